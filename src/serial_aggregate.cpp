@@ -0,0 +1,305 @@
+//
+//  serial_aggregate.cpp
+//
+//  Tumbling / sliding window statistics over numeric streams.
+//
+
+#include "serial_aggregate.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+// _channels = values per record
+// _window_ms = window length
+// _hop_ms = time between windows, 0 (or _window_ms) for tumbling
+// windows. Must divide _window_ms, it's rounded down to a divisor if not
+StreamAggregator::StreamAggregator(int _channels, int _window_ms, int _hop_ms)
+{
+    channels = std::max(1, _channels);
+    _window_ms = std::max(1, _window_ms);
+    if(_hop_ms <= 0 || _hop_ms > _window_ms)
+        _hop_ms = _window_ms;
+    while(_window_ms % _hop_ms != 0)
+        _hop_ms--;
+
+    panes = _window_ms / _hop_ms;
+    hop = std::chrono::milliseconds(_hop_ms);
+    started = false;
+    current = 0;
+    filled = 0;
+    emitted = 0;
+
+    size_t size = static_cast<size_t>(panes) * channels;
+    sum.assign(size, 0);
+    sumsq.assign(size, 0);
+    lo.assign(size, std::numeric_limits<double>::infinity());
+    hi.assign(size, -std::numeric_limits<double>::infinity());
+    n.assign(size, 0);
+
+    out.min.resize(channels);
+    out.max.resize(channels);
+    out.mean.resize(channels);
+    out.rms.resize(channels);
+    out.count.resize(channels);
+    counts.resize(channels);
+    parsed.resize(channels);
+}
+
+// Sets the function receiving each window as it closes. The window
+// object is reused, copy what's needed before returning.
+void StreamAggregator::set_handler(std::function<void(const AggregateWindow &)> handler)
+{
+    on_window = handler;
+}
+
+// Adds records (records x channels values, row by row) to the pane
+// being filled. Compilers won't vectorize the NaN checks and min / max
+// of doubles on their own (the comparisons may trap), so on x86 two
+// channels at a time go through SSE2, where min / max of a NaN and a
+// number give the number and an ordered compare masks NaNs out of the
+// sums.
+void StreamAggregator::accumulate(const double *values, int records)
+{
+    double *s = &sum[current * channels];
+    double *s2 = &sumsq[current * channels];
+    double *l = &lo[current * channels];
+    double *h = &hi[current * channels];
+    double *c = &n[current * channels];
+
+    for(int r = 0; r < records; r++)
+    {
+        const double *v = values + static_cast<size_t>(r) * channels;
+        int i = 0;
+
+#if defined(__SSE2__)
+        const __m128d one = _mm_set1_pd(1.0);
+        for(; i + 2 <= channels; i += 2)
+        {
+            __m128d x = _mm_loadu_pd(v + i);
+            __m128d ok = _mm_cmpord_pd(x, x);   // All ones unless NaN
+            __m128d y = _mm_and_pd(x, ok);
+            _mm_storeu_pd(s + i, _mm_add_pd(_mm_loadu_pd(s + i), y));
+            _mm_storeu_pd(s2 + i, _mm_add_pd(_mm_loadu_pd(s2 + i), _mm_mul_pd(y, y)));
+            _mm_storeu_pd(l + i, _mm_min_pd(x, _mm_loadu_pd(l + i)));  // NaN x gives l
+            _mm_storeu_pd(h + i, _mm_max_pd(x, _mm_loadu_pd(h + i)));
+            _mm_storeu_pd(c + i, _mm_add_pd(_mm_loadu_pd(c + i), _mm_and_pd(ok, one)));
+        }
+#endif
+        for(; i < channels; i++)
+        {
+            double x = v[i];
+            bool ok = x == x;                   // false for NaN
+            double y = ok ? x : 0.0;
+            s[i] += y;
+            s2[i] += y * y;
+            l[i] = x < l[i] ? x : l[i];         // Comparisons with NaN are false
+            h[i] = x > h[i] ? x : h[i];
+            c[i] += ok ? 1.0 : 0.0;
+        }
+    }
+}
+
+// Combines the last panes into the output window and hands it over
+void StreamAggregator::emit()
+{
+    const double inf = std::numeric_limits<double>::infinity();
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    double total = 0;
+
+    for(int i = 0; i < channels; i++)
+    {
+        out.min[i] = inf;
+        out.max[i] = -inf;
+        out.mean[i] = 0;        // Sum for now
+        out.rms[i] = 0;         // Sum of squares for now
+    }
+    std::fill(counts.begin(), counts.end(), 0.0);
+
+    for(int p = 0; p < panes; p++)
+    {
+        const double *s = &sum[p * channels];
+        const double *s2 = &sumsq[p * channels];
+        const double *l = &lo[p * channels];
+        const double *h = &hi[p * channels];
+        const double *c = &n[p * channels];
+        for(int i = 0; i < channels; i++)
+        {
+            out.mean[i] += s[i];
+            out.rms[i] += s2[i];
+            out.min[i] = std::min(out.min[i], l[i]);
+            out.max[i] = std::max(out.max[i], h[i]);
+            counts[i] += c[i];
+        }
+    }
+
+    for(int i = 0; i < channels; i++)
+    {
+        total += counts[i];
+        out.count[i] = static_cast<unsigned long>(counts[i]);
+        if(counts[i] > 0) {
+            out.mean[i] /= counts[i];
+            out.rms[i] = std::sqrt(out.rms[i] / counts[i]);
+        }
+        else
+            out.min[i] = out.max[i] = out.mean[i] = out.rms[i] = nan;
+    }
+    if(total == 0)
+        return;                 // Nothing in this window
+
+    out.end = pane_start + hop;
+    out.start = out.end - hop * panes;
+    emitted++;
+    if(on_window)
+        on_window(out);
+}
+
+// Ends the pane being filled: emits the window ending with it (once
+// enough panes exist for a full window) and starts the next pane
+void StreamAggregator::close_pane()
+{
+    if(filled < panes)
+        filled++;
+    if(filled == panes)
+        this->emit();
+
+    pane_start += hop;
+    current = (current + 1) % panes;
+
+    size_t at = static_cast<size_t>(current) * channels;
+    std::fill(sum.begin() + at, sum.begin() + at + channels, 0.0);
+    std::fill(sumsq.begin() + at, sumsq.begin() + at + channels, 0.0);
+    std::fill(lo.begin() + at, lo.begin() + at + channels, std::numeric_limits<double>::infinity());
+    std::fill(hi.begin() + at, hi.begin() + at + channels, -std::numeric_limits<double>::infinity());
+    std::fill(n.begin() + at, n.begin() + at + channels, 0.0);
+}
+
+// Closes every window ending at or before now, emitting those holding
+// samples. Called by push() with the sample times, call it directly to
+// get the last windows out of a stream that stopped.
+void StreamAggregator::flush(SerialClock::time_point now)
+{
+    if(!started)
+        return;
+
+    // After a long gap, the windows in between are empty: jump over them
+    // instead of closing them one by one
+    SerialClock::duration behind = now - pane_start;
+    if(behind > hop * (panes + 1)) {
+        for(int p = 0; p < panes; p++)
+            this->close_pane();
+        pane_start += ((now - pane_start) / hop) * hop;
+    }
+
+    while(now >= pane_start + hop)
+        this->close_pane();
+}
+
+// Adds one record of channels values taken at time. Records must come
+// in time order.
+void StreamAggregator::push(SerialClock::time_point time, const double *values)
+{
+    if(!started) {
+        pane_start = time;
+        started = true;
+    }
+    this->flush(time);
+    this->accumulate(values, 1);
+}
+
+// Adds records taken every period starting at first (records x channels
+// values, row by row), a whole pane's worth of records per pass.
+void StreamAggregator::push_block(SerialClock::time_point first, SerialClock::duration period,
+                                  const double *values, int records)
+{
+    if(records <= 0)
+        return;
+    if(!started) {
+        pane_start = first;
+        started = true;
+    }
+
+    int done = 0;
+    while(done < records)
+    {
+        SerialClock::time_point t = first + period * done;
+        this->flush(t);
+
+        // Records left that still fall into this pane
+        int run = records - done;
+        if(period > SerialClock::duration::zero()) {
+            auto left = pane_start + hop - t;
+            run = static_cast<int>(std::min<long long>(run, (left - SerialClock::duration(1)) / period + 1));
+        }
+        this->accumulate(values + static_cast<size_t>(done) * channels, run);
+        done += run;
+    }
+}
+
+// Parses a text record: numbers separated by commas, semicolons, spaces
+// or tabs, one per channel. A tag in front of a number (eg "T=23.5") is
+// skipped, empty or unparseable fields count as missing values.
+// Returns the number of values parsed.
+int StreamAggregator::push_line(SerialClock::time_point time, const char *text, int len)
+{
+    const char *p = text;
+    const char *end = text + len;
+    int found = 0;
+
+    for(int i = 0; i < channels; i++)
+    {
+        while(p < end && (*p == ' ' || *p == '\t'))
+            p++;
+
+        const char *field_end = p;
+        while(field_end < end && *field_end != ',' && *field_end != ';' && *field_end != ' ' &&
+              *field_end != '\t' && *field_end != '\r' && *field_end != '\n')
+            field_end++;
+
+        const char *q = p;
+        while(q < field_end && !((*q >= '0' && *q <= '9') || *q == '-' || *q == '+' || *q == '.'))
+            q++;
+
+        // strtod() wants a terminated string, the line may not be
+        char field[64];
+        int flen = static_cast<int>(std::min<ptrdiff_t>(field_end - q, sizeof(field) - 1));
+        memcpy(field, q, flen);
+        field[flen] = 0;
+
+        char *stop;
+        double v = std::strtod(field, &stop);
+        if(flen > 0 && stop != field) {
+            parsed[i] = v;
+            found++;
+        }
+        else
+            parsed[i] = std::numeric_limits<double>::quiet_NaN();
+
+        p = field_end;
+        if(p < end && (*p == ',' || *p == ';'))
+            p++;
+    }
+
+    if(found > 0)
+        this->push(time, parsed.data());
+
+    return found;
+}
+
+// Reads a line from the port (waiting up to its timeout) and pushes it,
+// stamped with its arrival time.
+// Returns number of values parsed, -1 on error, -2 if timed out.
+int StreamAggregator::feed(SERIAL_PORT &port)
+{
+    line.clear();
+    int r = port.sreadline(line);
+    if(r < 0)
+        return r;
+
+    return this->push_line(port.last_rx_time(), line.data(), static_cast<int>(line.size()));
+}
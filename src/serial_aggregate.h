@@ -0,0 +1,84 @@
+//
+//  serial_aggregate.h
+//
+//  Downsampling stage for high rate numeric streams: per channel min,
+//  max, mean, RMS and count over tumbling or sliding time windows, so
+//  dashboards and storage only get one record per window instead of
+//  every raw sample.
+//
+//  Sliding windows are built from panes one hop long: each pane keeps
+//  the running sum, sum of squares, min, max and count of every channel,
+//  and a window is the combination of its last window / hop panes. The
+//  memory used is fixed (panes x channels), whatever the sample rate.
+//  Tumbling windows are the case hop = window, a single pane.
+//
+//  Per channel state is stored as plain arrays (one per statistic) and
+//  updated two channels per SSE2 instruction on x86 (plain loops
+//  elsewhere). push_block() takes a run of records at once for the
+//  highest rates.
+//
+//  Windows are aligned to the first sample and closed by the time of
+//  the samples themselves (use last_rx_time() or device time mapped
+//  with ClockSync), or by flush() when the stream goes quiet. Windows
+//  without any sample aren't emitted. A missing value (NaN, eg an
+//  empty field in a CSV line) is left out of its channel's statistics.
+//
+//  Single threaded.
+//
+
+#pragma once
+
+#include "serial_port.h"
+
+struct AggregateWindow
+{
+    SerialClock::time_point start;      // Window covers [start, end)
+    SerialClock::time_point end;
+    std::vector<double> min;            // Per channel, NaN if no samples
+    std::vector<double> max;
+    std::vector<double> mean;
+    std::vector<double> rms;
+    std::vector<unsigned long> count;
+};
+
+class StreamAggregator
+{
+public:
+    StreamAggregator(int _channels, int _window_ms = 100, int _hop_ms = 0);
+
+    void set_handler(std::function<void(const AggregateWindow &)> handler);    // Gets every window
+    void push(SerialClock::time_point time, const double *values);  // One record, all channels
+    void push_block(SerialClock::time_point first, SerialClock::duration period,
+                    const double *values, int records);             // records x channels, evenly spaced
+    int push_line(SerialClock::time_point time, const char *line, int len);    // Parse a text record
+    int feed(SERIAL_PORT &port);        // Read one line from the port and push it
+    void flush(SerialClock::time_point now = SerialClock::now());  // Close windows ending before now
+    unsigned long windows() const { return emitted; }   // Windows emitted so far
+
+private:
+    void accumulate(const double *values, int records);
+    void close_pane();
+    void emit();
+
+    int channels;
+    int panes;                          // Panes per window
+    SerialClock::duration hop;
+    SerialClock::time_point pane_start; // Start of the pane being filled
+    bool started;
+    int current;                        // Ring index of that pane
+    int filled;                         // Panes closed so far, up to panes
+
+    // Pane statistics, panes x channels each
+    std::vector<double> sum;
+    std::vector<double> sumsq;
+    std::vector<double> lo;
+    std::vector<double> hi;
+    std::vector<double> n;
+
+    std::vector<double> counts;         // emit() scratch
+    std::vector<double> parsed;         // push_line() scratch
+    std::string line;                   // feed() scratch
+    AggregateWindow out;
+    unsigned long emitted;
+    std::function<void(const AggregateWindow &)> on_window;
+};
@@ -0,0 +1,345 @@
+//
+//  serial_arq.cpp
+//
+//  Selective repeat ARQ (reliable delivery) over a serial link.
+//
+
+#include "serial_arq.h"
+
+#include <algorithm>
+#include <random>
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = static_cast<uint8_t>(v);
+    p[1] = static_cast<uint8_t>(v >> 8);
+    p[2] = static_cast<uint8_t>(v >> 16);
+    p[3] = static_cast<uint8_t>(v >> 24);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+// Tag of the DATA / ACK frames sent from one session to another. Not
+// symmetric, so frames from the old session going the other way don't
+// match either.
+static uint32_t session_tag(uint32_t from, uint32_t to)
+{
+    return from ^ (to * 0x9E3779B1u);
+}
+
+// _port = already opened serial port, with a short read timeout (eg 1ms)
+// as pump() reads once per call
+// _window = segments in flight before waiting for acks (1..ARQ_MAX_WINDOW).
+// Pick it so window * max_payload covers the bytes the link carries in
+// one round trip (including the peer's ack delay), or more on lossy links
+// so retransmits don't stall it
+// _max_payload = data bytes per segment (1..256)
+// _rto_ms = time without ack before a segment is sent again
+ArqLink::ArqLink(SERIAL_PORT &_port, int _window, int _max_payload, int _rto_ms)
+    : port(_port), rto(_rto_ms), decoder(std::min(_max_payload, 256) + 10)
+{
+    window = std::max(1, std::min(_window, ARQ_MAX_WINDOW));
+    max_payload = std::max(1, std::min(_max_payload, 256));
+    tx_slots.resize(256);
+    rx_slots.resize(256);
+    tx_base = tx_next = 0;
+    rx_base = 0;
+    resent = 0;
+
+    std::random_device rd;
+    session = rd() ^ static_cast<uint32_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+    if(session == 0)
+        session = 1;
+    peer_session = 0;
+    session_resets = 0;
+    bad_frames = 0;
+}
+
+// True if seq lies in the window starting at base (modulo 256)
+bool ArqLink::in_window(uint8_t seq, uint8_t base) const
+{
+    return static_cast<uint8_t>(seq - base) < window;
+}
+
+// Queues bytes for reliable delivery, pump() sends them
+int ArqLink::send(const uint8_t *buf, int len)
+{
+    tx_queue.insert(tx_queue.end(), buf, buf + len);
+    return len;
+}
+
+int ArqLink::send(const std::string str)
+{
+    return this->send(reinterpret_cast<const uint8_t *>(str.data()),
+                      static_cast<int>(str.size()));
+}
+
+int ArqLink::tx_pending() const
+{
+    int total = static_cast<int>(tx_queue.size());
+    for(uint8_t s = tx_base; s != tx_next; s++)
+    {
+        if(!tx_slots[s].acked)
+            total += static_cast<int>(tx_slots[s].data.size());
+    }
+    return total;
+}
+
+// Appends a framed DATA or ACK to this round's output
+void ArqLink::queue_frame(uint8_t type, uint8_t seq, const uint8_t *data, int len)
+{
+    uint8_t payload[6 + 256 + 4];
+    int n = 6;
+
+    payload[0] = type;
+    put32(payload + 1, session_tag(session, peer_session));
+    payload[5] = seq;
+    if(len > 0) {
+        memcpy(payload + 6, data, len);
+        n += len;
+    }
+    put32(payload + n, crc32_ieee(payload, n));
+    frame_encode(payload, n + 4, out);
+}
+
+// Appends a SYN with our id and the peer's id as we know it
+void ArqLink::queue_syn()
+{
+    uint8_t payload[9 + 4];
+
+    payload[0] = ARQ_SYN;
+    put32(payload + 1, session);
+    put32(payload + 5, peer_session);
+    put32(payload + 9, crc32_ieee(payload, 9));
+    frame_encode(payload, sizeof(payload), out);
+    syn_at = std::chrono::steady_clock::now();
+}
+
+// Starts both windows over at sequence 0 for a new peer session. Data
+// the old peer hadn't received in order goes back in front of the
+// queue, to be sent to the new one.
+void ArqLink::reset_windows()
+{
+    for(uint8_t s = tx_next; s != tx_base; )
+    {
+        s--;
+        tx_queue.insert(tx_queue.begin(), tx_slots[s].data.begin(), tx_slots[s].data.end());
+    }
+    for(Segment &seg : tx_slots)
+    {
+        seg.data.clear();
+        seg.acked = false;
+    }
+    for(Segment &seg : rx_slots)
+        seg.valid = false;
+
+    tx_base = tx_next = 0;
+    rx_base = 0;
+}
+
+// SYN from the peer: a new id means it (re)started, so both windows
+// start over. Answers with our own SYN unless the peer already knows
+// our id.
+void ArqLink::on_syn(uint32_t from, uint32_t echo)
+{
+    if(from == 0)
+        return;
+
+    if(from != peer_session) {
+#if PORTCON_DEBUG
+        if(peer_session != 0)
+            std::cerr << "ArqLink: peer restarted, resetting the session" << std::endl;
+#endif
+        if(peer_session != 0)
+            session_resets++;
+        peer_session = from;
+        this->reset_windows();
+    }
+    if(echo != session)
+        this->queue_syn();
+}
+
+void ArqLink::on_frame(const uint8_t *payload, int len)
+{
+    if(len < 5 || crc32_ieee(payload, len - 4) != get32(payload + len - 4)) {
+        bad_frames++;
+        return;
+    }
+    len -= 4;
+
+    if(payload[0] == ARQ_SYN) {
+        if(len >= 9)
+            this->on_syn(get32(payload + 1), get32(payload + 5));
+        return;
+    }
+    if(len < 6) {
+        bad_frames++;
+        return;
+    }
+
+    // From another session (ours or the peer's restarted). Tell the
+    // peer who we are, at most once per rto, in case it's the one that
+    // missed a restart
+    if(peer_session == 0 || get32(payload + 1) != session_tag(peer_session, session)) {
+        if(std::chrono::steady_clock::now() - syn_at >= rto)
+            this->queue_syn();
+        return;
+    }
+
+    uint8_t seq = payload[5];
+
+    if(payload[0] == ARQ_DATA) {
+        if(in_window(seq, rx_base) && !rx_slots[seq].valid) {
+            rx_slots[seq].data.assign(payload + 6, payload + len);
+            rx_slots[seq].valid = true;
+
+            // Deliver whatever is now in order
+            while(rx_slots[rx_base].valid)
+            {
+                Segment &s = rx_slots[rx_base];
+                rx_data.insert(rx_data.end(), s.data.begin(), s.data.end());
+                s.valid = false;
+                rx_base++;
+            }
+        }
+        // Ack new segments and duplicates alike (our earlier ack may have
+        // been lost). Anything else is from outside both windows, ignore it
+        if(in_window(seq, rx_base) || in_window(seq, rx_base - window)) {
+            uint8_t ack[1] = {rx_base};
+            queue_frame(ARQ_ACK, seq, ack, 1);
+        }
+    }
+    else if(payload[0] == ARQ_ACK && len >= 7) {
+        uint8_t next = payload[6];
+        uint8_t in_flight = tx_next - tx_base;
+
+        if(static_cast<uint8_t>(seq - tx_base) < in_flight && !tx_slots[seq].acked) {
+            tx_slots[seq].acked = true;
+
+            // The link doesn't reorder, so an unacked segment sent before
+            // this one was lost. Resend it now rather than at its timeout
+            for(uint8_t s = tx_base; s != seq; s++)
+            {
+                Segment &seg = tx_slots[s];
+                if(!seg.acked && seg.sent_at <= tx_slots[seq].sent_at)
+                    seg.sent_at -= rto;
+            }
+        }
+        if(static_cast<uint8_t>(next - tx_base) <= in_flight) {
+            for(uint8_t s = tx_base; s != next; s++)
+                tx_slots[s].acked = true;
+        }
+        while(tx_base != tx_next && tx_slots[tx_base].acked)
+        {
+            tx_slots[tx_base].data.clear();
+            tx_base++;
+        }
+    }
+}
+
+// One round of the protocol: reads once from the port and handles the
+// frames received, resends segments whose ack is overdue, sends new
+// segments while the window has room and writes it all in one go.
+// Until the peer's session id is known it only sends a SYN every rto.
+// Returns number of bytes written, -1 on error.
+int ArqLink::pump()
+{
+    uint8_t buf[512];
+    int n = port.sread(buf, sizeof(buf));
+    if(n == -1)
+        return -1;
+    if(n > 0)
+        decoder.feed(buf, n,
+            [this](const uint8_t *payload, int len) { this->on_frame(payload, len); });
+
+    auto now = std::chrono::steady_clock::now();
+
+    if(!this->connected()) {
+        if(now - syn_at >= rto)
+            this->queue_syn();
+    }
+    else {
+        this->send_segments(now);
+    }
+
+    if(out.empty())
+        return 0;
+
+    int w = port.swrite(out.data(), static_cast<int>(out.size()));
+    out.clear();
+
+    return w < 0 ? -1 : w;
+}
+
+// Queues the overdue segments again, then new segments while the window
+// has room
+void ArqLink::send_segments(std::chrono::steady_clock::time_point now)
+{
+    // Selective repeat: only the overdue segments go again
+    for(uint8_t s = tx_base; s != tx_next; s++)
+    {
+        Segment &seg = tx_slots[s];
+        if(!seg.acked && now - seg.sent_at >= rto) {
+            queue_frame(ARQ_DATA, s, seg.data.data(), static_cast<int>(seg.data.size()));
+            seg.sent_at = now;
+            resent++;
+        }
+    }
+
+    while(!tx_queue.empty() && static_cast<uint8_t>(tx_next - tx_base) < window)
+    {
+        Segment &seg = tx_slots[tx_next];
+        size_t count = std::min(tx_queue.size(), static_cast<size_t>(max_payload));
+        seg.data.assign(tx_queue.begin(), tx_queue.begin() + count);
+        tx_queue.erase(tx_queue.begin(), tx_queue.begin() + count);
+        seg.acked = false;
+        seg.sent_at = now;
+        queue_frame(ARQ_DATA, tx_next, seg.data.data(), static_cast<int>(count));
+        tx_next++;
+    }
+}
+
+// Pumps until all queued data is acknowledged.
+// Returns 0 if OK, -1 on error, -2 if timeout_ms expired first.
+int ArqLink::flush(int timeout_ms)
+{
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(timeout_ms);
+
+    while(!tx_queue.empty() || tx_base != tx_next)
+    {
+        if(this->pump() == -1)
+            return -1;
+        if(std::chrono::steady_clock::now() >= deadline) {
+#if PORTCON_DEBUG
+            std::cerr << "ArqLink flush: " << this->tx_pending() <<
+                " bytes still unacknowledged" << std::endl;
+#endif
+            return -2;
+        }
+    }
+
+    return 0;
+}
+
+// Reads up to max_size bytes of in order data into vec_bytes, pumping
+// once if none is waiting. Returns number of bytes read, -1 on error,
+// -2 if nothing arrived.
+int ArqLink::receive(std::vector<uint8_t> &vec_bytes, int max_size)
+{
+    if(rx_data.empty()) {
+        if(this->pump() == -1)
+            return -1;
+    }
+    if(rx_data.empty())
+        return -2;
+
+    int count = std::min(max_size, static_cast<int>(rx_data.size()));
+    vec_bytes.insert(vec_bytes.end(), rx_data.begin(), rx_data.begin() + count);
+    rx_data.erase(rx_data.begin(), rx_data.begin() + count);
+
+    return count;
+}
@@ -0,0 +1,103 @@
+//
+//  serial_arq.h
+//
+//  Reliable byte stream over a serial link that corrupts or drops
+//  bytes (long USB runs, noisy RS-485 converters, ...). Data is cut
+//  into numbered segments, each sent in its own CRC checked frame (see
+//  serial_frame.h), and a selective repeat sliding window resends only
+//  the segments that weren't acknowledged, while up to window segments
+//  stay in flight so the link keeps running during recovery.
+//
+//  Both ends run an ArqLink with the same window and payload size.
+//  Each ArqLink draws a random session id when created. Before any data
+//  flows the two ends swap ids in SYN frames, and every DATA / ACK
+//  carries a tag derived from both ids. When either end restarts it
+//  comes up with a new id: its SYN makes the other end reset both
+//  windows to sequence 0, and frames still in flight from the old
+//  session no longer match the tag and are thrown away, so a restart
+//  neither wedges the windows nor delivers stale data. Data the old
+//  peer hadn't received in order is sent again to the new one.
+//
+//  Frame payloads, each followed by a CRC-32 of the bytes before it (on
+//  top of the frame's CRC16, which lets too much through on a noisy
+//  line):
+//    SYN  : ARQ_SYN session peer   (peer = the other end's id as far
+//                                   as we know, 0 if none yet)
+//    DATA : ARQ_DATA tag seq data...
+//    ACK  : ARQ_ACK tag seq next   (seq = segment received, next = first
+//                                   segment not yet received in order)
+//  Ids and tags are 4 bytes, little endian.
+//
+//  Single threaded: send(), receive() and pump() must be called from
+//  the same thread.
+//
+
+#pragma once
+
+#include "serial_port.h"
+#include "serial_frame.h"
+
+#include <chrono>
+#include <deque>
+
+#define ARQ_DATA 0x01
+#define ARQ_ACK 0x02
+#define ARQ_SYN 0x03
+#define ARQ_MAX_WINDOW 128      // Half the 8 bit sequence space
+
+class ArqLink
+{
+public:
+    ArqLink(SERIAL_PORT &_port, int _window = 16, int _max_payload = 128, int _rto_ms = 100);
+
+    int send(const uint8_t *buf, int len);              // Queue bytes for reliable delivery
+    int send(const std::string str);                    // Queue string for reliable delivery
+    int receive(std::vector<uint8_t> &vec_bytes, int max_size = 256);   // Get in order data
+    int pump();                         // Read input, (re)transmit segments
+    int flush(int timeout_ms = 1000);   // Pump until everything queued is acknowledged
+    int tx_pending() const;             // Bytes queued or in flight, not yet acknowledged
+    bool connected() const { return peer_session != 0; }   // Sessions swapped, data can flow
+    unsigned long retransmits() const { return resent; }    // Segments sent again so far
+    unsigned long resets() const { return session_resets; } // Peer restarts seen so far
+    unsigned long errors() const { return decoder.errors() + bad_frames; }  // Damaged frames dropped
+
+private:
+    struct Segment
+    {
+        std::vector<uint8_t> data;
+        std::chrono::steady_clock::time_point sent_at;
+        bool acked = false;
+        bool valid = false;     // Receive side: segment held for in order delivery
+    };
+
+    void on_frame(const uint8_t *payload, int len);
+    void on_syn(uint32_t from, uint32_t echo);
+    void queue_frame(uint8_t type, uint8_t seq, const uint8_t *data, int len);
+    void queue_syn();
+    void reset_windows();
+    void send_segments(std::chrono::steady_clock::time_point now);
+    bool in_window(uint8_t seq, uint8_t base) const;
+
+    SERIAL_PORT &port;
+    int window;
+    int max_payload;
+    std::chrono::milliseconds rto;
+    FrameDecoder decoder;
+    std::vector<uint8_t> out;           // Frames to write this round
+
+    uint32_t session;                   // Our id, random per ArqLink
+    uint32_t peer_session;              // The other end's id, 0 until it sent a SYN
+    std::chrono::steady_clock::time_point syn_at;   // Last SYN sent, they go at most once per rto
+    unsigned long session_resets;
+    unsigned long bad_frames;           // Failed the CRC-32, or malformed
+
+    std::deque<uint8_t> tx_queue;       // Bytes not yet cut into segments
+    std::vector<Segment> tx_slots;      // In flight segments, indexed by seq
+    uint8_t tx_base;                    // Oldest unacknowledged segment
+    uint8_t tx_next;                    // Next segment to send
+    unsigned long resent;
+
+    std::vector<Segment> rx_slots;      // Out of order segments, indexed by seq
+    uint8_t rx_base;                    // Next segment to deliver
+    std::vector<uint8_t> rx_data;       // Delivered data waiting for receive()
+};
@@ -0,0 +1,417 @@
+//
+//  serial_bridge.cpp
+//
+//  Serial to TCP bridge, one TCP port per serial device, all on one
+//  event loop.
+//
+
+#include "serial_bridge.h"
+
+#if defined(__APPLE__) || defined(__linux__)
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <signal.h>
+
+#define BRIDGE_CHUNK 65536
+#define BRIDGE_RETRY_MS 1000     // Between reopen attempts of a device that went away
+
+#if defined(MSG_NOSIGNAL)
+#define BRIDGE_NOSIGNAL MSG_NOSIGNAL
+#else
+#define BRIDGE_NOSIGNAL 0       // macOS: SO_NOSIGPIPE is set on the socket instead
+#endif
+
+#if defined(__linux__)
+// splice() to a socket has no MSG_NOSIGNAL and raises SIGPIPE when the
+// peer is gone. Blocks it for the call and takes back the one raised,
+// unless one was already pending. Returns what splice() returns.
+static ssize_t splice_nosignal(int pipe_rd, int sock, size_t len)
+{
+    sigset_t pipe_set, old_mask, pending;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &old_mask);
+    sigpending(&pending);
+    bool was_pending = sigismember(&pending, SIGPIPE);
+
+    ssize_t n = splice(pipe_rd, nullptr, sock, nullptr, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    int err = errno;
+
+    if(n < 0 && err == EPIPE && !was_pending) {
+        struct timespec zero = {0, 0};
+        sigtimedwait(&pipe_set, nullptr, &zero);
+    }
+    pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+    errno = err;
+
+    return n;
+}
+#endif
+
+SerialBridge::SerialBridge(const std::string _bind_address)
+{
+    bind_address = _bind_address;
+    running = false;
+}
+
+SerialBridge::~SerialBridge()
+{
+    for(Device &dev : devices)
+    {
+        this->drop_client(dev);
+        close(dev.listener);
+    }
+}
+
+// Exposes an already opened port on tcp_port. name is only used in
+// stats(). Returns the device index, -1 if the port can't be listened on.
+int SerialBridge::add_device(SerialPort &port, const std::string name, int tcp_port)
+{
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if(listener == -1)
+        return -1;
+
+    int on = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(tcp_port);
+    inet_pton(AF_INET, bind_address.c_str(), &addr.sin_addr);
+
+    if(bind(listener, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0 ||
+       listen(listener, 1) < 0) {
+#if PORTCON_DEBUG
+        std::cerr << "SerialBridge add_device: couldn't listen on port " <<
+            tcp_port << " " << strerror(errno) << std::endl;
+#endif
+        close(listener);
+        return -1;
+    }
+    fcntl(listener, F_SETFL, O_NONBLOCK);
+
+    Device dev;
+    dev.name = name;
+    dev.port = &port;
+    dev.tty = port.get_fd();
+    dev.tcp_port = tcp_port;
+    dev.listener = listener;
+    dev.client = -1;
+    dev.to_client.pipe_rd = dev.to_client.pipe_wr = -1;
+    dev.to_device.pipe_rd = dev.to_device.pipe_wr = -1;
+    devices.push_back(dev);
+
+    return static_cast<int>(devices.size()) - 1;
+}
+
+// Sets up a forwarding direction, with a pipe for splice() on Linux
+void SerialBridge::open_flow(Flow &flow, int src, int dst, bool dst_socket)
+{
+    flow.src = src;
+    flow.dst = dst;
+    flow.src_failed = false;
+    flow.dst_socket = dst_socket;
+    flow.use_splice = false;
+    flow.pipe_rd = flow.pipe_wr = -1;
+    flow.in_pipe = 0;
+    flow.buf_off = 0;
+    flow.buf_len = 0;
+    flow.bytes = 0;
+
+#if defined(__linux__)
+    int p[2];
+    if(pipe2(p, O_NONBLOCK) == 0) {
+        flow.pipe_rd = p[0];
+        flow.pipe_wr = p[1];
+        fcntl(flow.pipe_wr, F_SETPIPE_SZ, BRIDGE_CHUNK);
+        flow.use_splice = true;
+    }
+#endif
+    if(!flow.use_splice)
+        flow.buf.resize(BRIDGE_CHUNK);
+}
+
+void SerialBridge::close_flow(Flow &flow)
+{
+    if(flow.pipe_rd != -1) {
+        close(flow.pipe_rd);
+        close(flow.pipe_wr);
+    }
+    flow.pipe_rd = flow.pipe_wr = -1;
+    flow.in_pipe = 0;
+    flow.buf_len = 0;
+}
+
+// Moves data from src to dst without blocking, as much as both sides
+// take right now. Returns bytes delivered to dst, 0 if nothing moved,
+// -1 if either end is closed or failed (src_failed tells which).
+int SerialBridge::pump(Flow &flow)
+{
+    flow.src_failed = false;
+
+#if defined(__linux__)
+    if(flow.use_splice) {
+        if(flow.in_pipe == 0) {
+            ssize_t n = splice(flow.src, nullptr, flow.pipe_wr, nullptr, BRIDGE_CHUNK,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if(n == 0) {
+                flow.src_failed = true;
+                return -1;      // EOF
+            }
+            if(n < 0 && errno == EINVAL) {
+                // Kernel can't splice this fd, switch to read/write for good
+                this->close_flow(flow);
+                flow.use_splice = false;
+                flow.buf.resize(BRIDGE_CHUNK);
+                return this->pump(flow);
+            }
+            if(n < 0 && errno != EAGAIN) {
+                flow.src_failed = true;
+                return -1;
+            }
+            if(n > 0)
+                flow.in_pipe += static_cast<int>(n);
+        }
+        if(flow.in_pipe == 0)
+            return 0;
+
+        ssize_t n = flow.dst_socket ? splice_nosignal(flow.pipe_rd, flow.dst, flow.in_pipe) :
+                    splice(flow.pipe_rd, nullptr, flow.dst, nullptr, flow.in_pipe,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if(n < 0 && errno == EINVAL) {
+            // Destination can't be spliced to, move what's in the pipe to
+            // the fallback buffer and carry on with read/write for good
+            flow.buf.resize(BRIDGE_CHUNK);
+            ssize_t drained = read(flow.pipe_rd, flow.buf.data(), flow.in_pipe);
+            this->close_flow(flow);
+            flow.buf_off = 0;
+            flow.buf_len = (drained > 0) ? static_cast<int>(drained) : 0;
+            flow.use_splice = false;
+            return this->pump(flow);
+        }
+        if(n < 0)
+            return (errno == EAGAIN) ? 0 : -1;
+
+        flow.in_pipe -= static_cast<int>(n);
+        flow.bytes += n;
+        return static_cast<int>(n);
+    }
+#endif
+
+    if(flow.buf_len == 0) {
+        ssize_t n = read(flow.src, flow.buf.data(), flow.buf.size());
+        if(n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            flow.src_failed = true;
+            return -1;          // EOF or error
+        }
+        if(n < 0)
+            return 0;
+        flow.buf_off = 0;
+        flow.buf_len = static_cast<int>(n);
+    }
+
+    ssize_t n = flow.dst_socket ?
+                send(flow.dst, flow.buf.data() + flow.buf_off, flow.buf_len, BRIDGE_NOSIGNAL) :
+                write(flow.dst, flow.buf.data() + flow.buf_off, flow.buf_len);
+    if(n < 0)
+        return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+
+    flow.buf_off += static_cast<int>(n);
+    flow.buf_len -= static_cast<int>(n);
+    flow.bytes += n;
+
+    return static_cast<int>(n);
+}
+
+// Accepts a client on the device's port. Only one client at a time,
+// later ones are turned away until it disconnects.
+void SerialBridge::accept_client(Device &dev)
+{
+    int sock = accept(dev.listener, nullptr, nullptr);
+    if(sock == -1)
+        return;
+    if(dev.client != -1) {
+        close(sock);            // Busy
+        return;
+    }
+
+    fcntl(sock, F_SETFL, O_NONBLOCK);
+    int on = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+#if defined(SO_NOSIGPIPE)
+    setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+    dev.client = sock;
+    dev.since = std::chrono::steady_clock::now();
+    this->open_flow(dev.to_client, dev.tty, sock, true);
+    this->open_flow(dev.to_device, sock, dev.tty, false);
+}
+
+void SerialBridge::drop_client(Device &dev)
+{
+    if(dev.client == -1)
+        return;
+
+    this->close_flow(dev.to_client);
+    this->close_flow(dev.to_device);
+    close(dev.client);
+    dev.client = -1;
+}
+
+// The device hung up or failed: drops its client and closes the port,
+// check_device() reopens it
+void SerialBridge::lose_device(Device &dev)
+{
+#if PORTCON_DEBUG
+    std::cerr << "SerialBridge: " << dev.name << " went away, reopening every " <<
+        BRIDGE_RETRY_MS << " ms" << std::endl;
+#endif
+    this->drop_client(dev);
+    dev.port->sclose();
+    dev.tty = -1;
+    dev.retry = std::chrono::steady_clock::now() + std::chrono::milliseconds(BRIDGE_RETRY_MS);
+}
+
+// Picks up the port's current fd. A port closed (by lose_device() or
+// by its owner) is reopened every BRIDGE_RETRY_MS; a port reopened
+// behind the bridge's back drops the client, whose flows still point
+// at the old fd.
+void SerialBridge::check_device(Device &dev)
+{
+    int fd = dev.port->get_fd();
+
+    if(fd == -1 && std::chrono::steady_clock::now() >= dev.retry) {
+        dev.retry = std::chrono::steady_clock::now() + std::chrono::milliseconds(BRIDGE_RETRY_MS);
+        dev.port->open_port();
+        fd = dev.port->get_fd();
+    }
+    if(fd != dev.tty) {
+        this->drop_client(dev);
+        dev.tty = fd;
+    }
+}
+
+// Runs one pass of the event loop: waits up to timeout_ms for any
+// socket or tty to be ready, then moves whatever can be moved.
+// Returns number of bytes forwarded, -1 on poll() failure.
+int SerialBridge::run_once(int timeout_ms)
+{
+    std::vector<struct pollfd> fds;
+    fds.reserve(devices.size() * 3);
+
+    // Per device: listener, tty, client. While a direction has data
+    // waiting for its destination, watch that for POLLOUT instead of
+    // reading more from the source. Unwatched entries get fd -1, so a
+    // hung up tty doesn't make poll() return at once on every pass.
+    // While the tty is closed the listener isn't watched either, so new
+    // clients wait in the backlog until it's back.
+    for(Device &dev : devices)
+    {
+        this->check_device(dev);
+        if(dev.tty == -1)
+            timeout_ms = std::min(timeout_ms < 0 ? BRIDGE_RETRY_MS : timeout_ms, BRIDGE_RETRY_MS);
+
+        struct pollfd l = { dev.tty != -1 ? dev.listener : -1, POLLIN, 0 };
+        struct pollfd t = { -1, 0, 0 };
+        struct pollfd c = { dev.client, 0, 0 };
+
+        if(dev.client != -1) {
+            if(pending(dev.to_client)) c.events |= POLLOUT; else t.events |= POLLIN;
+            if(pending(dev.to_device)) t.events |= POLLOUT; else c.events |= POLLIN;
+            t.fd = dev.tty;
+        }
+        fds.push_back(l);
+        fds.push_back(t);
+        fds.push_back(c);
+    }
+
+    if(poll(fds.data(), fds.size(), timeout_ms) < 0)
+        return (errno == EINTR) ? 0 : -1;
+
+    int moved = 0;
+    for(size_t i = 0; i < devices.size(); i++)
+    {
+        Device &dev = devices[i];
+        short t = fds[i * 3 + 1].revents;
+        short c = fds[i * 3 + 2].revents;
+
+        if(fds[i * 3].revents & POLLIN)
+            this->accept_client(dev);
+        if(dev.client == -1 || fds[i * 3 + 2].fd == -1)
+            continue;           // No client, or it just connected
+
+        if(t & POLLNVAL) {
+            this->lose_device(dev);         // fd closed under us
+            continue;
+        }
+        if(t & (POLLIN | POLLHUP | POLLERR) || c & POLLOUT) {
+            int n = this->pump(dev.to_client);
+            if(n < 0 && dev.to_client.src_failed) {
+                this->lose_device(dev);     // Device hung up
+                continue;
+            }
+            if(n < 0) {
+                this->drop_client(dev);     // Client went away (EPIPE, ECONNRESET)
+                continue;
+            }
+            moved += (n > 0) ? n : 0;
+        }
+        if(c & (POLLIN | POLLHUP | POLLERR) || t & POLLOUT) {
+            int n = this->pump(dev.to_device);
+            if(n < 0 && !dev.to_device.src_failed) {
+                this->lose_device(dev);     // Write to the device failed
+                continue;
+            }
+            if(n < 0) {
+                this->drop_client(dev);     // Client went away
+                continue;
+            }
+            moved += n;
+        }
+    }
+
+    return moved;
+}
+
+// Runs the event loop until stop() is called
+void SerialBridge::run()
+{
+    running = true;
+    while(running)
+    {
+        if(this->run_once(100) < 0)
+            break;
+    }
+}
+
+// Returns per device counters and throughput of the current connection
+std::vector<BridgeStats> SerialBridge::stats()
+{
+    std::vector<BridgeStats> result;
+    auto now = std::chrono::steady_clock::now();
+
+    for(const Device &dev : devices)
+    {
+        BridgeStats st;
+        st.device = dev.name;
+        st.tcp_port = dev.tcp_port;
+        st.connected = (dev.client != -1);
+        st.to_client = st.connected ? dev.to_client.bytes : 0;
+        st.to_device = st.connected ? dev.to_device.bytes : 0;
+
+        double secs = st.connected ?
+            std::chrono::duration<double>(now - dev.since).count() : 0;
+        st.to_client_rate = (secs > 0) ? st.to_client / secs : 0;
+        st.to_device_rate = (secs > 0) ? st.to_device / secs : 0;
+        result.push_back(st);
+    }
+
+    return result;
+}
+
+#endif
@@ -0,0 +1,103 @@
+//
+//  serial_bridge.h
+//
+//  Serial to TCP bridge (like ser2net). Each added device is exposed on
+//  its own TCP port; one client at a time can connect to it and bytes
+//  are forwarded both ways. All devices share one poll() event loop.
+//
+//  On Linux the forwarding goes through splice() and a pipe, so the data
+//  never passes through user space. When the kernel refuses to splice a
+//  given fd (older tty drivers do) that direction falls back to plain
+//  read()/write() with a 64KB buffer.
+//
+//  The bridge drives the port's fd directly, so SerialPort's own read
+//  path (reconnect, etc) is bypassed while it runs. Instead, when the
+//  device hangs up the bridge drops its client, closes the port and
+//  tries to reopen it every second; clients connecting in the meantime
+//  wait in the listen backlog until it is back.
+//
+//  A client that disconnects while data is on its way to it is dropped
+//  like one that closed normally: writes to it never raise SIGPIPE, so
+//  the program doesn't need to ignore that signal.
+//
+//  macOS / Linux only.
+//
+
+#pragma once
+
+#include "serial_port.h"
+
+#if defined(__APPLE__) || defined(__linux__)
+
+#include <chrono>
+
+struct BridgeStats
+{
+    std::string device;         // Serial port name
+    int tcp_port;
+    bool connected;             // A client is connected
+    unsigned long long to_client;   // Bytes device -> client, current connection
+    unsigned long long to_device;   // Bytes client -> device, current connection
+    double to_client_rate;      // Bytes/s over the current connection
+    double to_device_rate;
+};
+
+class SerialBridge
+{
+public:
+    SerialBridge(const std::string _bind_address = "127.0.0.1");
+    ~SerialBridge();
+
+    int add_device(SerialPort &port, const std::string name, int tcp_port); // Expose a port
+    int run_once(int timeout_ms);       // One pass of the event loop
+    void run();                         // Loop until stop()
+    void stop() { running = false; }    // Safe to call from any thread
+    std::vector<BridgeStats> stats();   // Per device counters
+
+private:
+    // One forwarding direction, src -> dst
+    struct Flow
+    {
+        int src;
+        int dst;
+        bool src_failed;        // Last -1 from pump() came from src (EOF or error)
+        bool dst_socket;        // dst is the client, written without raising SIGPIPE
+        bool use_splice;
+        int pipe_rd;            // splice() goes src -> pipe -> dst
+        int pipe_wr;
+        int in_pipe;            // Bytes sitting in the pipe
+        std::vector<uint8_t> buf;   // Fallback buffer
+        int buf_off;
+        int buf_len;
+        unsigned long long bytes;
+    };
+
+    struct Device
+    {
+        std::string name;
+        SerialPort *port;
+        int tty;                // Port fd the flows were set up with
+        int tcp_port;
+        int listener;
+        int client;
+        Flow to_client;
+        Flow to_device;
+        std::chrono::steady_clock::time_point since;
+        std::chrono::steady_clock::time_point retry;   // Next reopen attempt while the port is closed
+    };
+
+    void open_flow(Flow &flow, int src, int dst, bool dst_socket);
+    void close_flow(Flow &flow);
+    int pump(Flow &flow);
+    bool pending(const Flow &flow) const { return flow.in_pipe > 0 || flow.buf_len > 0; }
+    void accept_client(Device &dev);
+    void drop_client(Device &dev);
+    void lose_device(Device &dev);
+    void check_device(Device &dev);
+
+    std::string bind_address;
+    std::vector<Device> devices;
+    std::atomic<bool> running;
+};
+
+#endif
@@ -0,0 +1,246 @@
+//
+//  serial_channels.cpp
+//
+//  Multiplexed logical channels with priority scheduling over one
+//  serial link.
+//
+
+#include "serial_channels.h"
+
+#include <algorithm>
+
+// _port = already opened serial port, preferably with a short read
+// timeout so pump() doesn't hold up sending while waiting for input
+// _max_fragment = data bytes per frame. Smaller fragments lower the
+// control latency at the cost of 5-6 bytes of framing each
+// _tx_watermark = bytes allowed in the OS transmit queue before pump()
+// stops handing it fragments
+ChannelLink::ChannelLink(SERIAL_PORT &_port, int _max_fragment, int _tx_watermark)
+    : port(_port), decoder(_max_fragment + 2)
+{
+    max_fragment = _max_fragment;
+    tx_watermark = _tx_watermark;
+    rx_dropped = 0;
+}
+
+// Registers channel id (0..CHANNEL_MAX) with the given priority, higher
+// values are sent first. Channels of equal priority are served in the
+// order they were added. Both ends must add the same channels.
+// max_message = longest message accepted when reassembling input.
+// Returns 0 if OK, -1 on error.
+int ChannelLink::add_channel(uint8_t id, int priority, int max_message)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    if(id > CHANNEL_MAX || this->find(id)) {
+#if PORTCON_DEBUG
+        std::cerr << "ChannelLink: invalid or duplicate channel " << int(id) << std::endl;
+#endif
+        return -1;
+    }
+
+    Channel ch;
+    ch.id = id;
+    ch.priority = priority;
+    ch.max_message = max_message;
+    ch.tx_offset = 0;
+    ch.tx_seq = 0;
+    ch.rx_seq = 0;
+    ch.rx_active = false;
+
+    auto pos = std::find_if(channels.begin(), channels.end(),
+        [priority](const Channel &c) { return c.priority < priority; });
+    channels.insert(pos, std::move(ch));
+
+    return 0;
+}
+
+ChannelLink::Channel *ChannelLink::find(uint8_t id)
+{
+    for(auto &ch : channels)
+    {
+        if(ch.id == id)
+            return &ch;
+    }
+    return NULL;
+}
+
+// Queues a message on channel id, pump() sends it. Safe to call from
+// other threads while one thread runs pump().
+// Returns len if OK, -1 on unknown channel.
+int ChannelLink::send(uint8_t id, const uint8_t *buf, int len)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    Channel *ch = this->find(id);
+    if(!ch)
+        return -1;
+
+    ch->tx.push_back(std::vector<uint8_t>(buf, buf + len));
+
+    return len;
+}
+
+// Queues a string on channel id
+int ChannelLink::send(uint8_t id, const std::string str)
+{
+    return this->send(id, reinterpret_cast<const uint8_t *>(str.data()),
+                      static_cast<int>(str.size()));
+}
+
+// Bytes of channel id not yet handed to the port, -1 on unknown channel
+int ChannelLink::tx_pending(uint8_t id)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    Channel *ch = this->find(id);
+    if(!ch)
+        return -1;
+
+    size_t total = 0;
+    for(auto &msg : ch->tx)
+        total += msg.size();
+
+    return static_cast<int>(total - ch->tx_offset);
+}
+
+// Hands fragments to the port, highest priority first, until the OS
+// transmit queue reaches the watermark or nothing is left. Drivers that
+// don't report their queue (ptys, some USB adapters) always return 0, so
+// a round also stops after writing tx_watermark bytes.
+// Returns number of fragments written, -1 on error.
+int ChannelLink::send_fragments()
+{
+    int sent = 0;
+    int written = 0;
+    std::vector<uint8_t> frame;
+    std::vector<uint8_t> payload;
+
+    while(written < tx_watermark && port.soutput_pending() < tx_watermark)
+    {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+
+            // Re-pick every fragment, a new control message may have arrived
+            auto ch = std::find_if(channels.begin(), channels.end(),
+                [](const Channel &c) { return !c.tx.empty(); });
+            if(ch == channels.end())
+                break;
+
+            std::vector<uint8_t> &msg = ch->tx.front();
+            size_t count = std::min(msg.size() - ch->tx_offset, static_cast<size_t>(max_fragment));
+            bool more = ch->tx_offset + count < msg.size();
+
+            payload.assign(1, static_cast<uint8_t>(ch->id | (more ? CHANNEL_MORE : 0)));
+            payload.push_back(static_cast<uint8_t>((ch->tx_seq & CHANNEL_SEQ_MASK) |
+                                                   (ch->tx_offset == 0 ? CHANNEL_FIRST : 0)));
+            ch->tx_seq++;
+            payload.insert(payload.end(), msg.begin() + ch->tx_offset,
+                           msg.begin() + ch->tx_offset + count);
+            if(more)
+                ch->tx_offset += count;
+            else {
+                ch->tx.pop_front();
+                ch->tx_offset = 0;
+            }
+        }
+
+        frame.clear();
+        frame_encode(payload.data(), static_cast<int>(payload.size()), frame);
+        int n = port.swrite(frame.data(), static_cast<int>(frame.size()));
+        if(n < 0)
+            return -1;
+        written += n;
+        sent++;
+    }
+
+    return sent;
+}
+
+// Reassembles an inbound fragment into its channel's queue. A gap in
+// the fragment counter drops the message being reassembled, and the
+// channel then skips fragments until the next message starts.
+void ChannelLink::on_frame(const uint8_t *payload, int len)
+{
+    if(len < 2) {
+        rx_dropped++;
+        return;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+
+    Channel *ch = this->find(payload[0] & ~CHANNEL_MORE);
+    if(!ch) {
+        rx_dropped++;
+        return;
+    }
+
+    uint8_t seq = payload[1] & CHANNEL_SEQ_MASK;
+    if(payload[1] & CHANNEL_FIRST) {
+        if(ch->rx_active)
+            rx_dropped++;           // Previous message lost its last fragment
+        ch->rx_partial.clear();
+        ch->rx_active = true;
+    }
+    else if(!ch->rx_active || seq != ch->rx_seq) {
+        if(ch->rx_active)
+            rx_dropped++;           // Gap, a fragment of this message was lost
+        ch->rx_partial.clear();
+        ch->rx_active = false;      // Wait for the next message start
+        return;
+    }
+    ch->rx_seq = (seq + 1) & CHANNEL_SEQ_MASK;
+
+    if(static_cast<int>(ch->rx_partial.size()) + len - 2 > ch->max_message) {
+        ch->rx_partial.clear();     // Drop it, the rest of it is skipped
+        ch->rx_active = false;      // until the next message start
+        rx_dropped++;
+        return;
+    }
+    ch->rx_partial.insert(ch->rx_partial.end(), payload + 2, payload + len);
+
+    if(!(payload[0] & CHANNEL_MORE)) {
+        ch->rx.push_back(std::move(ch->rx_partial));
+        ch->rx_partial.clear();
+        ch->rx_active = false;
+    }
+}
+
+// Runs one round of the link: sends queued fragments by priority, then
+// reads once from the port and sorts the input into the channel queues.
+// Call it in a loop (the port read timeout paces it).
+// Returns number of frames received, -1 on error.
+int ChannelLink::pump()
+{
+    if(this->send_fragments() < 0)
+        return -1;
+
+    uint8_t buf[512];
+    int n = port.sread(buf, sizeof(buf));
+    if(n == -1)
+        return -1;
+    if(n <= 0)
+        return 0;
+
+    return decoder.feed(buf, n,
+        [this](const uint8_t *payload, int len) { this->on_frame(payload, len); });
+}
+
+// Moves the next complete message of channel id into msg (replacing its
+// contents). Returns message length, -2 if none is waiting, -1 on
+// unknown channel.
+int ChannelLink::receive(uint8_t id, std::vector<uint8_t> &msg)
+{
+    std::lock_guard<std::mutex> guard(lock);
+
+    Channel *ch = this->find(id);
+    if(!ch)
+        return -1;
+    if(ch->rx.empty())
+        return -2;
+
+    msg = std::move(ch->rx.front());
+    ch->rx.pop_front();
+
+    return static_cast<int>(msg.size());
+}
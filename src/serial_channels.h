@@ -0,0 +1,80 @@
+//
+//  serial_channels.h
+//
+//  Carries several logical streams (control, telemetry, bulk, ...) over
+//  one serial link. Messages are cut into short fragments and every
+//  fragment travels in its own frame (see serial_frame.h), so the
+//  scheduler can slip an urgent control message in between two
+//  fragments of a long bulk transfer instead of waiting for it to end.
+//
+//  Outbound, the highest priority channel with queued data always goes
+//  first. Only a few fragments are handed to the OS at a time
+//  (tx_watermark), because once bytes are in the driver queue nothing
+//  can overtake them. A control message therefore waits at most for
+//  one fragment plus the watermark to drain, ie about
+//  (max_fragment + tx_watermark) * 10 / baud seconds.
+//
+//  Inbound, frames are reassembled and queued per channel, so a
+//  consumer only sees its own channel's messages.
+//
+//  Frame payload: channel byte (bit 7 set = more fragments follow),
+//  fragment byte (bit 7 set = first fragment of a message, bits 0-6 =
+//  the channel's fragment counter), then up to max_fragment data bytes.
+//  A lost fragment shows up as a gap in the counter: the message it
+//  belonged to is dropped and the channel discards input until the next
+//  first fragment, so a damaged message is never delivered.
+//
+
+#pragma once
+
+#include "serial_port.h"
+#include "serial_frame.h"
+
+#include <deque>
+#include <mutex>
+
+#define CHANNEL_MORE 0x80       // Fragment flag in the channel byte
+#define CHANNEL_FIRST 0x80      // First fragment flag in the fragment byte
+#define CHANNEL_SEQ_MASK 0x7F   // Fragment counter bits in the fragment byte
+#define CHANNEL_MAX 127         // Highest usable channel id
+
+class ChannelLink
+{
+public:
+    ChannelLink(SERIAL_PORT &_port, int _max_fragment = 64, int _tx_watermark = 128);
+
+    int add_channel(uint8_t id, int priority, int max_message = 4096);  // Higher priority goes first
+    int send(uint8_t id, const uint8_t *buf, int len);  // Queue a message on a channel
+    int send(uint8_t id, const std::string str);        // Queue a string on a channel
+    int receive(uint8_t id, std::vector<uint8_t> &msg); // Get next message of a channel
+    int pump();                     // Move queued fragments to the port, read and demux input
+    int tx_pending(uint8_t id);     // Bytes queued on a channel, not yet handed to the port
+    unsigned long errors() const { return decoder.errors() + rx_dropped; }  // Frames lost
+
+private:
+    struct Channel
+    {
+        uint8_t id;
+        int priority;
+        int max_message;
+        std::deque<std::vector<uint8_t>> tx;    // Outbound messages
+        size_t tx_offset;                       // Bytes of tx.front() already sent
+        uint8_t tx_seq;                         // Counter of the next fragment sent
+        std::vector<uint8_t> rx_partial;        // Message being reassembled
+        uint8_t rx_seq;                         // Counter expected on the next fragment
+        bool rx_active;                         // In a message, false = discard until a first fragment
+        std::deque<std::vector<uint8_t>> rx;    // Complete inbound messages
+    };
+
+    Channel *find(uint8_t id);
+    int send_fragments();
+    void on_frame(const uint8_t *payload, int len);
+
+    SERIAL_PORT &port;
+    int max_fragment;
+    int tx_watermark;
+    std::vector<Channel> channels;      // Sorted by descending priority
+    std::mutex lock;                    // Guards the channel queues
+    FrameDecoder decoder;
+    unsigned long rx_dropped;           // Frames for unknown channels, oversized or broken messages
+};
@@ -0,0 +1,141 @@
+//
+//  serial_clock.cpp
+//
+//  Ping based clock offset / drift estimation between host and device.
+//
+
+#include "serial_clock.h"
+
+#include <algorithm>
+
+// _max_samples = ping exchanges kept for the fit. More samples average
+// out jitter, fewer follow drift changes (temperature) faster
+ClockSync::ClockSync(int _max_samples)
+{
+    max_samples = std::max(2, _max_samples);
+    last_device = 0;
+    epoch = SerialClock::now();
+    offset_us = 0.0;
+    rate = 1.0;
+    device_ref = 0;
+}
+
+// micros() wraps every 71 minutes, extend it to 64 bits around the
+// latest sample
+int64_t ClockSync::unwrap(uint32_t device_us) const
+{
+    if(window.empty())
+        return device_us;
+
+    int32_t delta = static_cast<int32_t>(device_us - static_cast<uint32_t>(last_device));
+    return last_device + delta;
+}
+
+// Adds one exchange: the request went out at sent, the reply carrying
+// device_us came in at received (use last_rx_time() for it)
+void ClockSync::add_sample(SerialClock::time_point sent, SerialClock::time_point received,
+                           uint32_t device_us)
+{
+    Sample s;
+    s.device_us = this->unwrap(device_us);
+    s.rtt_us = std::chrono::duration<double, std::micro>(received - sent).count();
+    s.host_us = std::chrono::duration<double, std::micro>(sent - epoch).count() + s.rtt_us / 2;
+
+    last_device = s.device_us;
+    window.push_back(s);
+    if(static_cast<int>(window.size()) > max_samples)
+        window.pop_front();
+
+    this->fit();
+}
+
+// Least squares line through the samples whose round trip is no longer
+// than the median, the rest were held up somewhere and only add noise
+void ClockSync::fit()
+{
+    std::vector<double> rtts;
+    for(const Sample &s : window)
+        rtts.push_back(s.rtt_us);
+    std::nth_element(rtts.begin(), rtts.begin() + rtts.size() / 2, rtts.end());
+    double limit = rtts[rtts.size() / 2];
+
+    device_ref = window.back().device_us;
+    double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for(const Sample &s : window)
+    {
+        if(s.rtt_us > limit)
+            continue;
+        double x = static_cast<double>(s.device_us - device_ref);
+        n++;
+        sx += x;
+        sy += s.host_us;
+        sxx += x * x;
+        sxy += x * s.host_us;
+    }
+
+    double var = n * sxx - sx * sx;
+    if(n >= 2 && var > 0) {
+        rate = (n * sxy - sx * sy) / var;
+        offset_us = (sy - rate * sx) / n;
+    }
+    else {
+        rate = 1.0;             // Not enough spread yet, offset only
+        offset_us = sy / n - sx / n;
+    }
+}
+
+// Host time at which the device clock read device_us
+SerialClock::time_point ClockSync::to_host(uint32_t device_us) const
+{
+    double x = static_cast<double>(this->unwrap(device_us) - device_ref);
+    double host_us = offset_us + rate * x;
+
+    return epoch + std::chrono::duration_cast<SerialClock::duration>(
+        std::chrono::duration<double, std::micro>(host_us));
+}
+
+// Best case error of a single mapping, -1 before the first sample
+double ClockSync::uncertainty_us() const
+{
+    if(window.empty())
+        return -1.0;
+
+    double best = window.front().rtt_us;
+    for(const Sample &s : window)
+        best = std::min(best, s.rtt_us);
+
+    return best / 2;
+}
+
+// Sends "PING\n" and waits for the "PONG <micros>" reply, skipping
+// other lines meanwhile (they're lost, so ping while the device is
+// quiet or handle PONG lines in your own reader with add_sample()).
+// Returns round trip in us, -1 on error, -2 if timeout_ms expired.
+int ClockSync::ping(SERIAL_PORT &port, int timeout_ms)
+{
+    auto sent = SerialClock::now();
+    auto deadline = sent + std::chrono::milliseconds(timeout_ms);
+
+    if(port.swrite(std::string("PING\n")) < 0)
+        return -1;
+
+    std::string line;
+    while(SerialClock::now() < deadline)
+    {
+        int n = port.sreadline(line);
+        if(n == -1)
+            return -1;
+        if(n > 0 && line.back() == '\n') {
+            if(line.compare(0, 5, "PONG ") == 0) {
+                auto received = port.last_rx_time();
+                this->add_sample(sent, received,
+                                 static_cast<uint32_t>(strtoul(line.c_str() + 5, NULL, 10)));
+                return static_cast<int>(std::chrono::duration_cast<
+                    std::chrono::microseconds>(received - sent).count());
+            }
+            line.clear();
+        }
+    }
+
+    return -2;                  // Timed out
+}
@@ -0,0 +1,61 @@
+//
+//  serial_clock.h
+//
+//  Maps device timestamps (micros() on the Arduino) onto host time, so
+//  samples from several boards can be lined up on one time base. The
+//  host pings the device, the device answers with its clock, and each
+//  exchange gives one sample: the device time matches the middle of
+//  the round trip, give or take half of it. A line fitted through the
+//  samples with the shortest round trips (the least delayed by USB
+//  polling and scheduling) gives the offset and the drift between the
+//  two clocks.
+//
+//  Device side, answer "PING" lines with the current micros():
+//
+//    if(line == "PING") {
+//      Serial.print("PONG ");
+//      Serial.println(micros());
+//    }
+//
+//  Ping every second or so, the drift of a ceramic resonator (up to a
+//  few thousand ppm) adds up to milliseconds within seconds.
+//
+
+#pragma once
+
+#include "serial_port.h"
+
+#include <deque>
+
+class ClockSync
+{
+public:
+    ClockSync(int _max_samples = 32);
+
+    void add_sample(SerialClock::time_point sent, SerialClock::time_point received,
+                    uint32_t device_us);                    // Add one ping exchange
+    int ping(SERIAL_PORT &port, int timeout_ms = 100);      // PING / PONG exchange with the device
+    SerialClock::time_point to_host(uint32_t device_us) const;  // Device time -> host time
+    double drift_ppm() const { return (1.0 / rate - 1.0) * 1e6; }  // Device clock fast (+) or slow (-)
+    double uncertainty_us() const;                          // Half the best round trip
+    int samples() const { return static_cast<int>(window.size()); }
+
+private:
+    struct Sample
+    {
+        int64_t device_us;      // Unwrapped device time
+        double host_us;         // Middle of the round trip, since epoch
+        double rtt_us;
+    };
+
+    int64_t unwrap(uint32_t device_us) const;
+    void fit();
+
+    std::deque<Sample> window;      // Latest samples
+    int max_samples;
+    int64_t last_device;            // Unwrapped time of the latest sample
+    SerialClock::time_point epoch;  // Host time origin
+    double offset_us;               // Fit: host_us = offset_us + rate * (device_us - device_ref)
+    double rate;
+    int64_t device_ref;
+};
@@ -0,0 +1,201 @@
+//
+//  serial_compress.cpp
+//
+//  Delta + zigzag varint coding for numeric records and a small LZ77
+//  for text.
+//
+
+#include "serial_compress.h"
+
+#include <string.h>
+
+// Encodes records * channels values (record by record) as zigzag
+// varints of each value's change since the previous record of the same
+// channel. out needs room for DELTA_MAX_ENCODED(records * channels).
+// Returns number of bytes written.
+int delta_encode(const int32_t *values, int records, int channels, uint8_t *out)
+{
+    int o = 0;
+    int count = records * channels;
+
+    for(int i = 0; i < count; i++)
+    {
+        // Unsigned arithmetic, deltas wrap instead of overflowing
+        uint32_t prev = i >= channels ? static_cast<uint32_t>(values[i - channels]) : 0;
+        int32_t d = static_cast<int32_t>(static_cast<uint32_t>(values[i]) - prev);
+        uint32_t zz = (static_cast<uint32_t>(d) << 1) ^ static_cast<uint32_t>(d >> 31);
+
+        while(zz >= 0x80)
+        {
+            out[o++] = static_cast<uint8_t>(zz | 0x80);
+            zz >>= 7;
+        }
+        out[o++] = static_cast<uint8_t>(zz);
+    }
+
+    return o;
+}
+
+// Decodes a delta block into values (appended). Works in two passes
+// over the receive buffer so both are tight loops the compiler can
+// vectorize: the varints are turned into deltas, eight at a time while
+// no continuation bits show up (the common case for slow signals), then
+// each channel is summed up.
+// Returns number of records decoded, -1 if the block is malformed.
+int delta_decode(const uint8_t *buf, int len, int channels, std::vector<int32_t> &values)
+{
+    if(channels <= 0)
+        return -1;
+
+    size_t start = values.size();
+    values.resize(start + len);             // At least one byte per value
+    uint32_t *out = reinterpret_cast<uint32_t *>(values.data() + start);
+    int n = 0;
+    int i = 0;
+
+    // Pass 1: varints -> zigzag decoded deltas
+    while(i < len)
+    {
+        if(i + 8 <= len) {
+            uint64_t word;
+            memcpy(&word, buf + i, 8);
+            if((word & 0x8080808080808080ULL) == 0) {
+                for(int k = 0; k < 8; k++)
+                {
+                    uint32_t zz = buf[i + k];
+                    out[n + k] = (zz >> 1) ^ (0 - (zz & 1));
+                }
+                n += 8;
+                i += 8;
+                continue;
+            }
+        }
+
+        uint32_t zz = 0;
+        int shift = 0;
+        while(1)
+        {
+            if(i >= len || shift > 28) {
+                values.resize(start);
+                return -1;          // Truncated or overlong varint
+            }
+            uint8_t b = buf[i++];
+            zz |= static_cast<uint32_t>(b & 0x7F) << shift;
+            if(!(b & 0x80))
+                break;
+            shift += 7;
+        }
+        out[n++] = (zz >> 1) ^ (0 - (zz & 1));
+    }
+
+    if(n % channels != 0) {
+        values.resize(start);
+        return -1;                  // Partial record
+    }
+
+    // Pass 2: running sum per channel, the dependency is channels apart
+    for(int j = channels; j < n; j++)
+        out[j] += out[j - channels];
+
+    values.resize(start + n);
+
+    return n / channels;
+}
+
+// Writes count literals from in, in runs of up to LZ_MAX_LITERALS
+static int lz_literals(const uint8_t *in, int count, uint8_t *out)
+{
+    int o = 0;
+
+    while(count > 0)
+    {
+        int run = count < LZ_MAX_LITERALS ? count : LZ_MAX_LITERALS;
+        out[o++] = static_cast<uint8_t>(run - 1);
+        memcpy(out + o, in, run);
+        o += run;
+        in += run;
+        count -= run;
+    }
+
+    return o;
+}
+
+// Compresses len bytes from in into out, which needs room for
+// LZ_MAX_COMPRESSED(len) bytes. Greedy matching through a 256 entry
+// hash table of 3 byte prefixes, same as the sketch side encoder.
+// Returns number of bytes written.
+int lz_compress(const uint8_t *in, int len, uint8_t *out)
+{
+    int table[256];
+    int o = 0;
+    int i = 0;
+    int lit_start = 0;
+
+    for(int k = 0; k < 256; k++)
+        table[k] = -LZ_WINDOW - 1;
+
+    while(i + LZ_MIN_MATCH <= len)
+    {
+        uint8_t h = static_cast<uint8_t>((in[i] * 33) ^ (in[i + 1] * 7) ^ in[i + 2]);
+        int cand = table[h];
+        table[h] = i;
+
+        if(i - cand <= LZ_WINDOW && in[cand] == in[i] &&
+           in[cand + 1] == in[i + 1] && in[cand + 2] == in[i + 2]) {
+            int m = LZ_MIN_MATCH;
+            while(i + m < len && m < LZ_MAX_MATCH && in[cand + m] == in[i + m])
+                m++;
+
+            o += lz_literals(in + lit_start, i - lit_start, out + o);
+            out[o++] = static_cast<uint8_t>(0x80 | (m - LZ_MIN_MATCH));
+            out[o++] = static_cast<uint8_t>(i - cand - 1);
+            i += m;
+            lit_start = i;
+        }
+        else
+            i++;
+    }
+    o += lz_literals(in + lit_start, len - lit_start, out + o);
+
+    return o;
+}
+
+// Decompresses an LZ block, appending the data to out.
+// Returns decompressed length, -1 if the block is malformed.
+int lz_decompress(const uint8_t *in, int len, std::vector<uint8_t> &out)
+{
+    size_t start = out.size();
+    int i = 0;
+
+    while(i < len)
+    {
+        uint8_t token = in[i++];
+
+        if(token < 0x80) {
+            int run = token + 1;
+            if(i + run > len)
+                break;
+            out.insert(out.end(), in + i, in + i + run);
+            i += run;
+        }
+        else {
+            if(i >= len)
+                break;
+            size_t dist = in[i++] + 1;
+            int m = (token & 0x7F) + LZ_MIN_MATCH;
+            if(dist > out.size() - start)
+                break;
+            // Byte by byte, the match may overlap what it produces
+            size_t from = out.size() - dist;
+            for(int k = 0; k < m; k++)
+                out.push_back(out[from + k]);
+        }
+    }
+
+    if(i != len) {
+        out.resize(start);
+        return -1;
+    }
+
+    return static_cast<int>(out.size() - start);
+}
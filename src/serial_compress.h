@@ -0,0 +1,43 @@
+//
+//  serial_compress.h
+//
+//  Compression for links that run out of bandwidth before the device
+//  runs out of data. Two block codecs, both cheap enough to encode on
+//  an AVR (see serial_compress_test.ino for the device side):
+//
+//  - Delta: numeric records (one value per channel) are stored as the
+//    zigzag varint of each value's difference from the same channel in
+//    the previous record. Slowly changing sensor values mostly take one
+//    byte instead of two or four.
+//  - LZ: byte oriented LZ77 with a 256 byte window for text (log lines,
+//    NMEA, JSON, ...), repeated substrings become 2 byte references.
+//
+//  Every block is independent (the delta base and LZ window start from
+//  scratch), so a block lost on the link doesn't spoil the next ones.
+//  Send blocks in frames (serial_frame.h) so their boundaries survive.
+//
+//  Delta format: records * channels zigzag varints, record by record.
+//  LZ format: tokens, 0x00-0x7F = (token + 1) literal bytes follow,
+//  0x80-0xFF = match of (token & 0x7F) + 3 bytes at distance (next
+//  byte + 1).
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#define DELTA_MAX_ENCODED(values) ((values) * 5)        // Worst case delta block size
+#define LZ_MAX_COMPRESSED(len) ((len) + (len) / 128 + 1)  // Worst case LZ block size
+#define LZ_WINDOW 256
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH 130
+#define LZ_MAX_LITERALS 128
+
+int delta_encode(const int32_t *values, int records, int channels, uint8_t *out);  // Returns bytes written
+int delta_decode(const uint8_t *buf, int len, int channels,
+                 std::vector<int32_t> &values);         // Appends values, returns records, -1 if malformed
+int lz_compress(const uint8_t *in, int len, uint8_t *out);  // Returns bytes written
+int lz_decompress(const uint8_t *in, int len,
+                  std::vector<uint8_t> &out);           // Appends data, returns its length, -1 if malformed
@@ -0,0 +1,94 @@
+//
+// serial_compress_test
+//
+// Device side of the delta compression in serial_compress.h, and the
+// reference encoder for sketches. Upload this to your Arduino and run
+// test_serial_compress.cpp on the computer side.
+//
+// The sketch samples CHANNELS analog inputs as fast as it can, collects
+// RECORDS records, delta + zigzag varint encodes them and sends the
+// block in a COBS + CRC16 frame (same format as serial_frame.h). Each
+// block starts from zero, so a corrupted frame only loses that block.
+//
+// Everything is computed byte by byte on the fly, no tables: the
+// encoder needs the block buffer and a few bytes of stack.
+//
+
+#include <Arduino.h>
+
+#define CHANNELS 6      // Must match test_serial_compress.cpp
+#define RECORDS 16      // Records per block
+
+int16_t block[RECORDS][CHANNELS];
+uint8_t frame[RECORDS * CHANNELS * 3 + 2];    // Varints of 16 bit deltas take up to 3 bytes
+
+uint16_t crc;
+uint8_t cobs[255];      // COBS group being built, cobs[0] is its code
+uint8_t cobs_len;
+
+// CRC-16/CCITT-FALSE, bitwise to save the 512 byte table
+void crc_update(uint8_t b) {
+  crc ^= (uint16_t)b << 8;
+  for(uint8_t i = 0; i < 8; i++)
+    crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+}
+
+// Streaming COBS: bytes go out a group at a time
+void cobs_flush() {
+  cobs[0] = cobs_len;
+  Serial.write(cobs, cobs_len);
+  cobs_len = 1;
+}
+
+void cobs_put(uint8_t b) {
+  if(b == 0) {
+    cobs_flush();
+    return;
+  }
+  cobs[cobs_len++] = b;
+  if(cobs_len == 0xFF)
+    cobs_flush();
+}
+
+void send_frame(const uint8_t *buf, int len) {
+  crc = 0xFFFF;
+  cobs_len = 1;
+  for(int i = 0; i < len; i++) {
+    crc_update(buf[i]);
+    cobs_put(buf[i]);
+  }
+  uint16_t c = crc;
+  cobs_put(c >> 8);
+  cobs_put(c & 0xFF);
+  cobs_flush();
+  Serial.write((uint8_t)0x00);     // Frame delimiter
+}
+
+// Delta + zigzag varint, as delta_encode() on the host
+int encode_block(uint8_t *out) {
+  int o = 0;
+  for(int r = 0; r < RECORDS; r++) {
+    for(int c = 0; c < CHANNELS; c++) {
+      int32_t d = (int32_t)block[r][c] - (r > 0 ? block[r - 1][c] : 0);
+      uint32_t zz = ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+      while(zz >= 0x80) {
+        out[o++] = (uint8_t)(zz | 0x80);
+        zz >>= 7;
+      }
+      out[o++] = (uint8_t)zz;
+    }
+  }
+  return o;
+}
+
+void setup() {
+  Serial.begin(115200);
+}
+
+void loop() {
+  for(int r = 0; r < RECORDS; r++) {
+    for(int c = 0; c < CHANNELS; c++)
+      block[r][c] = analogRead(A0 + c);
+  }
+  send_frame(frame, encode_block(frame));
+}
@@ -0,0 +1,127 @@
+//
+//  serial_credit.cpp
+//
+//  Credit based flow control layered on top of the serial port
+//  classes, for boards without usable RTS/CTS lines.
+//
+
+#include "serial_credit.h"
+
+#include <algorithm>
+
+// _port = already opened serial port. Open it with a read timeout
+// (eg 10ms) so waiting for credit blocks in the port instead of spinning
+// _initial_credit = bytes the device is known to accept before its first
+// grant arrives (default 0, wait for the device to advertise its buffer)
+CreditLink::CreditLink(SERIAL_PORT &_port, int _initial_credit)
+    : port(_port)
+{
+    credit = _initial_credit;
+    in_marker = false;
+}
+
+// Reads whatever the port has pending, strips credit grants out of
+// the stream and keeps the remaining device data for receive().
+// Returns number of bytes read from the port, or the port error code.
+int CreditLink::process_input()
+{
+    uint8_t buf[256];
+    int n = port.sread(buf, sizeof(buf));
+
+    if(n <= 0)
+        return n;
+
+    for(int i = 0; i < n; i++)
+    {
+        if(in_marker) {
+            if(buf[i] == 0)
+                rx_data.push_back(CREDIT_MARKER);   // Escaped literal
+            else
+                credit += buf[i];
+            in_marker = false;
+        }
+        else if(buf[i] == CREDIT_MARKER)
+            in_marker = true;
+        else
+            rx_data.push_back(buf[i]);
+    }
+
+    return n;
+}
+
+// Processes any pending input and returns the credit available
+int CreditLink::poll_credits()
+{
+    while(this->process_input() > 0)
+        ;
+
+    return credit;
+}
+
+// Sends len bytes from buf, never more than the device has granted.
+// Whatever credit is available goes out straight away and the rest is
+// pipelined as grants come back, so the link runs as fast as the device
+// drains its buffer.
+// Returns number of bytes sent, -1 on error, -2 if timeout_ms expired
+// (-1 waits forever).
+int CreditLink::send(const uint8_t *buf, int len, int timeout_ms)
+{
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(timeout_ms);
+    int total = 0;
+
+    while(total < len)
+    {
+        if(credit > 0) {
+            int chunk = std::min(credit, len - total);
+            int n = port.swrite(buf + total, chunk);
+            if(n < 0)
+                return n;       // Write error or timed out
+            credit -= n;
+            total += n;
+            continue;
+        }
+
+        // Out of credit, wait for the device to free up buffer space
+        int n = this->process_input();
+        if(n == -1)
+            return -1;
+        if(credit == 0 && timeout_ms >= 0 &&
+           std::chrono::steady_clock::now() >= deadline) {
+#if PORTCON_DEBUG
+            std::cerr << "CreditLink send: timed out waiting for credit after " <<
+                total << " of " << len << " bytes" << std::endl;
+#endif
+            return -2;          // Timed out
+        }
+    }
+
+    return total;       // Return number of bytes sent
+}
+
+// Sends full string as credit allows
+int CreditLink::send(const std::string str, int timeout_ms)
+{
+    return this->send(reinterpret_cast<const uint8_t *>(str.data()),
+                      static_cast<int>(str.size()), timeout_ms);
+}
+
+// Reads up to max_size bytes of device data (credit grants removed)
+// into vec_bytes. Returns number of bytes read, -1 on error, -2 if
+// the port timed out with no data.
+int CreditLink::receive(std::vector<uint8_t> &vec_bytes, int max_size)
+{
+    if(rx_data.empty()) {
+        int n = this->process_input();
+        if(n < 0)
+            return n;
+    }
+    if(rx_data.empty())
+        return -2;              // Only credit grants arrived
+
+    int count = std::min(max_size, static_cast<int>(rx_data.size()));
+    vec_bytes.insert(vec_bytes.end(), rx_data.begin(), rx_data.begin() + count);
+    rx_data.erase(rx_data.begin(), rx_data.begin() + count);
+
+    return count;
+}
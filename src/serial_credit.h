@@ -0,0 +1,42 @@
+//
+//  serial_credit.h
+//
+//  Credit based flow control layered on top of the serial port
+//  classes, for boards without usable RTS/CTS lines (CH340, native
+//  USB, etc). The device advertises how many bytes of free RX buffer
+//  it has and the host never sends more than that.
+//
+//  Protocol (see serial_credit_test.ino for the device side):
+//    host -> device : raw data bytes, no framing
+//    device -> host : regular data, except that CREDIT_MARKER n grants
+//                     n more bytes of credit (n = 1..255), and
+//                     CREDIT_MARKER 0 stands for a literal marker byte
+//
+
+#pragma once
+
+#include "serial_port.h"
+
+#include <chrono>
+
+#define CREDIT_MARKER 0xFE
+
+class CreditLink
+{
+public:
+    CreditLink(SERIAL_PORT &_port, int _initial_credit = 0);
+
+    int send(const uint8_t *buf, int len, int timeout_ms = -1);     // Send buf as credit allows
+    int send(const std::string str, int timeout_ms = -1);           // Send string as credit allows
+    int receive(std::vector<uint8_t> &vec_bytes, int max_size = 256);   // Read device data, grants stripped
+    int poll_credits();                                             // Process pending input, return credit
+    int credits() const { return credit; }                          // Credit currently available
+
+private:
+    int process_input();       // Read once from the port, parsing grants
+
+    SERIAL_PORT &port;
+    int credit;
+    bool in_marker;             // Last byte read was CREDIT_MARKER
+    std::vector<uint8_t> rx_data;   // Device data waiting for receive()
+};
@@ -0,0 +1,62 @@
+//
+// serial_credit_test
+//
+// Device side of the credit based flow control in serial_credit.h.
+// Upload this to your Arduino and run test_serial_credit.cpp on the
+// computer side. The sketch advertises its free RX buffer space on boot
+// and grants more credit as it consumes bytes, so the host can stream
+// at the fastest rate the sketch can keep up with, without overrunning
+// the 64 byte hardware buffer and without any delay() guessing.
+//
+// Every byte is "processed" with a short busy wait, to stand in for real
+// work (writing to an SD card, updating a display, etc). On each '\n' the
+// sketch prints back how many bytes it got so far.
+//
+
+#include <Arduino.h>
+
+#define CREDIT_MARKER 0xFE    // Must match serial_credit.h
+#define GRANT_BATCH   16      // Return credit in batches to save bandwidth
+
+#ifdef SERIAL_RX_BUFFER_SIZE
+  #define RX_BUFFER SERIAL_RX_BUFFER_SIZE
+#else
+  #define RX_BUFFER 64
+#endif
+
+unsigned int consumed = 0;    // Bytes consumed since the last grant
+unsigned long total = 0;      // Bytes consumed since boot
+
+// Tell the host it may send n more bytes
+void grant(uint8_t n) {
+  Serial.write(CREDIT_MARKER);
+  Serial.write(n);
+}
+
+void setup() {
+  Serial.begin(115200);
+
+  // The ring buffer holds one byte less than its size
+  grant(RX_BUFFER - 1);
+}
+
+void loop() {
+  while(Serial.available() > 0) {
+    int b = Serial.read();
+    delayMicroseconds(100);   // Stand in for real per-byte work
+
+    total++;
+    consumed++;
+    if(consumed >= GRANT_BATCH) {
+      grant(consumed);
+      consumed = 0;
+    }
+
+    // Only ASCII goes back to the host, so no need to escape CREDIT_MARKER
+    if(b == '\n') {
+      Serial.print("Received ");
+      Serial.print(total);
+      Serial.println(" bytes");
+    }
+  }
+}
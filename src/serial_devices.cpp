@@ -313,3 +313,23 @@ std::vector<SerialDevice> InterfacesWin32::GetDevices()
 	return vec_ports;
 }
 #endif
+
+// *************************************************************
+// Common implementation
+// *************************************************************
+
+// Looks up the USB device with the given serial number among the
+// currently connected devices
+PSTRING Interfaces::FindBySerialNumber(uint32_t serialNumber)
+{
+    std::vector<SerialDevice> devices = GetDevices();
+
+    for (const SerialDevice &dev : devices)
+    {
+        if (serialNumber != 0 && dev.parent.type == DeviceType::USB_DEVICE &&
+            dev.parent.serialNumber == serialNumber)
+            return dev.calloutDevice;
+    }
+
+    return PSTRING();
+}
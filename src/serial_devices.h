@@ -96,6 +96,13 @@ struct SerialDevice
 // as a vector of @{SerialDevice} objects.
 class Interfaces
 {
+public:
+    // Returns the callout device of the USB device with the given
+    // serial number, or an empty string if it isn't connected. Handy as
+    // a SerialPort device locator, to follow a board across replugs.
+    PSTRING FindBySerialNumber(uint32_t serialNumber);
+
+private:
     virtual std::vector<SerialDevice> GetDevices() = 0;
 };
 
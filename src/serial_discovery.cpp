@@ -0,0 +1,143 @@
+//
+//  serial_discovery.cpp
+//
+//  Parallel probing of serial ports to map device roles to ports.
+//
+
+#include "serial_discovery.h"
+
+#include <algorithm>
+#include <mutex>
+#include <thread>
+
+#if defined(__APPLE__) || defined(__linux__)
+    #include <glob.h>
+#endif
+
+// ports = candidate port names, all probed at the same time
+// baud = baud rate to open them at
+// handshake = identifies the device on an opened port, see ProbeHandshake
+// deadline_ms = time allowed for the whole discovery. Each handshake gets
+// the time left and must return within it: every probe has finished and
+// closed its port by the time this returns, so the caller can open the
+// ports found right away. Answers that come after the deadline are ignored.
+// Returns role / ID -> device. If two ports answer with the same ID, the
+// one that answered first is kept.
+std::map<std::string, DiscoveredDevice> discover_devices(
+    const std::vector<PSTRING> &ports, int baud,
+    ProbeHandshake handshake, int deadline_ms)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(deadline_ms);
+    std::mutex lock;
+    std::vector<DiscoveredDevice> found;
+    std::vector<std::thread> probes;
+
+    for(const PSTRING &name : ports)
+    {
+        probes.emplace_back([&lock, &found, name, baud, handshake, deadline] {
+            DiscoveredDevice dev;
+            dev.port = name;
+            dev.probe_ms = 0;
+
+            auto opened = std::chrono::steady_clock::now();
+            SERIAL_PORT port;
+            if(port.open_port(name, baud, 10) >= 0) {
+                int left = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now()).count());
+                if(left > 0)
+                    dev.id = handshake(port, left);
+                dev.probe_ms = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - opened).count());
+                port.sclose();
+            }
+
+            std::lock_guard<std::mutex> guard(lock);
+            if(!dev.id.empty() && std::chrono::steady_clock::now() <= deadline)
+                found.push_back(dev);
+        });
+    }
+
+    // Handshakes honour the deadline, so this waits about deadline_ms at most
+    for(std::thread &probe : probes)
+        probe.join();
+
+#if PORTCON_DEBUG
+    int overran = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - deadline).count());
+    if(overran > 100)
+        std::cerr << "discover_devices: a handshake ran " << overran << " ms past the deadline" << std::endl;
+#endif
+
+    std::map<std::string, DiscoveredDevice> result;
+    for(const DiscoveredDevice &dev : found)
+    {
+        if(!result.insert(std::make_pair(dev.id, dev)).second) {
+#if PORTCON_DEBUG
+            PCOUT << _S("discover_devices: ID ") << dev.id.c_str() << _S(" also answered on ") <<
+                dev.port << _S(", ignored") << std::endl;
+#endif
+        }
+    }
+
+    return result;
+}
+
+// Handshake for sketches that answer an identify command with a line
+// "<prefix><ID>". The command is sent every retry_ms until the answer
+// comes, so the probe finishes as soon as the sketch is up instead of
+// after a fixed reset delay. The returned ID has the prefix and line
+// end stripped.
+ProbeHandshake identify_probe(const std::string &command, const std::string &prefix, int retry_ms)
+{
+    return [command, prefix, retry_ms](SERIAL_PORT &port, int deadline_ms) -> std::string {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(deadline_ms);
+        std::string id;
+
+        while(1)
+        {
+            int left = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count());
+            if(left <= 0)
+                return std::string();
+
+            if(port.swrite(command) < 0)
+                return std::string();
+
+            int r = port.swait_ready([&prefix, &id](const std::string &line) {
+                if(line.compare(0, prefix.size(), prefix) != 0)
+                    return false;
+                id = line.substr(prefix.size());
+                while(!id.empty() && (id.back() == '\n' || id.back() == '\r'))
+                    id.pop_back();
+                return true;
+            }, std::min(left, retry_ms));
+
+            if(r >= 0)
+                return id;
+            if(r == -1)
+                return std::string();
+        }
+    };
+}
+
+#if defined(__APPLE__) || defined(__linux__)
+// Lists the USB serial devices in /dev (ttyACM* / ttyUSB* on Linux,
+// cu.usb* on macOS)
+std::vector<std::string> candidate_ports()
+{
+    std::vector<std::string> ports;
+    const char *patterns[] = {"/dev/ttyACM*", "/dev/ttyUSB*", "/dev/cu.usb*"};
+
+    for(const char *pattern : patterns)
+    {
+        glob_t g;
+        if(glob(pattern, 0, NULL, &g) == 0) {
+            for(size_t i = 0; i < g.gl_pathc; i++)
+                ports.push_back(g.gl_pathv[i]);
+        }
+        globfree(&g);
+    }
+
+    return ports;
+}
+#endif
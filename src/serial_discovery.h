@@ -0,0 +1,54 @@
+//
+//  serial_discovery.h
+//
+//  Finds out which device (sketch, role, board ID) sits behind each
+//  serial port by probing all candidate ports at once, one thread per
+//  port. Most of a probe is spent waiting for the board to come out of
+//  the reset that opening the port triggers, so running them in
+//  parallel makes discovery take about as long as the slowest single
+//  probe instead of the sum of all of them.
+//
+//  The handshake is supplied by the caller: it gets the opened port
+//  and the time left, talks to the device and returns its role / ID,
+//  or an empty string if the device isn't one of ours, without running
+//  past the time left: discover_devices() waits for every probe to
+//  close its port before it returns. identify_probe() builds the common
+//  "send a command, wait for a tagged reply" one.
+//  Example:
+//
+//    auto found = discover_devices(candidate_ports(), 115200,
+//                                  identify_probe("ID?\n", "ID "), 4000);
+//    SerialPort motor(found["motor"].port, 115200);
+//
+//  Candidate ports come from candidate_ports() (macOS / Linux), or the
+//  callout devices returned by GetDevices() (see serial_devices.h).
+//
+
+#pragma once
+
+#include "serial_port.h"
+
+#include <map>
+
+struct DiscoveredDevice
+{
+    PSTRING port;       // Port the device answered on
+    std::string id;     // Role / ID returned by the handshake
+    int probe_ms;       // Time from opening the port to the answer (open included)
+};
+
+// Identifies the device on an open port within deadline_ms. Returns its
+// role / ID, empty if it isn't recognized. Must return by deadline_ms:
+// discover_devices() waits for every probe before it returns.
+typedef std::function<std::string(SERIAL_PORT &port, int deadline_ms)> ProbeHandshake;
+
+std::map<std::string, DiscoveredDevice> discover_devices(
+    const std::vector<PSTRING> &ports, int baud,
+    ProbeHandshake handshake, int deadline_ms = 5000);      // Probe all ports in parallel
+
+ProbeHandshake identify_probe(const std::string &command, const std::string &prefix,
+                              int retry_ms = 250);          // Send command until a prefix line answers
+
+#if defined(__APPLE__) || defined(__linux__)
+std::vector<std::string> candidate_ports();     // USB serial devices in /dev
+#endif
@@ -0,0 +1,252 @@
+//
+//  serial_fanout.cpp
+//
+//  Publish/subscribe stage that hands the lines read from one serial
+//  port to any number of consumers without copying them per consumer.
+//
+
+#include "serial_fanout.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+// *************************************************************
+// Subscriber
+// *************************************************************
+
+// _capacity = lines queued before the overflow policy kicks in
+// _policy = what to do when the queue is full
+FanoutSubscriber::FanoutSubscriber(int _capacity, OverflowPolicy _policy)
+    : ring(_capacity > 0 ? _capacity : 1)
+{
+    head = 0;
+    count = 0;
+    policy = _policy;
+    drops = 0;
+    closed = false;
+}
+
+// Queues a line according to the overflow policy. Returns false if the
+// line was not queued (dropped or subscriber closed).
+bool FanoutSubscriber::push(const SharedLine &line)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    int capacity = static_cast<int>(ring.size());
+
+    if(count == capacity) {
+        if(policy == OverflowPolicy::BLOCK) {
+            space_ready.wait(guard, [this, capacity]() {
+                return count < capacity || closed;
+            });
+        }
+        else if(policy == OverflowPolicy::DROP_OLDEST) {
+            ring[head].reset();
+            head = (head + 1) % capacity;
+            count--;
+            drops++;
+        }
+        else {
+            drops++;
+            return false;
+        }
+    }
+    if(closed)
+        return false;
+
+    ring[(head + count) % capacity] = line;
+    count++;
+    guard.unlock();
+    data_ready.notify_one();
+
+    return true;
+}
+
+// Gets the next line for this subscriber, waiting up to timeout_ms
+// (-1 waits forever). Returns the line length, -1 if the subscriber
+// was closed, -2 if timed out.
+int FanoutSubscriber::next(SharedLine &line, int timeout_ms)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    auto ready = [this]() { return count > 0 || closed; };
+
+    if(timeout_ms < 0)
+        data_ready.wait(guard, ready);
+    else if(!data_ready.wait_for(guard, std::chrono::milliseconds(timeout_ms), ready))
+        return -2;              // Timed out
+    if(count == 0)
+        return -1;              // Closed
+
+    line.swap(ring[head]);
+    ring[head].reset();
+    head = (head + 1) % static_cast<int>(ring.size());
+    count--;
+    guard.unlock();
+    space_ready.notify_one();
+
+    return static_cast<int>(line->size());
+}
+
+// Returns how many lines this subscriber lost to overflow
+unsigned long FanoutSubscriber::dropped()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return drops;
+}
+
+// Closes the subscriber, waking up anybody waiting on it. Lines already
+// queued can still be read.
+void FanoutSubscriber::close()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        closed = true;
+    }
+    data_ready.notify_all();
+    space_ready.notify_all();
+}
+
+// *************************************************************
+// Publisher
+// *************************************************************
+
+// _port = already opened serial port, the fanout is its only reader
+// _max_line = lines longer than this are split
+SerialFanout::SerialFanout(SERIAL_PORT &_port, int _max_line)
+    : port(_port),
+      subs(std::make_shared<const std::vector<std::shared_ptr<FanoutSubscriber>>>())
+{
+    max_line = _max_line;
+    running = false;
+}
+
+SerialFanout::~SerialFanout()
+{
+    this->stop();
+}
+
+// Adds a subscriber. The subscriber list is copied on change, so
+// publishing never takes a lock shared with subscribe/unsubscribe.
+std::shared_ptr<FanoutSubscriber> SerialFanout::subscribe(int capacity,
+                                                          OverflowPolicy policy)
+{
+    std::shared_ptr<FanoutSubscriber> sub =
+        std::make_shared<FanoutSubscriber>(capacity, policy);
+
+    std::lock_guard<std::mutex> guard(subs_lock);
+    auto updated = std::make_shared<std::vector<std::shared_ptr<FanoutSubscriber>>>(*subs);
+    updated->push_back(sub);
+    std::atomic_store(&subs, std::shared_ptr<const std::vector<std::shared_ptr<FanoutSubscriber>>>(updated));
+
+    return sub;
+}
+
+// Removes a subscriber and closes it
+void SerialFanout::unsubscribe(const std::shared_ptr<FanoutSubscriber> &sub)
+{
+    {
+        std::lock_guard<std::mutex> guard(subs_lock);
+        auto updated = std::make_shared<std::vector<std::shared_ptr<FanoutSubscriber>>>();
+        for(const std::shared_ptr<FanoutSubscriber> &s : *subs)
+        {
+            if(s != sub)
+                updated->push_back(s);
+        }
+        std::atomic_store(&subs, std::shared_ptr<const std::vector<std::shared_ptr<FanoutSubscriber>>>(updated));
+    }
+    sub->close();
+}
+
+// Hands one line to every subscriber
+void SerialFanout::publish(const SharedLine &line)
+{
+    auto current = std::atomic_load(&subs);
+
+    for(const std::shared_ptr<FanoutSubscriber> &sub : *current)
+        sub->push(line);
+}
+
+// Closes every subscriber, waking up any consumer (or BLOCK-ed
+// publisher) waiting on them
+void SerialFanout::close_all()
+{
+    auto current = std::atomic_load(&subs);
+    for(const std::shared_ptr<FanoutSubscriber> &sub : *current)
+        sub->close();
+}
+
+// Reads whatever the port has and publishes every line completed by it.
+// Returns number of bytes read, -1 on error, -2 if the port timed out.
+int SerialFanout::poll_once()
+{
+    uint8_t buf[1024];
+    int n = port.sread(buf, sizeof(buf));
+
+    if(n <= 0)
+        return n;
+
+    const char *p = reinterpret_cast<const char *>(buf);
+    const char *end = p + n;
+    while(p != end)
+    {
+        // Never take more than fits in the line, so a long run without
+        // a newline is split at max_line rather than at the chunk end
+        int room = std::max(1, max_line - static_cast<int>(partial.size()));
+        const char *limit = end - p > room ? p + room : end;
+        const char *nl = static_cast<const char *>(memchr(p, '\n', limit - p));
+        const char *stop = nl ? nl + 1 : limit;
+
+        partial.append(p, stop - p);
+        p = stop;
+
+        // One allocation per line, shared by all subscribers from here on
+        if(nl || static_cast<int>(partial.size()) >= max_line) {
+            publish(std::make_shared<const std::string>(std::move(partial)));
+            partial.clear();
+        }
+    }
+
+    return n;
+}
+
+// Starts publishing on a background thread. The port should have a read
+// timeout so stop() doesn't wait long for it. A read error ends the
+// thread and closes all subscribers.
+// Returns 0 if started, -1 if already running.
+int SerialFanout::start()
+{
+    if(running.exchange(true))
+        return -1;
+
+    // A thread that ended on a read error is done but still joinable
+    if(reader.joinable())
+        reader.join();
+
+    reader = std::thread([this]() {
+        while(running)
+        {
+            if(this->poll_once() == -1) {
+#if PORTCON_DEBUG
+                std::cerr << "SerialFanout: read error, stopping" << std::endl;
+#endif
+                // Nothing more will be published, wake up the consumers
+                running = false;
+                this->close_all();
+                break;
+            }
+        }
+    });
+
+    return 0;
+}
+
+// Stops the background thread and closes all subscribers, waking up any
+// consumer (or BLOCK-ed publisher) waiting on them
+void SerialFanout::stop()
+{
+    running = false;
+    this->close_all();
+
+    if(reader.joinable())
+        reader.join();
+}
@@ -0,0 +1,83 @@
+//
+//  serial_fanout.h
+//
+//  Publish/subscribe stage that hands the lines read from one serial
+//  port to any number of consumers (recorder, dashboard, control loop,
+//  ...) without copying them per consumer. Each line is read into one
+//  reference counted string and every subscriber gets a pointer to it.
+//
+//  Each subscriber has its own queue (its cursor into the stream) and
+//  its own overflow policy, so a slow dashboard dropping lines never
+//  holds up the control loop. Only a BLOCK subscriber can stall the
+//  publisher, and with it everybody else.
+//
+
+#pragma once
+
+#include "serial_port.h"
+
+#include <memory>
+#include <thread>
+#include <condition_variable>
+
+// What a subscriber's queue does when a new line arrives and it is full
+enum class OverflowPolicy
+{
+    BLOCK,          // Publisher waits for the subscriber to catch up (lossless)
+    DROP_OLDEST,    // Oldest queued line is discarded
+    DROP_NEWEST     // New line is discarded
+};
+
+typedef std::shared_ptr<const std::string> SharedLine;
+
+class FanoutSubscriber
+{
+public:
+    FanoutSubscriber(int _capacity, OverflowPolicy _policy);
+
+    int next(SharedLine &line, int timeout_ms = -1);    // Get next line
+    unsigned long dropped();                            // Lines lost to overflow so far
+    void close();                                       // Wake up and stop waiters
+
+private:
+    friend class SerialFanout;
+    bool push(const SharedLine &line);
+
+    std::mutex lock;
+    std::condition_variable data_ready;
+    std::condition_variable space_ready;
+    std::vector<SharedLine> ring;
+    int head;           // Oldest queued line
+    int count;
+    OverflowPolicy policy;
+    unsigned long drops;
+    bool closed;
+};
+
+class SerialFanout
+{
+public:
+    SerialFanout(SERIAL_PORT &_port, int _max_line = 256);
+    ~SerialFanout();
+
+    std::shared_ptr<FanoutSubscriber> subscribe(int capacity = 256,
+        OverflowPolicy policy = OverflowPolicy::DROP_OLDEST);       // Add a consumer
+    void unsubscribe(const std::shared_ptr<FanoutSubscriber> &sub); // Remove a consumer
+    int start();            // Read and publish on a background thread
+    void stop();            // Stop the background thread, close subscribers
+    int poll_once();        // Read once and publish complete lines (no thread)
+
+private:
+    void publish(const SharedLine &line);
+    void close_all();
+
+    SERIAL_PORT &port;
+    int max_line;
+    std::string partial;    // Line still being received
+
+    std::mutex subs_lock;   // Only held to swap the subscriber list
+    std::shared_ptr<const std::vector<std::shared_ptr<FanoutSubscriber>>> subs;
+
+    std::thread reader;
+    std::atomic<bool> running;
+};
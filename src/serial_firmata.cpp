@@ -0,0 +1,341 @@
+//
+//  serial_firmata.cpp
+//
+//  Firmata client: in place decoding into a latest value table,
+//  batched output.
+//
+
+#include "serial_firmata.h"
+
+#include <algorithm>
+
+// _port = already opened serial port (StandardFirmata uses 57600 baud),
+// with a short read timeout (eg 1ms) as pump() reads once per call
+FirmataClient::FirmataClient(SERIAL_PORT &_port)
+    : port(_port)
+{
+    command = 0;
+    have = 0;
+    in_sysex = false;
+    sysex.reserve(FIRMATA_MAX_SYSEX);
+
+    for(int i = 0; i < FIRMATA_MAX_ANALOG; i++)
+    {
+        analog[i] = -1;
+        analog_samples[i] = 0;
+    }
+    memset(digital_in, 0, sizeof(digital_in));
+    memset(digital_out, 0, sizeof(digital_out));
+    digital_known = 0;
+    digital_dirty = 0;
+    major = minor = 0;
+    bad_bytes = 0;
+}
+
+// Number of data bytes following a command byte, -1 if it isn't one
+static int message_length(uint8_t command)
+{
+    switch(command < 0xF0 ? command & 0xF0 : command)
+    {
+        case FIRMATA_DIGITAL_MESSAGE:
+        case FIRMATA_ANALOG_MESSAGE:
+        case FIRMATA_SET_PIN_MODE:
+        case FIRMATA_SET_DIGITAL_PIN:
+        case FIRMATA_VERSION:
+            return 2;
+        case FIRMATA_REPORT_ANALOG:
+        case FIRMATA_REPORT_DIGITAL:
+            return 1;
+        case FIRMATA_SYSTEM_RESET:
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+void FirmataClient::pin_mode(int pin, int mode)
+{
+    if(pin < 0 || pin >= FIRMATA_MAX_PINS)
+        return;
+    out.push_back(FIRMATA_SET_PIN_MODE);
+    out.push_back(static_cast<uint8_t>(pin));
+    out.push_back(static_cast<uint8_t>(mode & 0x7F));
+}
+
+void FirmataClient::report_analog(int channel, bool enable)
+{
+    if(channel < 0 || channel >= FIRMATA_MAX_ANALOG)
+        return;
+    out.push_back(static_cast<uint8_t>(FIRMATA_REPORT_ANALOG | channel));
+    out.push_back(enable ? 1 : 0);
+}
+
+void FirmataClient::report_digital(int port_index, bool enable)
+{
+    if(port_index < 0 || port_index >= FIRMATA_MAX_PINS / 8)
+        return;
+    out.push_back(static_cast<uint8_t>(FIRMATA_REPORT_DIGITAL | port_index));
+    out.push_back(enable ? 1 : 0);
+}
+
+// ms = time between analog reports, StandardFirmata accepts down to 1ms
+void FirmataClient::set_sampling_interval(int ms)
+{
+    ms = std::max(1, std::min(ms, 0x3FFF));
+    uint8_t msg[5] = {FIRMATA_START_SYSEX, FIRMATA_SAMPLING_INTERVAL,
+                      static_cast<uint8_t>(ms & 0x7F), static_cast<uint8_t>(ms >> 7),
+                      FIRMATA_END_SYSEX};
+    out.insert(out.end(), msg, msg + sizeof(msg));
+}
+
+void FirmataClient::query_firmware()
+{
+    uint8_t msg[3] = {FIRMATA_START_SYSEX, FIRMATA_REPORT_FIRMWARE, FIRMATA_END_SYSEX};
+    out.insert(out.end(), msg, msg + sizeof(msg));
+}
+
+void FirmataClient::reset()
+{
+    out.push_back(FIRMATA_SYSTEM_RESET);
+}
+
+// Only updates the port state, flush() sends one message per changed port
+void FirmataClient::digital_write(int pin, bool value)
+{
+    if(pin < 0 || pin >= FIRMATA_MAX_PINS)
+        return;
+    uint8_t mask = static_cast<uint8_t>(1 << (pin & 7));
+    if(value)
+        digital_out[pin >> 3] |= mask;
+    else
+        digital_out[pin >> 3] &= ~mask;
+    digital_dirty |= static_cast<uint16_t>(1 << (pin >> 3));
+}
+
+// Pins 0..15 with values below 2^14 use ANALOG_MESSAGE, others
+// EXTENDED_ANALOG
+void FirmataClient::analog_write(int pin, int value)
+{
+    if(pin < 0 || pin >= FIRMATA_MAX_PINS || value < 0)
+        return;
+
+    if(pin < 16 && value < 0x4000) {
+        out.push_back(static_cast<uint8_t>(FIRMATA_ANALOG_MESSAGE | pin));
+        out.push_back(static_cast<uint8_t>(value & 0x7F));
+        out.push_back(static_cast<uint8_t>(value >> 7));
+        return;
+    }
+
+    out.push_back(FIRMATA_START_SYSEX);
+    out.push_back(FIRMATA_EXTENDED_ANALOG);
+    out.push_back(static_cast<uint8_t>(pin));
+    do {
+        out.push_back(static_cast<uint8_t>(value & 0x7F));
+        value >>= 7;
+    } while(value);
+    out.push_back(FIRMATA_END_SYSEX);
+}
+
+void FirmataClient::queue_digital_port(int port_index)
+{
+    uint8_t bits = digital_out[port_index];
+    out.push_back(static_cast<uint8_t>(FIRMATA_DIGITAL_MESSAGE | port_index));
+    out.push_back(bits & 0x7F);
+    out.push_back(bits >> 7);
+}
+
+// Sends the queued configuration and writes in a single write.
+// Returns number of bytes written, -1 on error.
+int FirmataClient::flush()
+{
+    for(int i = 0; digital_dirty; i++)
+    {
+        if(digital_dirty & (1 << i)) {
+            this->queue_digital_port(i);
+            digital_dirty &= static_cast<uint16_t>(~(1 << i));
+        }
+    }
+
+    if(out.empty())
+        return 0;
+
+    int w = port.swrite(out.data(), static_cast<int>(out.size()));
+    out.clear();
+
+    return w < 0 ? -1 : w;
+}
+
+// Reads what is available (waiting up to the port timeout), decodes it
+// into the value table and sends queued output.
+// Returns number of bytes read, -1 on error.
+int FirmataClient::pump()
+{
+    int n = port.sread(rx, sizeof(rx));
+    if(n == -1)
+        return -1;
+    if(n > 0) {
+        now = port.last_rx_time();
+        this->decode(rx, n);
+    }
+
+    if(this->flush() == -1)
+        return -1;
+
+    return n;
+}
+
+void FirmataClient::on_message(uint8_t cmd, uint8_t b1, uint8_t b2)
+{
+    int value = b1 | (b2 << 7);
+
+    switch(cmd & 0xF0)
+    {
+        case FIRMATA_ANALOG_MESSAGE:
+        {
+            int ch = cmd & 0x0F;
+            analog[ch] = value;
+            analog_stamp[ch] = now;
+            analog_samples[ch]++;
+            if(on_analog)
+                on_analog(ch, value);
+            return;
+        }
+        case FIRMATA_DIGITAL_MESSAGE:
+        {
+            int p = cmd & 0x0F;
+            digital_in[p] = static_cast<uint8_t>(value);
+            digital_known |= static_cast<uint16_t>(1 << p);
+            return;
+        }
+    }
+    if(cmd == FIRMATA_VERSION) {
+        major = b1;
+        minor = b2;
+    }
+}
+
+void FirmataClient::on_sysex()
+{
+    if(sysex.empty())
+        return;
+
+    if(sysex[0] == FIRMATA_REPORT_FIRMWARE && sysex.size() >= 3) {
+        major = sysex[1];
+        minor = sysex[2];
+        firmware_name.clear();
+        for(size_t i = 3; i + 1 < sysex.size(); i += 2)
+            firmware_name += static_cast<char>(sysex[i] | (sysex[i + 1] << 7));
+    }
+}
+
+// Decodes a chunk of input. Whole analog / digital messages take the
+// fast path straight from the buffer, anything else (split messages,
+// sysex, rarer commands) goes through the state machine.
+void FirmataClient::decode(const uint8_t *buf, int len)
+{
+    int i = 0;
+
+    while(i < len)
+    {
+        if(!in_sysex && command == 0) {
+            // Fast path: the stream is mostly 3 byte messages
+            while(i + 2 < len &&
+                  ((buf[i] & 0xF0) == FIRMATA_ANALOG_MESSAGE ||
+                   (buf[i] & 0xF0) == FIRMATA_DIGITAL_MESSAGE) &&
+                  !(buf[i + 1] & 0x80) && !(buf[i + 2] & 0x80))
+            {
+                this->on_message(buf[i], buf[i + 1], buf[i + 2]);
+                i += 3;
+            }
+            if(i >= len)
+                break;
+        }
+
+        uint8_t b = buf[i++];
+
+        if(in_sysex) {
+            if(b == FIRMATA_END_SYSEX) {
+                in_sysex = false;
+                this->on_sysex();
+            }
+            else if(b & 0x80) {
+                // Command inside sysex: the end was lost, drop it
+                bad_bytes += sysex.size();
+                in_sysex = false;
+                i--;
+            }
+            else if(sysex.size() < FIRMATA_MAX_SYSEX)
+                sysex.push_back(b);
+            else
+                bad_bytes++;
+            continue;
+        }
+
+        if(b & 0x80) {
+            if(command != 0)
+                bad_bytes += 1 + have;      // Previous message cut short
+            command = 0;
+            have = 0;
+
+            if(b == FIRMATA_START_SYSEX) {
+                in_sysex = true;
+                sysex.clear();
+                continue;
+            }
+            int n = message_length(b);
+            if(n < 0)
+                bad_bytes++;
+            else if(n == 0)
+                this->on_message(b, 0, 0);
+            else
+                command = b;
+            continue;
+        }
+
+        if(command == 0) {
+            bad_bytes++;
+            continue;
+        }
+        data[have++] = b;
+        if(have == message_length(command)) {
+            this->on_message(command, data[0], have > 1 ? data[1] : 0);
+            command = 0;
+            have = 0;
+        }
+    }
+}
+
+int FirmataClient::analog_read(int channel) const
+{
+    if(channel < 0 || channel >= FIRMATA_MAX_ANALOG)
+        return -1;
+    return analog[channel];
+}
+
+int FirmataClient::digital_read(int pin) const
+{
+    if(pin < 0 || pin >= FIRMATA_MAX_PINS || !(digital_known & (1 << (pin >> 3))))
+        return -1;
+    return (digital_in[pin >> 3] >> (pin & 7)) & 1;
+}
+
+SerialClock::time_point FirmataClient::analog_time(int channel) const
+{
+    if(channel < 0 || channel >= FIRMATA_MAX_ANALOG)
+        return SerialClock::time_point();
+    return analog_stamp[channel];
+}
+
+unsigned long FirmataClient::analog_count(int channel) const
+{
+    if(channel < 0 || channel >= FIRMATA_MAX_ANALOG)
+        return 0;
+    return analog_samples[channel];
+}
+
+// Called from pump() with every analog sample, in arrival order (the
+// value table only keeps the latest)
+void FirmataClient::set_analog_handler(std::function<void(int channel, int value)> handler)
+{
+    on_analog = handler;
+}
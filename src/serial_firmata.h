@@ -0,0 +1,123 @@
+//
+//  serial_firmata.h
+//
+//  Client for boards running Firmata (StandardFirmata and friends).
+//  Input is read in chunks into a fixed buffer and decoded in place by
+//  a small state machine: analog and digital messages update a table
+//  of the latest value of every pin, so readers just look the value up
+//  instead of parsing byte vectors. A message split across two reads is
+//  carried over in the decoder state.
+//
+//  Output is batched: pin modes, reporting settings and pin writes are
+//  queued and sent in one swrite() by flush() (pump() calls it), and
+//  digital writes to pins of the same port collapse into a single
+//  DIGITAL_MESSAGE with the port's final state.
+//
+//  For fast analog sampling, set_sampling_interval(1) and enable
+//  reporting only on the channels needed: at 57600 baud each reported
+//  channel costs 3 bytes per sample, so the link carries about 1900
+//  channel samples per second in total.
+//
+//  Single threaded: call everything from the same thread.
+//
+
+#pragma once
+
+#include "serial_port.h"
+
+#include <chrono>
+
+// Message types (upper nibble carries the port / channel)
+#define FIRMATA_DIGITAL_MESSAGE 0x90
+#define FIRMATA_ANALOG_MESSAGE 0xE0
+#define FIRMATA_REPORT_ANALOG 0xC0
+#define FIRMATA_REPORT_DIGITAL 0xD0
+#define FIRMATA_SET_PIN_MODE 0xF4
+#define FIRMATA_SET_DIGITAL_PIN 0xF5
+#define FIRMATA_VERSION 0xF9
+#define FIRMATA_SYSTEM_RESET 0xFF
+#define FIRMATA_START_SYSEX 0xF0
+#define FIRMATA_END_SYSEX 0xF7
+
+// Sysex commands
+#define FIRMATA_EXTENDED_ANALOG 0x6F
+#define FIRMATA_REPORT_FIRMWARE 0x79
+#define FIRMATA_SAMPLING_INTERVAL 0x7A
+
+// Pin modes
+#define FIRMATA_INPUT 0x00
+#define FIRMATA_OUTPUT 0x01
+#define FIRMATA_ANALOG 0x02
+#define FIRMATA_PWM 0x03
+#define FIRMATA_SERVO 0x04
+#define FIRMATA_PULLUP 0x0B
+
+#define FIRMATA_MAX_PINS 128
+#define FIRMATA_MAX_ANALOG 16
+#define FIRMATA_MAX_SYSEX 256
+
+class FirmataClient
+{
+public:
+    FirmataClient(SERIAL_PORT &_port);
+
+    // Configuration, queued until flush()
+    void pin_mode(int pin, int mode);
+    void report_analog(int channel, bool enable);       // Stream analog channel (A0 = 0)
+    void report_digital(int port_index, bool enable);   // Stream digital port (pins 8*port..+7)
+    void set_sampling_interval(int ms);                 // Analog reporting period
+    void query_firmware();                              // Ask for version and firmware name
+    void reset();                                       // SYSTEM_RESET
+
+    // Pin writes, queued until flush()
+    void digital_write(int pin, bool value);
+    void analog_write(int pin, int value);              // PWM / servo value, up to 14 bits
+
+    int flush();    // Send everything queued in one write
+    int pump();     // Read and decode available input, then flush()
+
+    // Latest values received
+    int analog_read(int channel) const;                 // -1 if never reported
+    int digital_read(int pin) const;                    // -1 if never reported
+    SerialClock::time_point analog_time(int channel) const;    // When the value was read
+    unsigned long analog_count(int channel) const;     // Samples received on a channel
+    void set_analog_handler(std::function<void(int channel, int value)> handler);   // Per sample
+
+    std::string firmware() const { return firmware_name; }  // Empty until reported
+    int version_major() const { return major; }
+    int version_minor() const { return minor; }
+    unsigned long errors() const { return bad_bytes; }  // Bytes that fit no message
+
+private:
+    void decode(const uint8_t *buf, int len);
+    void on_message(uint8_t command, uint8_t b1, uint8_t b2);
+    void on_sysex();
+    void queue_digital_port(int port_index);
+
+    SERIAL_PORT &port;
+    uint8_t rx[1024];                   // Read buffer, decoded in place
+    std::vector<uint8_t> out;           // Queued output
+    SerialClock::time_point now;        // Stamp of the chunk being decoded
+
+    // Decoder state, carried between reads
+    uint8_t command;                    // Pending message type, 0 = none
+    uint8_t data[2];
+    int have;                           // Data bytes of the pending message so far
+    bool in_sysex;
+    std::vector<uint8_t> sysex;
+
+    // Latest value table
+    int analog[FIRMATA_MAX_ANALOG];
+    SerialClock::time_point analog_stamp[FIRMATA_MAX_ANALOG];
+    unsigned long analog_samples[FIRMATA_MAX_ANALOG];
+    uint8_t digital_in[FIRMATA_MAX_PINS / 8];
+    uint16_t digital_known;             // Ports reported at least once, one bit each
+    std::function<void(int, int)> on_analog;
+
+    uint8_t digital_out[FIRMATA_MAX_PINS / 8];  // Output state of each port
+    uint16_t digital_dirty;             // Ports with writes queued, one bit each
+
+    std::string firmware_name;
+    int major, minor;
+    unsigned long bad_bytes;
+};
@@ -0,0 +1,46 @@
+//
+//  serial_frame.h
+//
+//  Framing helpers shared by the protocol layers (channels, reliable
+//  transport): frames are the payload followed by a CRC16, COBS encoded
+//  and terminated by a 0x00 byte. COBS keeps 0x00 out of the encoded
+//  data, so after a corrupted or dropped byte the decoder resyncs on the
+//  next delimiter, and the CRC throws away the damaged frame.
+//
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <functional>
+
+#define FRAME_DELIMITER 0x00
+
+uint16_t crc16_ccitt(const uint8_t *buf, int len, uint16_t crc = 0xFFFF);  // CRC-16/CCITT-FALSE
+uint32_t crc32_ieee(const uint8_t *buf, int len, uint32_t crc = 0);        // CRC-32 (zlib, Ethernet)
+int cobs_encode(const uint8_t *in, int len, uint8_t *out);     // Returns encoded length
+int cobs_decode(const uint8_t *in, int len, uint8_t *out);     // Returns decoded length, -1 if malformed
+void frame_encode(const uint8_t *payload, int len,
+                  std::vector<uint8_t> &out);                  // Append CRC, COBS and delimiter
+
+// Splits a byte stream into frames, checking their CRC
+class FrameDecoder
+{
+public:
+    FrameDecoder(int _max_frame = 1024);
+
+    // Feeds received bytes, calls on_frame(payload, len) for every
+    // intact frame. Returns number of frames delivered.
+    int feed(const uint8_t *buf, int len,
+             std::function<void(const uint8_t *, int)> on_frame);
+    unsigned long errors() const { return bad_frames; }        // Frames dropped (CRC, size, COBS)
+
+private:
+    int max_frame;
+    int max_encoded;                // Longest encoded frame accepted (payload, CRC, COBS overhead)
+    std::vector<uint8_t> encoded;   // Bytes since the last delimiter
+    std::vector<uint8_t> decoded;
+    bool overflow;                  // Current frame too long, skip to next delimiter
+    unsigned long bad_frames;
+};
@@ -0,0 +1,165 @@
+//
+//  serial_merge.cpp
+//
+//  Time ordered k-way merge of samples from many devices.
+//
+
+#include "serial_merge.h"
+
+#include <algorithm>
+#include <cmath>
+
+// _sources = number of sources, samples carry 0 .. _sources - 1
+// _window_ms = reorder window. A sample is held at most this long
+// (after its timestamp) waiting for quiet sources, pick it above the
+// worst delivery delay of the slowest board (USB latency timer, ...)
+SampleMerger::SampleMerger(int _sources, int _window_ms)
+    : queues(_sources), heap_time(_sources), hold(_sources, NAN)
+{
+    nonempty = 0;
+    queued = 0;
+    window = std::chrono::milliseconds(_window_ms);
+    started = false;
+    late = 0;
+    period = SerialClock::duration::zero();
+    ticking = false;
+}
+
+// Adds a sample. Samples of one source normally arrive in time order,
+// the odd one out of order is sorted into its queue.
+// Returns 0 if queued, -1 on invalid source, -2 if late.
+int SampleMerger::push(const MergeSample &sample)
+{
+    if(sample.source < 0 || sample.source >= static_cast<int>(queues.size()))
+        return -1;
+
+    if(started && sample.time < released) {
+        late++;
+        if(late_handler)
+            late_handler(sample);
+        return -2;
+    }
+
+    std::deque<MergeSample> &q = queues[sample.source];
+
+    if(q.empty() || !(sample.time < q.back().time))
+        q.push_back(sample);
+    else {
+        auto pos = std::upper_bound(q.begin(), q.end(), sample,
+            [](const MergeSample &a, const MergeSample &b) { return a.time < b.time; });
+        q.insert(pos, sample);
+    }
+    queued++;
+
+    // New head for this source, the old heap entry (if any) goes stale
+    if(q.size() == 1 || q.front().time < heap_time[sample.source]) {
+        if(q.size() == 1)
+            nonempty++;
+        heap_time[sample.source] = q.front().time;
+        heap.push_back(HeapEntry{q.front().time, sample.source});
+        std::push_heap(heap.begin(), heap.end());
+    }
+
+    return 0;
+}
+
+// Takes the earliest queued sample off its queue
+int SampleMerger::release(MergeSample &sample)
+{
+    while(!heap.empty())
+    {
+        HeapEntry top = heap.front();
+        std::pop_heap(heap.begin(), heap.end());
+        heap.pop_back();
+
+        std::deque<MergeSample> &q = queues[top.source];
+        if(q.empty() || top.time != heap_time[top.source])
+            continue;               // Stale entry
+
+        sample = q.front();
+        q.pop_front();
+        queued--;
+        if(q.empty())
+            nonempty--;
+        else {
+            heap_time[top.source] = q.front().time;
+            heap.push_back(HeapEntry{q.front().time, top.source});
+            std::push_heap(heap.begin(), heap.end());
+        }
+
+        this->align_until(sample.time);
+        hold[sample.source] = sample.value;
+        released = sample.time;
+        started = true;
+
+        return 1;
+    }
+
+    return 0;
+}
+
+// Gets the next sample in time order, if it can be released by now:
+// every source has data queued, or it's older than the reorder window.
+// Returns 1 if a sample was stored in sample, 0 if none is ready.
+int SampleMerger::pop(MergeSample &sample, SerialClock::time_point now)
+{
+    while(!heap.empty() && (queues[heap.front().source].empty() ||
+                            heap.front().time != heap_time[heap.front().source]))
+    {
+        std::pop_heap(heap.begin(), heap.end());    // Drop stale entries
+        heap.pop_back();
+    }
+    if(heap.empty())
+        return 0;
+
+    if(nonempty < static_cast<int>(queues.size()) && heap.front().time + window > now)
+        return 0;       // A quiet source may still deliver something earlier
+
+    return this->release(sample);
+}
+
+// Gets the next sample in time order without waiting for the window,
+// to drain what's left once capture stops.
+// Returns 1 if a sample was stored in sample, 0 if none is left.
+int SampleMerger::finish(MergeSample &sample)
+{
+    return this->release(sample);
+}
+
+// Calls on_set(tick, values) at rate_hz with the latest value of each
+// source at or before the tick (NaN for sources not heard from yet).
+// Ticks start at the first sample released and run as samples come out,
+// so they're exact in stream time however late pop() is called.
+void SampleMerger::set_alignment(double rate_hz,
+    std::function<void(SerialClock::time_point, const std::vector<double> &)> on_set)
+{
+    period = std::chrono::duration_cast<SerialClock::duration>(
+        std::chrono::duration<double>(1.0 / rate_hz));
+    set_handler = on_set;
+    ticking = false;
+}
+
+// Sets a function receiving late samples (default: counted and dropped)
+void SampleMerger::set_late_handler(std::function<void(const MergeSample &)> on_late)
+{
+    late_handler = on_late;
+}
+
+// Emits the aligned sets for the ticks up to time (exclusive), before
+// the sample at time is applied
+void SampleMerger::align_until(SerialClock::time_point time)
+{
+    if(period == SerialClock::duration::zero())
+        return;
+
+    if(!ticking) {
+        next_tick = time;
+        ticking = true;
+        return;
+    }
+    while(next_tick < time)
+    {
+        set_handler(next_tick, hold);
+        next_tick += period;
+    }
+}
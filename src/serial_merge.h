@@ -0,0 +1,83 @@
+//
+//  serial_merge.h
+//
+//  Merges timestamped samples coming from many devices into one stream
+//  in time order. Each source (a board, or a channel of one) keeps its
+//  own queue, and a heap holding the head of each queue picks the
+//  earliest sample, so a sample costs O(log sources) whatever the
+//  number of queued samples.
+//
+//  A sample is released once no source can still deliver an earlier
+//  one: either every source has something queued (queues are in time
+//  order), or the sample is older than the reorder window, which bounds
+//  how long a quiet or stalled board holds up the rest. Samples showing
+//  up after the stream has moved past their time are late: they're
+//  counted and handed to the late handler, if any, instead.
+//
+//  Optionally, aligned sample sets are produced at a fixed rate: at each
+//  tick, the latest value of every source at or before the tick time.
+//
+//  Timestamps must share one time base: use last_rx_time(), or map the
+//  device clocks onto host time with ClockSync::to_host().
+//
+//  Single threaded: push() and pop() must be called from the same thread
+//  (eg the loop polling all the ports).
+//
+
+#pragma once
+
+#include "serial_port.h"
+
+#include <deque>
+
+struct MergeSample
+{
+    SerialClock::time_point time;
+    int source;         // 0 .. sources - 1
+    double value;
+};
+
+class SampleMerger
+{
+public:
+    SampleMerger(int _sources, int _window_ms = 50);
+
+    int push(const MergeSample &sample);        // Add a sample from one source
+    int pop(MergeSample &sample,
+            SerialClock::time_point now = SerialClock::now());  // Next sample in time order
+    int finish(MergeSample &sample);            // Next sample, ignoring the window (end of capture)
+    void set_alignment(double rate_hz,
+        std::function<void(SerialClock::time_point,
+                           const std::vector<double> &)> on_set);   // Aligned sets at rate_hz
+    void set_late_handler(std::function<void(const MergeSample &)> on_late);
+    unsigned long late_count() const { return late; }   // Samples that came in too late
+    size_t pending() const { return queued; }           // Samples waiting for release
+
+private:
+    struct HeapEntry
+    {
+        SerialClock::time_point time;
+        int source;
+        bool operator<(const HeapEntry &other) const { return time > other.time; }  // Min heap
+    };
+
+    int release(MergeSample &sample);
+    void align_until(SerialClock::time_point time);
+
+    std::vector<std::deque<MergeSample>> queues;    // Per source, in time order
+    std::vector<HeapEntry> heap;                    // Head of each non-empty queue
+    std::vector<SerialClock::time_point> heap_time; // Live heap entry per source
+    int nonempty;                                   // Sources with something queued
+    size_t queued;
+    SerialClock::duration window;
+    SerialClock::time_point released;               // Time of the last sample out
+    bool started;
+    unsigned long late;
+    std::function<void(const MergeSample &)> late_handler;
+
+    SerialClock::duration period;                   // Aligned sets, zero if disabled
+    SerialClock::time_point next_tick;
+    bool ticking;                                   // next_tick set by the first sample
+    std::vector<double> hold;                       // Latest value per source
+    std::function<void(SerialClock::time_point, const std::vector<double> &)> set_handler;
+};
@@ -0,0 +1,333 @@
+//
+//  serial_modbus.cpp
+//
+//  Modbus RTU master with merged register polling.
+//
+
+#include "serial_modbus.h"
+
+#include <algorithm>
+#include <thread>
+
+// CRC-16/MODBUS (reflected poly 0xA001, init 0xFFFF), one table lookup
+// per byte
+static const uint16_t crc_table[256] = {
+    0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+    0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+    0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+    0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+    0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+    0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+    0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+    0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+    0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+    0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+    0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+    0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+    0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+    0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+    0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+    0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+    0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+    0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+    0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+    0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+    0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+    0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+    0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+    0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+    0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+    0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+    0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+    0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+    0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+    0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+    0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+    0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
+};
+
+// Running it over a frame including its CRC (low byte first) gives 0
+uint16_t modbus_crc16(const uint8_t *buf, size_t len)
+{
+    uint16_t crc = 0xFFFF;
+    for(size_t i = 0; i < len; i++)
+        crc = static_cast<uint16_t>((crc >> 8) ^ crc_table[(crc ^ buf[i]) & 0xFF]);
+    return crc;
+}
+
+// _port = already opened serial port, with a short read timeout (eg 1ms)
+// _baud = the port's baud rate, sets the frame timing
+// _timeout_ms = time a slave gets to answer, on top of the time the
+// request and reply take on the wire
+ModbusMaster::ModbusMaster(SERIAL_PORT &_port, int _baud, int _timeout_ms)
+    : port(_port), baud(_baud), timeout_ms(_timeout_ms)
+{
+    // 3.5 characters of 11 bits, fixed above 19200 baud
+    t35_us = baud > 19200 ? 1750 : this->chars_us(7) / 2;
+    idle_at = SerialClock::now();
+    exception = 0;
+    cycle_ms = 0;
+}
+
+// Time chars characters take on the wire
+int ModbusMaster::chars_us(int chars) const
+{
+    return static_cast<int>(chars * 11 * 1000000LL / std::max(baud, 1));
+}
+
+uint32_t ModbusMaster::key(uint8_t slave, uint8_t function, uint16_t addr)
+{
+    return static_cast<uint32_t>(slave) << 24 | static_cast<uint32_t>(function) << 16 | addr;
+}
+
+// Appends the CRC to the len bytes of frame, returns the new length
+int ModbusMaster::finish_frame(uint8_t *frame, int len)
+{
+    uint16_t crc = modbus_crc16(frame, len);
+    frame[len] = static_cast<uint8_t>(crc & 0xFF);
+    frame[len + 1] = static_cast<uint8_t>(crc >> 8);
+    return len + 2;
+}
+
+// Sends a request and reads a reply of resp_len bytes (5 if it's an
+// exception), after leaving the bus silent for t3.5.
+// Returns 0 if OK, -1 on error, -2 on timeout.
+int ModbusMaster::transact(const uint8_t *req, int req_len, uint8_t *resp, int resp_len)
+{
+    exception = 0;
+    std::this_thread::sleep_until(idle_at);
+    port.sdiscard_input();      // Late replies to an earlier request
+
+    if(port.swrite(req, req_len) < 0) {
+        idle_at = SerialClock::now() + std::chrono::microseconds(t35_us);
+        return -1;
+    }
+
+    // Broadcast: nobody answers, give the slaves the time to act on it
+    if(req[0] == 0) {
+        idle_at = SerialClock::now() +
+                  std::chrono::microseconds(this->chars_us(req_len) + t35_us);
+        return 0;
+    }
+
+    auto deadline = SerialClock::now() + std::chrono::milliseconds(timeout_ms) +
+                    std::chrono::microseconds(this->chars_us(req_len + resp_len));
+    int got = 0;
+    int expect = resp_len;
+
+    while(got < expect)
+    {
+        int n = port.sread(resp + got, expect - got);
+        if(n == -1)
+            return -1;
+        if(n > 0) {
+            got += n;
+            if(got >= 2 && (resp[1] & 0x80))
+                expect = 5;     // Exception reply
+        }
+        if(got < expect && SerialClock::now() >= deadline) {
+            idle_at = SerialClock::now() + std::chrono::microseconds(t35_us);
+#if PORTCON_DEBUG
+            std::cerr << "Modbus slave " << static_cast<int>(req[0]) << ": no reply to function " <<
+                static_cast<int>(req[1]) << " (" << got << " of " << expect << " bytes)" << std::endl;
+#endif
+            return -2;
+        }
+    }
+    idle_at = port.last_rx_time() + std::chrono::microseconds(t35_us);
+
+    if(modbus_crc16(resp, expect) != 0 || resp[0] != req[0] || (resp[1] & 0x7F) != req[1]) {
+#if PORTCON_DEBUG
+        std::cerr << "Modbus slave " << static_cast<int>(req[0]) << ": bad reply" << std::endl;
+#endif
+        return -1;
+    }
+    if(resp[1] & 0x80) {
+        exception = resp[2];
+#if PORTCON_DEBUG
+        std::cerr << "Modbus slave " << static_cast<int>(req[0]) << ": exception " <<
+            exception << " to function " << static_cast<int>(req[1]) << std::endl;
+#endif
+        return -1;
+    }
+
+    return 0;
+}
+
+// Reads count (1..125) holding (MODBUS_READ_HOLDING) or input
+// (MODBUS_READ_INPUT) registers starting at addr into values.
+// Returns 0 if OK, -1 on error, -2 on timeout.
+int ModbusMaster::read_registers(uint8_t slave, uint8_t function, uint16_t addr,
+                                 int count, uint16_t *values)
+{
+    if(count < 1 || count > MODBUS_MAX_READ)
+        return -1;
+
+    uint8_t req[8] = {slave, function, static_cast<uint8_t>(addr >> 8), static_cast<uint8_t>(addr),
+                      0, static_cast<uint8_t>(count)};
+    this->finish_frame(req, 6);
+
+    uint8_t resp[5 + 2 * MODBUS_MAX_READ];
+    int r = this->transact(req, 8, resp, 5 + 2 * count);
+    if(r < 0)
+        return r;
+    if(resp[2] != 2 * count)
+        return -1;
+
+    for(int i = 0; i < count; i++)
+        values[i] = static_cast<uint16_t>(resp[3 + 2 * i] << 8 | resp[4 + 2 * i]);
+
+    return 0;
+}
+
+int ModbusMaster::write_register(uint8_t slave, uint16_t addr, uint16_t value)
+{
+    uint8_t req[8] = {slave, MODBUS_WRITE_SINGLE,
+                      static_cast<uint8_t>(addr >> 8), static_cast<uint8_t>(addr),
+                      static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value)};
+    this->finish_frame(req, 6);
+
+    uint8_t resp[8];
+    return this->transact(req, 8, resp, 8);     // Echoes the request
+}
+
+// Writes count (1..123) registers starting at addr.
+// Returns 0 if OK, -1 on error, -2 on timeout.
+int ModbusMaster::write_registers(uint8_t slave, uint16_t addr, const uint16_t *values, int count)
+{
+    if(count < 1 || count > MODBUS_MAX_WRITE)
+        return -1;
+
+    uint8_t req[9 + 2 * MODBUS_MAX_WRITE] = {slave, MODBUS_WRITE_MULTIPLE,
+        static_cast<uint8_t>(addr >> 8), static_cast<uint8_t>(addr),
+        0, static_cast<uint8_t>(count), static_cast<uint8_t>(2 * count)};
+    for(int i = 0; i < count; i++)
+    {
+        req[7 + 2 * i] = static_cast<uint8_t>(values[i] >> 8);
+        req[8 + 2 * i] = static_cast<uint8_t>(values[i]);
+    }
+    int len = this->finish_frame(req, 7 + 2 * count);
+
+    uint8_t resp[8];
+    return this->transact(req, len, resp, 8);
+}
+
+// Adds count registers from addr to the points poll_cycle() reads.
+// Takes effect at the next plan().
+void ModbusMaster::add_poll(uint8_t slave, uint8_t function, uint16_t addr, int count)
+{
+    if(count < 1 || addr + count > 0x10000)
+        return;
+
+    Range r = {slave, function, addr, count};
+    watched.push_back(r);
+}
+
+// Builds the polling schedule: per slave and function, ranges closer
+// than max_gap unwatched registers are read with one request (up to
+// 125 registers). Reading a gap register costs 2 bytes, a separate
+// request about 20 characters plus the slave's turnaround, but slaves
+// answer with an exception if the gap holds unmapped addresses, so it
+// defaults to merging only touching / overlapping ranges. -1 keeps one
+// request per add_poll().
+// Returns the number of requests per cycle.
+int ModbusMaster::plan(int max_gap)
+{
+    std::vector<Range> ranges = watched;
+    std::vector<Range> merged;
+
+    if(max_gap < 0)
+        merged = ranges;
+    else {
+        std::sort(ranges.begin(), ranges.end(), [](const Range &a, const Range &b) {
+            if(a.slave != b.slave)
+                return a.slave < b.slave;
+            if(a.function != b.function)
+                return a.function < b.function;
+            return a.addr < b.addr;
+        });
+
+        for(const Range &r : ranges)
+        {
+            if(!merged.empty()) {
+                Range &m = merged.back();
+                int m_end = m.addr + m.count;
+                int end = std::max(m_end, r.addr + r.count);
+                if(m.slave == r.slave && m.function == r.function &&
+                   r.addr <= m_end + max_gap && end - m.addr <= MODBUS_MAX_READ) {
+                    m.count = end - m.addr;
+                    continue;
+                }
+            }
+            merged.push_back(r);
+
+            // A range longer than one request can carry is split
+            while(merged.back().count > MODBUS_MAX_READ)
+            {
+                Range rest = merged.back();
+                merged.back().count = MODBUS_MAX_READ;
+                rest.addr = static_cast<uint16_t>(rest.addr + MODBUS_MAX_READ);
+                rest.count -= MODBUS_MAX_READ;
+                merged.push_back(rest);
+            }
+        }
+    }
+
+    planned.clear();
+    lookup.clear();
+    for(const Range &r : merged)
+    {
+        Request req;
+        req.range = r;
+        uint8_t head[6] = {r.slave, r.function, static_cast<uint8_t>(r.addr >> 8),
+                           static_cast<uint8_t>(r.addr), 0, static_cast<uint8_t>(r.count)};
+        memcpy(req.frame, head, sizeof(head));
+        this->finish_frame(req.frame, 6);
+        req.values.assign(r.count, 0);
+        req.valid = false;
+        planned.push_back(req);
+
+        int index = static_cast<int>(planned.size()) - 1;
+        for(int i = 0; i < r.count; i++)
+            lookup[key(r.slave, r.function, static_cast<uint16_t>(r.addr + i))] = std::make_pair(index, i);
+    }
+
+    return static_cast<int>(planned.size());
+}
+
+// Runs every planned request once, back to back, and updates the values
+// read. Returns number of requests that failed (their values keep the
+// previous reading but are reported as -1 until read again).
+int ModbusMaster::poll_cycle()
+{
+    auto start = SerialClock::now();
+    uint8_t resp[5 + 2 * MODBUS_MAX_READ];
+    int failed = 0;
+
+    for(Request &req : planned)
+    {
+        int count = req.range.count;
+        if(this->transact(req.frame, 8, resp, 5 + 2 * count) < 0 || resp[2] != 2 * count) {
+            req.valid = false;
+            failed++;
+            continue;
+        }
+        for(int i = 0; i < count; i++)
+            req.values[i] = static_cast<uint16_t>(resp[3 + 2 * i] << 8 | resp[4 + 2 * i]);
+        req.valid = true;
+    }
+
+    cycle_ms = std::chrono::duration<double, std::milli>(SerialClock::now() - start).count();
+
+    return failed;
+}
+
+int ModbusMaster::value(uint8_t slave, uint8_t function, uint16_t addr) const
+{
+    auto it = lookup.find(key(slave, function, addr));
+    if(it == lookup.end())
+        return -1;
+
+    const Request &req = planned[it->second.first];
+    return req.valid ? req.values[it->second.second] : -1;
+}
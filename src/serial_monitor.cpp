@@ -0,0 +1,399 @@
+//
+// serial_monitor.cpp
+//
+// Monitor for many serial ports at once, built on serial_portset.h. One
+// event loop reads every port, splits the input into lines and prefixes
+// each with its arrival time and the port's label. Output is batched:
+// lines are appended to a buffer that a writer thread hands to the
+// terminal or file in large writes, so a slow terminal never stalls the
+// reading (if it falls far behind, output is dropped and counted, the
+// ports are still read). Per port rates and counters go to stderr.
+//
+// Usage: serial_monitor [-o file] [-d dir] [-i seconds] [-T] device:baud[:label] [...]
+//   eg:  serial_monitor /dev/ttyACM0:1000000:imu /dev/ttyUSB0:115200:gps
+//
+//   -o file     write all ports to file instead of the terminal
+//   -d dir      write each port to dir/<label>.log
+//   -i seconds  interval of the rates on stderr (default 1, 0 = off)
+//   -T          no timestamps
+//
+// label defaults to the device name without its path. Exit with Ctrl+C.
+// macOS / Linux only.
+//
+
+#include "serial_port.h"
+#include "serial_portset.h"
+
+#include <csignal>		// So std::signal can work
+#include <climits>
+#include <condition_variable>
+#include <ctime>
+#include <memory>
+#include <thread>
+
+#define MONITOR_BATCH (64 * 1024)           // Buffered output handed to the writer at once
+#define MONITOR_MAX_PENDING (64 << 20)      // Output waiting for the writer before dropping
+#define MONITOR_MAX_LINE 16384              // Longer partial lines are printed as they are
+
+volatile std::sig_atomic_t quit = 0;
+
+// Ctrl+C handler function
+void sig_handler(int) {
+    quit = 1;
+}
+
+// Output file / terminal written by its own thread, fed in batches
+class OutputSink
+{
+public:
+    OutputSink(int _fd) : fd(_fd), dropped(0), stop(false)
+    {
+        batch.reserve(2 * MONITOR_BATCH);
+        writer = std::thread(&OutputSink::run, this);
+    }
+
+    ~OutputSink()
+    {
+        this->commit();
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stop = true;
+        }
+        wake.notify_one();
+        writer.join();
+        if (fd > 2)
+            close(fd);
+    }
+
+    // Buffer the event loop appends to
+    std::string &out() { return batch; }
+
+    // Hands the buffered output to the writer thread
+    void commit()
+    {
+        if (batch.empty())
+            return;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (pending.size() > MONITOR_MAX_PENDING)
+                dropped += batch.size();
+            else
+                pending.append(batch);
+        }
+        batch.clear();
+        wake.notify_one();
+    }
+
+    unsigned long long dropped_bytes()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        return dropped;
+    }
+
+private:
+    void run()
+    {
+        std::string writing;
+        std::unique_lock<std::mutex> guard(lock);
+
+        while (1)
+        {
+            wake.wait(guard, [this] { return stop || !pending.empty(); });
+            if (pending.empty() && stop)
+                return;
+
+            writing.swap(pending);
+            guard.unlock();
+            size_t done = 0;
+            while (done < writing.size())
+            {
+                ssize_t w = write(fd, writing.data() + done, writing.size() - done);
+                if (w < 0 && errno != EINTR)
+                    break;
+                if (w > 0)
+                    done += w;
+            }
+            writing.clear();
+            guard.lock();
+        }
+    }
+
+    int fd;
+    std::string batch;              // Filled by the event loop
+    std::string pending;            // Waiting for the writer
+    unsigned long long dropped;
+    bool stop;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::thread writer;
+};
+
+struct MonitoredPort
+{
+    std::string device;
+    std::string label;
+    SerialPort port;
+    OutputSink *sink;
+    std::string partial;                        // Line without its end yet
+    SerialClock::time_point partial_time;       // When its first byte arrived
+    unsigned long long bytes = 0;
+    unsigned long long lines = 0;
+    unsigned long long last_bytes = 0;          // At the previous rate report
+    unsigned long long last_lines = 0;
+    bool failed = false;
+};
+
+// Turns steady clock stamps into wall clock prefixes, formatting the
+// date part once per second
+class TimeFormatter
+{
+public:
+    TimeFormatter()
+    {
+        offset = std::chrono::system_clock::now().time_since_epoch() -
+                 std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                     SerialClock::now().time_since_epoch());
+        last_second = -1;
+    }
+
+    // Appends "HH:MM:SS.uuuuuu " for time to out
+    void append(std::string &out, SerialClock::time_point time)
+    {
+        long long us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                time.time_since_epoch()) + offset).count();
+        long long second = us / 1000000;
+
+        if (second != last_second) {
+            time_t t = static_cast<time_t>(second);
+            struct tm tm;
+            localtime_r(&t, &tm);
+            strftime(hms, sizeof(hms), "%H:%M:%S", &tm);
+            last_second = second;
+        }
+
+        char buf[24];
+        int frac = static_cast<int>(us % 1000000);
+        memcpy(buf, hms, 8);
+        buf[8] = '.';
+        for (int i = 14; i >= 9; i--)
+        {
+            buf[i] = static_cast<char>('0' + frac % 10);
+            frac /= 10;
+        }
+        buf[15] = ' ';
+        out.append(buf, 16);
+    }
+
+private:
+    std::chrono::system_clock::duration offset;
+    long long last_second;
+    char hms[16];
+};
+
+int main(int argc, char *argv[])
+{
+    std::string out_file;
+    std::string out_dir;
+    double interval = 1;
+    bool timestamps = true;
+    std::vector<std::string> specs;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc)
+            out_file = argv[++i];
+        else if (arg == "-d" && i + 1 < argc)
+            out_dir = argv[++i];
+        else if (arg == "-i" && i + 1 < argc)
+            interval = atof(argv[++i]);
+        else if (arg == "-T")
+            timestamps = false;
+        else
+            specs.push_back(arg);
+    }
+    if (specs.empty()) {
+        std::cout << "Usage: " << argv[0] <<
+            " [-o file] [-d dir] [-i seconds] [-T] device:baud[:label] [...]" << std::endl;
+        return 0;
+    }
+
+    std::vector<std::unique_ptr<OutputSink>> sinks;
+    if (out_dir.empty()) {
+        int fd = 1;
+        if (!out_file.empty() &&
+            (fd = open(out_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+            std::cerr << "Couldn't open " << out_file << ": " << strerror(errno) << std::endl;
+            return 1;
+        }
+        sinks.push_back(std::unique_ptr<OutputSink>(new OutputSink(fd)));
+    }
+
+    std::vector<std::unique_ptr<MonitoredPort>> ports;     // Outlives the set using them
+    PortSet set;
+    size_t width = 0;
+
+    for (const std::string &spec : specs)
+    {
+        // device:baud[:label], the device itself may not contain ':'
+        size_t c1 = spec.find(':');
+        size_t c2 = (c1 == std::string::npos) ? std::string::npos : spec.find(':', c1 + 1);
+        if (c1 == std::string::npos) {
+            std::cerr << "Bad device spec: " << spec << std::endl;
+            return 1;
+        }
+
+        std::string rate = spec.substr(c1 + 1, c2 == std::string::npos ? std::string::npos : c2 - c1 - 1);
+        char *rate_end;
+        long baud = strtol(rate.c_str(), &rate_end, 10);
+        if (rate.empty() || *rate_end != 0 || baud <= 0 || baud > INT_MAX) {
+            std::cerr << "Bad device spec: " << spec << std::endl;
+            return 1;
+        }
+
+        std::unique_ptr<MonitoredPort> mp(new MonitoredPort());
+        mp->device = spec.substr(0, c1);
+        mp->label = (c2 != std::string::npos) ? spec.substr(c2 + 1) :
+                    mp->device.substr(mp->device.rfind('/') + 1);
+        width = std::max(width, mp->label.size());
+
+        if (mp->port.open_port(mp->device, static_cast<int>(baud)) < 0) {
+            std::cerr << "Couldn't open " << mp->device << std::endl;
+            return 1;
+        }
+        if (!out_dir.empty()) {
+            std::string path = out_dir + "/" + mp->label + ".log";
+            int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                std::cerr << "Couldn't open " << path << ": " << strerror(errno) << std::endl;
+                return 1;
+            }
+            sinks.push_back(std::unique_ptr<OutputSink>(new OutputSink(fd)));
+        }
+        mp->sink = sinks.back().get();
+        set.add(mp->port);
+        ports.push_back(std::move(mp));
+    }
+
+    // Labels padded to the same width, so the columns line up
+    std::vector<std::string> prefixes;
+    for (auto &mp : ports)
+        prefixes.push_back(mp->label + std::string(width - mp->label.size(), ' ') + " | ");
+
+    std::signal(SIGINT, sig_handler);
+    std::signal(SIGTERM, sig_handler);
+
+    TimeFormatter clock;
+    auto started = SerialClock::now();
+    auto last_report = started;
+    auto last_commit = started;
+
+    // Appends one complete line (partial + [begin, end)) with its prefix
+    auto emit = [&](int index, SerialClock::time_point time, const uint8_t *begin, const uint8_t *end) {
+        MonitoredPort &mp = *ports[index];
+        std::string &out = mp.sink->out();
+        if (timestamps)
+            clock.append(out, time);
+        out += prefixes[index];
+        out += mp.partial;
+        out.append(reinterpret_cast<const char *>(begin), end - begin);
+        mp.partial.clear();
+        mp.lines++;
+    };
+
+    auto on_data = [&](int index, const uint8_t *buf, int len, SerialClock::time_point time) {
+        MonitoredPort &mp = *ports[index];
+        if (len < 0) {
+            if (!mp.partial.empty()) {
+                const uint8_t nl = '\n';
+                emit(index, mp.partial_time, &nl, &nl + 1);
+            }
+            mp.failed = true;
+            std::cerr << mp.label << ": port closed" << std::endl;
+            return;
+        }
+        mp.bytes += len;
+
+        const uint8_t *p = buf;
+        const uint8_t *end = buf + len;
+        while (p < end)
+        {
+            const uint8_t *nl = static_cast<const uint8_t *>(memchr(p, '\n', end - p));
+            if (!nl) {
+                if (mp.partial.empty())
+                    mp.partial_time = time;
+                mp.partial.append(reinterpret_cast<const char *>(p), end - p);
+                if (mp.partial.size() >= MONITOR_MAX_LINE) {
+                    const uint8_t eol = '\n';
+                    emit(index, mp.partial_time, &eol, &eol + 1);
+                }
+                break;
+            }
+            emit(index, mp.partial.empty() ? time : mp.partial_time, p, nl + 1);
+            p = nl + 1;
+        }
+    };
+
+    auto report = [&](bool final) {
+        auto now = SerialClock::now();
+        double secs = std::chrono::duration<double>(now - (final ? started : last_report)).count();
+        unsigned long long dropped = 0;
+        for (auto &s : sinks)
+            dropped += s->dropped_bytes();
+
+        for (auto &mp : ports)
+        {
+            unsigned long long b = final ? mp->bytes : mp->bytes - mp->last_bytes;
+            unsigned long long l = final ? mp->lines : mp->lines - mp->last_lines;
+            fprintf(stderr, "%-*s %9.1f KB/s %8.0f lines/s  total %10.1f KB %10llu lines%s\n",
+                    static_cast<int>(width), mp->label.c_str(), b / secs / 1024, l / secs,
+                    mp->bytes / 1024.0, mp->lines, mp->failed ? "  (closed)" : "");
+            mp->last_bytes = mp->bytes;
+            mp->last_lines = mp->lines;
+        }
+        if (dropped > 0)
+            fprintf(stderr, "output dropped: %llu bytes (writer behind)\n", dropped);
+        last_report = now;
+    };
+
+    while (!quit)
+    {
+        if (set.wait(50, on_data) < 0)
+            break;
+
+        auto now = SerialClock::now();
+        for (auto &s : sinks)
+        {
+            if (s->out().size() >= MONITOR_BATCH || now - last_commit >= std::chrono::milliseconds(50))
+                s->commit();
+        }
+        if (now - last_commit >= std::chrono::milliseconds(50))
+            last_commit = now;
+
+        if (interval > 0 && now - last_report >= std::chrono::duration<double>(interval))
+            report(false);
+
+        bool all_failed = true;
+        for (auto &mp : ports)
+            all_failed = all_failed && mp->failed;
+        if (all_failed)
+            break;
+    }
+
+    // Lines still waiting for their end go out as they are
+    for (size_t i = 0; i < ports.size(); i++)
+    {
+        if (!ports[i]->partial.empty()) {
+            const uint8_t nl = '\n';
+            emit(static_cast<int>(i), ports[i]->partial_time, &nl, &nl + 1);
+        }
+    }
+    for (auto &s : sinks)
+        s->commit();
+
+    report(true);
+    sinks.clear();      // Waits for the writers to finish
+
+    return 0;
+}
@@ -10,12 +10,16 @@
 
 #include "serial_port.h"
 
+#include <chrono>
+#include <thread>
+#include <algorithm>
+
 // *************************************************************
-// MacOS implementation
+// MacOS / Linux implementation
 // Inspired by https://github.com/todbot/arduino-serial
 // *************************************************************
 
-#if defined(__APPLE__)
+#if defined(__APPLE__) || defined(__linux__)
 // Default constructor, need to call open_port() later with
 // appropriate parameters to start connection
 SerialPort::SerialPort()
@@ -24,28 +28,73 @@ SerialPort::SerialPort()
     baudrate = 0;
     fd = -1;
     timeout = 0;
+    write_timeout = -1;
+    flow_control = FlowControl::NONE;
+    dtr_state = LineState::DEFAULT;
+    rts_state = LineState::DEFAULT;
+    auto_reset = true;
+    reconnect_enabled = false;
+    reconnect_timeout = 0;
+    keep_pending = false;
+    last_reconnect = -1;
+    reconnects = 0;
+    wq_stub.next = nullptr;
+    wq_head = &wq_stub;
+    wq_tail = &wq_stub;
+    combining = false;
+    wq_waiters = 0;
+    rx_head = 0;
+    rx_tail = 0;
 }
 
 // Construct class and open connection with passed parameters
 // _portname = name of serial port (eg: "COM2", "dev/tty.usbmodem431", etc)
 // _baud = baud rate (9600, 14400, 57600, 115200, etc)
 // _timeout = timeout in ms for each read attempt (default 0ms)
+// _flow = flow control mode (default none)
 SerialPort::SerialPort(const std::string _portname,
-                       int _baud, int _timeout)
+                       int _baud, int _timeout, FlowControl _flow)
 {
     port_name = _portname;
     baudrate = _baud;
     timeout = _timeout;
+    write_timeout = -1;
+    flow_control = _flow;
+    dtr_state = LineState::DEFAULT;
+    rts_state = LineState::DEFAULT;
+    auto_reset = true;
+    reconnect_enabled = false;
+    reconnect_timeout = 0;
+    keep_pending = false;
+    last_reconnect = -1;
+    reconnects = 0;
+    wq_stub.next = nullptr;
+    wq_head = &wq_stub;
+    wq_tail = &wq_stub;
+    combining = false;
+    wq_waiters = 0;
+    rx_head = 0;
+    rx_tail = 0;
+    fd = -1;
 
     fd = this->open_port();
 }
 
+// Destructor, closes the connection
+SerialPort::~SerialPort()
+{
+    this->sclose();
+}
+
 // Opens connection with internally stored parameters
 int SerialPort::open_port()
 {
     struct termios toptions;
     int pd;
 
+    // Begin by closing any existing connection (if any)
+    this->sclose();
+
     pd = open(port_name.c_str(), O_RDWR | O_NONBLOCK );
     
     if (pd == -1)  {
@@ -55,30 +104,37 @@ int SerialPort::open_port()
 #endif
         return -1;
     }
+
+    // Put DTR / RTS in the requested state straight away, so a board
+    // wired to reset on DTR sees no more edges than open() itself caused.
+    // RTS belongs to the driver when hardware flow control is on.
+    int lines_on = 0;
+    int lines_off = 0;
+    if(dtr_state == LineState::ASSERTED)   lines_on |= TIOCM_DTR;
+    if(dtr_state == LineState::DEASSERTED) lines_off |= TIOCM_DTR;
+    if(flow_control != FlowControl::HARDWARE) {
+        if(rts_state == LineState::ASSERTED)   lines_on |= TIOCM_RTS;
+        if(rts_state == LineState::DEASSERTED) lines_off |= TIOCM_RTS;
+    }
+    if(lines_on)
+        ioctl(pd, TIOCMBIS, &lines_on);
+    if(lines_off)
+        ioctl(pd, TIOCMBIC, &lines_off);
     
     if (tcgetattr(pd, &toptions) < 0) {
 #if PORTCON_DEBUG
         std::cerr << "SerialPort open_port: Couldn't get term attributes" <<
             strerror(errno) << std::endl;
 #endif
+        close(pd);
         return -1;
     }
 
-    speed_t brate = baudrate; 
-    switch(baudrate) {
-        case 4800:   brate=B4800;   break;
-        case 9600:   brate=B9600;   break;
-#ifdef B14400
-        case 14400:  brate=B14400;  break;
-#endif
-        case 19200:  brate=B19200;  break;
-#ifdef B28800
-        case 28800:  brate=B28800;  break;
-#endif
-        case 38400:  brate=B38400;  break;
-        case 57600:  brate=B57600;  break;
-        case 115200: brate=B115200; break;
-    }
+    // Fall back to the plain number for rates without a constant,
+    // which macOS accepts as is
+    speed_t brate = baud_to_speed(baudrate);
+    if(brate == 0)
+        brate = baudrate;
     cfsetispeed(&toptions, brate);
     cfsetospeed(&toptions, brate);
     
@@ -87,16 +143,27 @@ int SerialPort::open_port()
     toptions.c_cflag &= ~CSTOPB;
     toptions.c_cflag &= ~CSIZE;
     toptions.c_cflag |= CS8;
-    // Disable flow control
+    // Hardware flow control only if requested
     toptions.c_cflag &= ~CRTSCTS;
+    if(flow_control == FlowControl::HARDWARE)
+        toptions.c_cflag |= CRTSCTS;
     
-    // Disable hang-up-on-close to avoid reset
-    // toptions.c_cflag &= ~HUPCL;   
+    // Disable hang-up-on-close to avoid reset. With HUPCL set, closing
+    // the port drops DTR and the next open() raises it again, which
+    // resets the board. Note the very first open after plugging the
+    // board in still raises DTR (and resets it) on most drivers.
+    if(!auto_reset)
+        toptions.c_cflag &= ~HUPCL;
     
     // Turn on READ & ignore ctrl lines
     toptions.c_cflag |= CREAD | CLOCAL;
-    // Turn off s/w flow ctrl
+    // Turn off s/w flow ctrl (unless requested) and CR/NL translation
     toptions.c_iflag &= ~(IXON | IXOFF | IXANY  | INLCR | ICRNL); 
+    if(flow_control == FlowControl::SOFTWARE) {
+        toptions.c_iflag |= IXON | IXOFF;
+        toptions.c_cc[VSTART] = 0x11;   // XON  (DC1)
+        toptions.c_cc[VSTOP]  = 0x13;   // XOFF (DC3)
+    }
     
     // Make raw
     toptions.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG);
@@ -106,6 +173,10 @@ int SerialPort::open_port()
     toptions.c_cc[VMIN]  = 0;
     toptions.c_cc[VTIME] = 20;
     //toptions.c_cc[VTIME] = 20;
+
+    // Let the owner adjust anything (framing, etc) before it's applied
+    if(termios_hook)
+        termios_hook(toptions);
     
     tcsetattr(pd, TCSANOW, &toptions);
     if( tcsetattr(pd, TCSAFLUSH, &toptions) < 0) {
@@ -113,6 +184,7 @@ int SerialPort::open_port()
         std::cerr << "SerialPort open_port: Couldn't set term attributes" <<
             strerror(errno) << std::endl;
 #endif
+        close(pd);
         return -1;
     }
     
@@ -123,64 +195,544 @@ int SerialPort::open_port()
 
 // Stores internally the passed parameters and open connection with them
 int SerialPort::open_port(const std::string _portname, 
-                          int _baud, int _timeout)
+                          int _baud, int _timeout, FlowControl _flow)
 {
     port_name = _portname;
     baudrate = _baud;
     timeout = _timeout;
+    flow_control = _flow;
+    rx_head = rx_tail = 0;      // Nothing buffered belongs to the new port
 
     fd = this->open_port();
 
     return fd;
 }
 
+// Sets how long (in ms) writes will wait for the output queue to drain
+// when the peer is holding us off via RTS/CTS or XOFF. -1 waits forever,
+// 0 returns as soon as the queue is full.
+void SerialPort::set_write_timeout(int _timeout)
+{
+    write_timeout = _timeout;
+}
+
+// Sets the flow control used by the next open_port() / reconnect, for
+// ports opened later by open_ports() or through a wrapper
+void SerialPort::set_flow_control(FlowControl _flow)
+{
+    flow_control = _flow;
+}
+
+// Sets the state DTR and RTS are put in on open_port(). Holding DTR
+// asserted (together with set_auto_reset(false)) keeps boards that
+// reset on a DTR edge from rebooting each time the port is opened.
+void SerialPort::set_control_lines(LineState _dtr, LineState _rts)
+{
+    dtr_state = _dtr;
+    rts_state = _rts;
+}
+
+// Enables or disables the board reset on open. When disabled, HUPCL is
+// cleared so DTR stays up when the port is closed, and DTR is held
+// asserted on open (unless set_control_lines() asked otherwise).
+void SerialPort::set_auto_reset(bool enable)
+{
+    auto_reset = enable;
+    if(!enable && dtr_state == LineState::DEFAULT)
+        dtr_state = LineState::ASSERTED;
+}
+
+// Sets a function called with the termios settings in open_port(),
+// right before they are applied, to change what the defaults don't cover
+// (parity, stop bits, etc). It runs again on every reconnect.
+void SerialPort::set_termios_hook(std::function<void(struct termios &)> hook)
+{
+    termios_hook = hook;
+}
+
+// Switches the open port to another baud rate with tcsetattr(), without
+// closing the fd, so DTR doesn't drop and the board isn't reset. Output
+// already queued goes out at the old rate first, input received at the
+// old rate is discarded. Reconnects use the new rate.
+// Returns 0 if OK, -1 on error.
+int SerialPort::set_baud(int _baud)
+{
+    struct termios toptions;
+
+    if(tcgetattr(fd, &toptions) < 0)
+        return -1;
+
+    speed_t brate = baud_to_speed(_baud);
+    if(brate == 0)
+        brate = _baud;          // macOS takes the plain number
+    if(cfsetispeed(&toptions, brate) < 0 || cfsetospeed(&toptions, brate) < 0 ||
+       tcsetattr(fd, TCSADRAIN, &toptions) < 0) {
+#if PORTCON_DEBUG
+        std::cerr << "SerialPort set_baud: Couldn't set " << _baud << " baud " <<
+            strerror(errno) << std::endl;
+#endif
+        return -1;
+    }
+
+    baudrate = _baud;
+    this->sdiscard_input();
+
+    return 0;
+}
+
+// Rates tried by detect_baud() when no candidates are given, most
+// common first, so a typical board is found on the first tries
+static const int detect_bauds[] = {
+    115200, 9600, 57600, 38400, 19200, 230400, 500000, 1000000,
+    2000000, 250000, 460800, 921600, 1500000, 28800, 14400, 4800
+};
+
+// Finds the baud rate the device is sending at, by listening at each
+// candidate rate for up to window_ms (less once 64 bytes are in) and
+// scoring what arrives: the share of characters received without a
+// framing or parity error, times the share of printable text among them
+// if text is set. Listening at the wrong rate produces framing errors
+// and random bytes, the right rate clean text. A window ends early once
+// 16 bytes score below 0.5 or 32 bytes score 0.95 or more. Stops at the
+// first candidate scoring 0.95 or more over at least 32 bytes, otherwise
+// takes the best one above 0.5. The speed is changed in place (see
+// set_baud()), the device must be sending on its own meanwhile.
+// Rates the driver rejects are skipped.
+// Returns the rate detected, and leaves the port at it, -1 on error,
+// -2 if no candidate scored well (the port is back at its old rate).
+int SerialPort::detect_baud(const std::vector<int> &candidates, int window_ms, bool text)
+{
+    struct termios saved;
+    if(tcgetattr(fd, &saved) < 0)
+        return -1;
+
+    // Mark bad characters in the input as \377 \0 <char> (a real 0xFF
+    // arrives as \377 \377)
+    struct termios probe = saved;
+    probe.c_iflag |= INPCK | PARMRK;
+    probe.c_iflag &= ~(IGNPAR | ISTRIP | IGNBRK | BRKINT);
+
+    std::vector<int> rates = candidates;
+    if(rates.empty())
+        rates.assign(detect_bauds, detect_bauds + sizeof(detect_bauds) / sizeof(detect_bauds[0]));
+
+    int best = -2;
+    double best_score = 0.5;
+    uint8_t buf[256];
+
+    for(int baud : rates)
+    {
+        speed_t brate = baud_to_speed(baud);
+        if(brate == 0)
+            brate = baud;
+        if(cfsetispeed(&probe, brate) < 0 || cfsetospeed(&probe, brate) < 0 ||
+           tcsetattr(fd, TCSANOW, &probe) < 0)
+            continue;
+        tcflush(fd, TCIFLUSH);
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(window_ms);
+        int good = 0, bad = 0, printable = 0;
+        int marker = 0;         // Bytes of a \377 sequence seen so far
+        auto score_of = [&]() {
+            double score = static_cast<double>(good) / std::max(good + bad, 1);
+            if(text)
+                score *= good > 0 ? static_cast<double>(printable) / good : 0;
+            return score;
+        };
+
+        // Stop listening as soon as the verdict is clear either way
+        while(good + bad < 64 && !(good + bad >= 32 && score_of() >= 0.95) &&
+              !(good + bad >= 16 && score_of() < 0.5))
+        {
+            int left = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count());
+            if(left <= 0)
+                break;
+
+            struct pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            if(poll(&pfd, 1, left) <= 0)
+                continue;
+
+            int n = static_cast<int>(read(fd, buf, sizeof(buf)));
+            if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                tcsetattr(fd, TCSANOW, &saved);
+                return -1;
+            }
+
+            for(int i = 0; i < n; i++)
+            {
+                uint8_t b = buf[i];
+                if(marker == 1) {
+                    marker = (b == 0) ? 2 : 0;
+                    if(b == 0xFF)
+                        good++;         // Escaped 0xFF
+                    continue;
+                }
+                if(marker == 2) {
+                    marker = 0;
+                    bad++;              // Framing / parity error or break
+                    continue;
+                }
+                if(b == 0xFF) {
+                    marker = 1;
+                    continue;
+                }
+                good++;
+                if((b >= 0x20 && b < 0x7F) || b == '\r' || b == '\n' || b == '\t')
+                    printable++;
+            }
+        }
+
+        if(good + bad < 8)
+            continue;           // Too little to judge
+        double score = score_of();
+
+        if(score > best_score) {
+            best_score = score;
+            best = baud;
+        }
+        if(score >= 0.95 && good + bad >= 32)
+            break;
+    }
+
+    if(best > 0) {
+        speed_t brate = baud_to_speed(best);
+        if(brate == 0)
+            brate = best;
+        cfsetispeed(&saved, brate);
+        cfsetospeed(&saved, brate);
+        baudrate = best;
+    }
+    if(tcsetattr(fd, TCSANOW, &saved) < 0)
+        return -1;
+    this->sdiscard_input();
+
+#if PORTCON_DEBUG
+    if(best < 0)
+        std::cerr << "SerialPort detect_baud: no candidate rate produced clean data" << std::endl;
+#endif
+
+    return best;
+}
+
+// Waits until the device prints a line containing banner (eg "READY"
+// printed at the end of the sketch's setup()), so startup takes as long
+// as the board actually needs instead of a fixed delay.
+// Returns ms waited, -1 on error, -2 if deadline_ms expired.
+int SerialPort::swait_ready(const std::string &banner, int deadline_ms)
+{
+    return this->swait_ready([&banner](const std::string &line) {
+        return line.find(banner) != std::string::npos;
+    }, deadline_ms);
+}
+
+// Waits until the device sends a line for which ready() returns true
+// (eg a first valid data frame). Lines up to and including that one are
+// consumed, anything after it is left for the next read.
+// Returns ms waited, -1 on error, -2 if deadline_ms expired.
+int SerialPort::swait_ready(std::function<bool(const std::string &)> ready,
+                            int deadline_ms)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::string line;
+
+    while(1)
+    {
+        int left = deadline_ms - static_cast<int>(std::chrono::duration_cast<
+            std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+        if(left <= 0)
+            return -2;          // Timed out
+
+        // Take the input a chunk at a time, whatever follows the ready
+        // line stays in rx_buf for the next read
+        if(rx_head < rx_tail) {
+            uint8_t b = rx_buf[rx_head++];
+            line += static_cast<char>(b);
+            if(b == '\n') {
+                if(ready(line))
+                    return deadline_ms - left;
+                line.clear();
+            }
+            continue;
+        }
+
+        int n = static_cast<int>(read(fd, rx_buf, sizeof(rx_buf)));
+
+        if(n > 0) {
+            rx_time = SerialClock::now();
+            rx_head = 0;
+            rx_tail = n;
+            continue;
+        }
+        if(n == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            return -1;          // Couldn't read
+
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        poll(&pfd, 1, left);
+    }
+}
+
 // Write single byte
 int SerialPort::swrite(uint8_t byte)
 {
-    int n = static_cast<int>(write(fd, &byte, 1));
-    
-    if(n != 1)
-        return -1;
-    
-    return n;       // Return number of bytes written
+    return this->swrite(&byte, 1);
 }
 
 // Write full string
 int SerialPort::swrite(const std::string str)
 {
-    int len = static_cast<int>(str.size());
-    int n = static_cast<int>(write(fd, str.c_str(), len));
-    
-    if(n != len) {
+    return this->swrite(reinterpret_cast<const uint8_t *>(str.data()),
+                        static_cast<int>(str.size()));
+} 
+
+// Write len bytes from buf. Safe to call from several threads at once:
+// the request is pushed on the write queue and whichever writer gets the
+// combining flag writes out everything queued, in order, while the
+// others sleep until their own request is done or the flag is free.
+// Returns number of bytes written, -1 on error, -2 if write_timeout expired.
+int SerialPort::swrite(const uint8_t *buf, int len)
+{
+    WriteRequest req;
+    req.buf = buf;
+    req.len = len;
+    req.result = 0;
+    req.done = false;
+    req.next = nullptr;
+
+    WriteRequest *prev = wq_head.exchange(&req);
+    prev->next = &req;
+
+    while(!req.done)
+    {
+        if(!combining.exchange(true)) {
+            WriteRequest *r;
+            while(!req.done && (r = this->wq_pop()) != nullptr)
+            {
+                r->result = this->write_now(r->buf, r->len);
+                r->done = true;     // r may be gone after this, don't touch it
+            }
+            combining = false;
+
+            // Wake whoever queued meanwhile: done, or next to combine.
+            // Taking the lock orders this with a waiter's last check.
+            if(wq_waiters > 0) {
+                { std::lock_guard<std::mutex> guard(wq_lock); }
+                wq_wake.notify_all();
+            }
+        }
+        else {
+            wq_waiters++;
+            std::unique_lock<std::mutex> guard(wq_lock);
+            wq_wake.wait(guard, [&] { return req.done || !combining; });
+            wq_waiters--;
+        }
+    }
+
+    return req.result;
+}
+
+// Pops the oldest write request, or returns nullptr if the queue is
+// empty or a writer is halfway through pushing (it will then take the
+// combining flag itself). Only called by the combining writer.
+SerialPort::WriteRequest *SerialPort::wq_pop()
+{
+    WriteRequest *tail = wq_tail;
+    WriteRequest *next = tail->next;
+
+    if(tail == &wq_stub) {
+        if(next == nullptr)
+            return nullptr;
+        wq_tail = next;
+        tail = next;
+        next = next->next;
+    }
+    if(next != nullptr) {
+        wq_tail = next;
+        return tail;
+    }
+    if(tail != wq_head)
+        return nullptr;         // Push in progress
+
+    // tail is the last request, put the stub behind it so it can go
+    wq_stub.next = nullptr;
+    WriteRequest *prev = wq_head.exchange(&wq_stub);
+    prev->next = &wq_stub;
+
+    next = tail->next;
+    if(next != nullptr) {
+        wq_tail = next;
+        return tail;
+    }
+
+    return nullptr;
+}
+
+// Writes len bytes from buf right away. The fd is non-blocking, so once
+// the kernel output queue fills up (peer deasserted CTS or sent XOFF, or
+// simply a slow link) write() returns EAGAIN. Instead of dropping the rest
+// we poll for POLLOUT and carry on, so no bytes are lost to overruns.
+// If the device goes away mid-write and reconnect is enabled, the port is
+// reopened. The unsent part is then either held back and sent after the
+// reconnect (keep_pending_writes) or dropped, returning -1.
+int SerialPort::write_now(const uint8_t *buf, int len)
+{
+    int generation = reconnects;
+
+    if(pending_tx.empty()) {
+        int written = 0;
+        int res = this->write_all(buf, len, written);
+
+        if(res != -1 || !reconnect_enabled || !is_disconnect(errno))
+            return (res < 0) ? res : written;
+        if(!keep_pending) {
+            this->recover(errno, generation);
+            return -1;
+        }
+        pending_tx.insert(pending_tx.end(), buf + written, buf + len);
+    }
+    else
+        pending_tx.insert(pending_tx.end(), buf, buf + len);
+
+    this->flush_pending();
+    return len;                 // Written now or queued for later
+}
+
+// Sends what was held back while the device was away, reconnecting first
+// if needed. Whatever can't go out stays queued for the next write.
+void SerialPort::flush_pending()
+{
+    int generation = reconnects;
+    int written = 0;
+    int res = this->write_all(pending_tx.data(), static_cast<int>(pending_tx.size()), written);
+    pending_tx.erase(pending_tx.begin(), pending_tx.begin() + written);
+
+    if(res == -1 && this->recover(errno, generation) == -2) {
+        this->write_all(pending_tx.data(), static_cast<int>(pending_tx.size()), written);
+        pending_tx.erase(pending_tx.begin(), pending_tx.begin() + written);
+    }
+}
+
+// Writes len bytes from buf, waiting on backpressure, and reports how far
+// it got in written. Returns 0 once all is written, -1 on error (errno
+// says why), -2 if write_timeout expired.
+int SerialPort::write_all(const uint8_t *buf, int len, int &written)
+{
+    written = 0;
+
+    while(written < len)
+    {
+        int n = static_cast<int>(write(fd, buf + written, len - written));
+
+        if(n > 0) {
+            written += n;
+            continue;
+        }
+        if(n == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            int err = errno;    // The caller checks it, logging may change it
 #if PORTCON_DEBUG
-        std::cerr << "SerialPort swrite: couldn't write whole string" <<
-            strerror(errno) << std::endl;
+            std::cerr << "SerialPort swrite: couldn't write buffer " <<
+                strerror(err) << std::endl;
 #endif
-        return -1;
+            errno = err;
+            return -1;
+        }
+
+        // Output queue full, wait until the peer lets us send again
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+
+        int pr = poll(&pfd, 1, write_timeout);
+        if(pr == 0) {
+#if PORTCON_DEBUG
+            std::cerr << "SerialPort swrite: timed out after " << written <<
+                " of " << len << " bytes" << std::endl;
+#endif
+            return -2;          // Timed out
+        }
+        if(pr == -1 && errno != EINTR)
+            return -1;
+        if(pr > 0 && (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))) {
+            errno = EIO;        // Device went away while we waited
+            return -1;
+        }
     }
 
-    return n;       // Return number of bytes written
-} 
+    return 0;
+}
 
 // Read single byte (note argument passed byref)
 int SerialPort::sread(uint8_t &byte)
 {
-    int n = static_cast<int>(read(fd, &byte, 1));
-    
-    if(n == -1) 
-        return -1;              // Couldn't read
-    if(n == 0) {
-        for(int tout = timeout; tout > 0; tout--)
-        {
-            usleep(1 * 1000);   // Wait 1ms before trying again
-            n = static_cast<int>(read(fd, &byte, 1));
-            if(n > 0) 
+    return this->sread(&byte, 1);
+}
+
+// Read whatever is already available, up to max_size bytes, into buf.
+// If nothing is pending, waits up to timeout ms for data to show up.
+// last_rx_time() then tells when the bytes came out of read().
+// Returns number of bytes read, -1 on error, -2 if timed out.
+int SerialPort::sread(uint8_t *buf, int max_size)
+{
+    if(rx_head < rx_tail) {
+        // Left over from a line read, hand that out first
+        int count = std::min(max_size, rx_tail - rx_head);
+        memcpy(buf, rx_buf + rx_head, count);
+        rx_head += count;
+        rx_stamp = rx_time;
+        return count;
+    }
+
+    int n = this->read_chunk(buf, max_size);
+    if(n > 0)
+        rx_stamp = rx_time;
+
+    return n;
+}
+
+// Reads from the driver into buf, waiting up to timeout ms for data,
+// and stamps rx_time as soon as read() returns data.
+// Returns number of bytes read, -1 on error, -2 if timed out.
+int SerialPort::read_chunk(uint8_t *buf, int max_size)
+{
+    int generation = reconnects;
+    int n = static_cast<int>(read(fd, buf, max_size));
+
+    if(n > 0) {
+        rx_time = SerialClock::now();
+        return n;               // Return number of bytes read
+    }
+    if(n == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        return this->recover(errno, generation);    // Couldn't read, reconnect if enabled
+
+    // Nothing pending (the fd is non-blocking), wait for input
+    if(timeout > 0) {
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        if(poll(&pfd, 1, timeout) > 0) {
+            if(!(pfd.revents & POLLIN) && (pfd.revents & (POLLHUP | POLLERR)))
+                return this->recover(EIO, generation);  // Hung up, device went away
+
+            n = static_cast<int>(read(fd, buf, max_size));
+            if(n > 0) {
+                rx_time = SerialClock::now();
                 return n;
+            }
+            if(n == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+                return this->recover(errno, generation);
         }
-        return -2;              // Timed out
     }
 
-    return n;                   // Return number of bytes read
+    return -2;                  // Timed out
 }
 
 // Read number of bytes defined in size argument (note byref input)
@@ -204,17 +756,14 @@ int SerialPort::sread(std::vector<uint8_t> &vec_bytes, int size)
 
 // Read full line (ending defined as the '\n' character, or
 // max_size bytes, whatever happens first). Stores the read
-// result in the string argument passed byref.
+// result in the string argument passed byref. last_rx_time() then
+// tells when the line's first byte came out of read().
 int SerialPort::sreadline(std::string &read_str, int max_size)
 {
     std::vector<uint8_t> vec_str;
     int n = this->sread_until(vec_str, '\n', max_size);
 
-    for(uint8_t byte : vec_str)
-    {
-        // Convert to char object so will print as ASCII
-        read_str += static_cast<char>(byte);
-    }
+    read_str.append(vec_str.begin(), vec_str.end());
 
     return n;
 }
@@ -222,22 +771,38 @@ int SerialPort::sreadline(std::string &read_str, int max_size)
 // Reads until either the character defined in until is read or
 // max_size bytes is reached. Whichever happens first. And stores
 // the read result in the vector of byte objects passed byref.
+// Input is taken from the driver a chunk at a time, bytes past the
+// end stay buffered for the next read.
 int SerialPort::sread_until(std::vector<uint8_t> &vec_bytes, 
                             char until, int max_size)
 {
-    uint8_t b;
-    int i = 0;
+    int limit = std::max(1, max_size - 1);
+    int count = 0;
 
-    do
+    while(1)
     {
-        int n = this->sread(b);
-        if(n == 1) {
-            vec_bytes.push_back(b);
+        if(rx_head == rx_tail) {
+            int n = this->read_chunk(rx_buf, sizeof(rx_buf));
+            if(n < 0)
+                return n;      // Timed out or read error
+            rx_head = 0;
+            rx_tail = n;
         }
-        else 
-            return n;      // Timed out or read error
-        i++;
-    } while (b != until && i + 1 < max_size);
+        if(count == 0)
+            rx_stamp = rx_time;     // Chunk holding the first byte
+
+        int avail = std::min(rx_tail - rx_head, limit - count);
+        const uint8_t *start = rx_buf + rx_head;
+        const uint8_t *end = static_cast<const uint8_t *>(memchr(start, static_cast<uint8_t>(until), avail));
+        int take = end ? static_cast<int>(end - start) + 1 : avail;
+
+        vec_bytes.insert(vec_bytes.end(), start, start + take);
+        rx_head += take;
+        count += take;
+
+        if(end || count >= limit)
+            break;
+    }
     
     return static_cast<int>(vec_bytes.size());
 }
@@ -245,14 +810,207 @@ int SerialPort::sread_until(std::vector<uint8_t> &vec_bytes,
 // Close serial connection
 int SerialPort::sclose()
 {
-    return close(fd);
+    if(fd == -1)
+        return 0;           // Nothing to close
+
+    int res = close(fd);
+    fd = -1;
+
+    return res;
+}
+
+// Enables or disables automatic reconnect. When enabled, a read or write
+// failing because the device went away (EIO, ENXIO, POLLHUP, ...) closes
+// the port and reopens it with the same settings, waiting up to
+// timeout_ms for the device to come back. With keep_pending_writes, data
+// that couldn't be written meanwhile is held and sent after reconnecting.
+void SerialPort::set_reconnect(bool enable, int timeout_ms,
+                               bool keep_pending_writes)
+{
+    reconnect_enabled = enable;
+    reconnect_timeout = timeout_ms;
+    keep_pending = keep_pending_writes;
 }
 
-// Flush serial connection
-int SerialPort::sflush()
+// Sets a function returning the device's current path, called on each
+// reconnect attempt. Use it to follow a board by USB serial number when
+// it comes back on another tty (see Interfaces::FindBySerialNumber()).
+// On Linux, opening a /dev/serial/by-id/ path does the same without it.
+void SerialPort::set_device_locator(std::function<std::string()> locate)
 {
-    sleep(2); // Required to make flush work, for some reason
-    return tcflush(fd, TCIOFLUSH);
+    locator = locate;
+}
+
+// Closes the port and reopens the same device. open_port() rebuilds and
+// reapplies the termios settings from the stored configuration (baud,
+// flow control, control lines). Polls every 5ms, so the port comes back
+// within a few ms of the device node reappearing. Writes held back while
+// disconnected go out with the next write.
+// Returns ms taken to reconnect, -2 if reconnect_timeout expired.
+int SerialPort::reconnect()
+{
+    std::lock_guard<std::mutex> lock(reconnect_lock);
+
+    return this->reopen();
+}
+
+// Does the actual reconnect, with reconnect_lock held
+int SerialPort::reopen()
+{
+    auto start = std::chrono::steady_clock::now();
+    int elapsed = 0;
+
+    this->sclose();
+
+    while(1)
+    {
+        std::string path = locator ? locator() : port_name;
+
+        // Check first, so we don't log a failed open every 5ms
+        if(!path.empty() && access(path.c_str(), F_OK) == 0) {
+            port_name = path;
+            if(this->open_port() >= 0)
+                break;
+        }
+
+        elapsed = static_cast<int>(std::chrono::duration_cast<
+            std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+        if(elapsed >= reconnect_timeout) {
+#if PORTCON_DEBUG
+            std::cerr << "SerialPort reconnect: device didn't come back after " <<
+                elapsed << " ms" << std::endl;
+#endif
+            return -2;          // Timed out
+        }
+        usleep(5 * 1000);       // Wait 5ms before trying again
+    }
+
+    last_reconnect = static_cast<int>(std::chrono::duration_cast<
+        std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+    reconnects++;
+
+    return last_reconnect;
+}
+
+// Returns true if err means the device is gone, not just busy
+bool SerialPort::is_disconnect(int err)
+{
+    return err == EIO || err == ENXIO || err == ENODEV || err == EBADF;
+}
+
+// Called when I/O fails. Reconnects if enabled and the device went away,
+// unless the other side (reader or writer) already did so since the
+// failed call started, ie reconnects moved past generation.
+// Returns -2 once reconnected (no data yet, same as a timeout), -1 if
+// the error stands.
+int SerialPort::recover(int err, int generation)
+{
+    if(!reconnect_enabled || !is_disconnect(err))
+        return -1;
+
+    std::lock_guard<std::mutex> lock(reconnect_lock);
+    if(reconnects != generation)
+        return -2;
+
+    return (this->reopen() >= 0) ? -2 : -1;
+}
+
+// Flush serial connection: transmit whatever is still queued for output,
+// then discard input until nothing new arrives for quiet_ms.
+//
+// A single tcflush() right after opening or writing is racy. Bytes the
+// device sent before the flush can still be in the USB adapter (FTDI
+// latency timer, CDC-ACM frame) and only reach the kernel queue
+// afterwards. TCOFLUSH also throws away our own output that hasn't gone
+// out yet. The old fixed 2s sleep just waited both of those out.
+// Discarding until the line stays quiet deals with the in-flight input,
+// and draining first keeps the output. Gives up waiting for quiet after
+// 10 * quiet_ms, for devices that never stop talking.
+// Returns 0 on success, -1 on error.
+int SerialPort::sflush(int quiet_ms)
+{
+    if(this->sdrain() == -1)
+        return -1;
+
+    rx_head = rx_tail = 0;
+
+    // poll() returns as soon as a byte arrives, so bound the total time
+    // rather than the number of rounds
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(10 * quiet_ms);
+
+    while(std::chrono::steady_clock::now() < deadline)
+    {
+        if(tcflush(fd, TCIFLUSH) < 0)
+            return -1;
+
+        struct pollfd pfd;
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        if(poll(&pfd, 1, quiet_ms) == 0)
+            return 0;           // Line quiet, nothing left in flight
+    }
+
+    return tcflush(fd, TCIFLUSH);
+}
+
+// Wait until all queued output has been transmitted. tcdrain() has no
+// timeout of its own, so watch the output queue shrink first and only
+// call it once the queue is empty (it then just waits for the last
+// character to leave the UART).
+// Returns 0 on success, -1 on error, -2 if timeout_ms expired.
+int SerialPort::sdrain(int timeout_ms)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    while(1)
+    {
+        int pending = this->soutput_pending();
+        if(pending == -1)
+            return -1;
+        if(pending == 0)
+            break;
+        if(std::chrono::steady_clock::now() >= deadline)
+            return -2;          // Timed out
+        usleep(1 * 1000);       // Wait 1ms before checking again
+    }
+
+    return tcdrain(fd);
+}
+
+// Discard bytes received but not read yet
+int SerialPort::sdiscard_input()
+{
+    rx_head = rx_tail = 0;
+    return tcflush(fd, TCIFLUSH);
+}
+
+// Discard bytes written but not transmitted yet
+int SerialPort::sdiscard_output()
+{
+    return tcflush(fd, TCOFLUSH);
+}
+
+// Returns number of bytes waiting in the input queue (including any
+// read ahead by a line read), -1 on error
+int SerialPort::sinput_pending()
+{
+    int count = 0;
+    if(ioctl(fd, FIONREAD, &count) < 0)
+        return -1;
+
+    return count + rx_tail - rx_head;
+}
+
+// Returns number of bytes waiting in the output queue, -1 on error
+int SerialPort::soutput_pending()
+{
+    int count = 0;
+    if(ioctl(fd, TIOCOUTQ, &count) < 0)
+        return -1;
+
+    return count;
 }
 #endif
 
@@ -272,13 +1030,18 @@ SerialPortWin32::SerialPortWin32()
 	port_name = _S("");
 	baud_rate = 0;
 	timeout = 0;
+	flow_control = FlowControl::NONE;
+	dtr_state = LineState::DEFAULT;
+	rts_state = LineState::DEFAULT;
 }
 
 // Construct class and open connection with passed parameters
 // _portname = name of serial port (eg: "COM2")
 // _baud = baud rate (9600, 14400, 57600, 115200, etc)
 // _timeout = timeout in ms for each read attempt (default 0ms)
-SerialPortWin32::SerialPortWin32(const PSTRING _pname, int _baud, int _timeout)
+// _flow = flow control mode (default none)
+SerialPortWin32::SerialPortWin32(const PSTRING _pname, int _baud, int _timeout,
+	FlowControl _flow)
 {
 	com = NULL;
 	dcb = { 0 };
@@ -286,6 +1049,9 @@ SerialPortWin32::SerialPortWin32(const PSTRING _pname, int _baud, int _timeout)
 	port_name = _pname;
 	baud_rate = _baud;
 	timeout = _timeout;
+	flow_control = _flow;
+	dtr_state = LineState::DEFAULT;
+	rts_state = LineState::DEFAULT;
 
 	this->open_port();
 }
@@ -326,6 +1092,23 @@ int SerialPortWin32::open_port()
 	dcb.ByteSize = 8;
 	dcb.StopBits = ONESTOPBIT;
 	dcb.Parity = NOPARITY;
+
+	// Flow control, RTS/CTS handshake or XON/XOFF if requested
+	dcb.fOutxCtsFlow = (flow_control == FlowControl::HARDWARE);
+	dcb.fRtsControl = (flow_control == FlowControl::HARDWARE) ?
+		RTS_CONTROL_HANDSHAKE : RTS_CONTROL_ENABLE;
+	dcb.fOutX = (flow_control == FlowControl::SOFTWARE);
+	dcb.fInX = (flow_control == FlowControl::SOFTWARE);
+	dcb.XonChar = 0x11;
+	dcb.XoffChar = 0x13;
+
+	// DTR / RTS state, if requested
+	if (dtr_state != LineState::DEFAULT)
+		dcb.fDtrControl = (dtr_state == LineState::ASSERTED) ?
+			DTR_CONTROL_ENABLE : DTR_CONTROL_DISABLE;
+	if (rts_state != LineState::DEFAULT && flow_control != FlowControl::HARDWARE)
+		dcb.fRtsControl = (rts_state == LineState::ASSERTED) ?
+			RTS_CONTROL_ENABLE : RTS_CONTROL_DISABLE;
  
     if(!SetCommState(com, &dcb)) {
         this->sclose();
@@ -353,17 +1136,93 @@ int SerialPortWin32::open_port()
 }
 
 // Stores internally the passed parameters and open connection with them
-int SerialPortWin32::open_port(const PSTRING _portname, int _baud, int _timeout)
+int SerialPortWin32::open_port(const PSTRING _portname, int _baud, int _timeout,
+	FlowControl _flow)
 {
 	port_name = _portname;
 	baud_rate = _baud;
 	timeout = _timeout;
+	flow_control = _flow;
 
 	int ret = this->open_port();
 
 	return ret;
 }
 
+// Sets the flow control used by the next open_port()
+void SerialPortWin32::set_flow_control(FlowControl _flow)
+{
+	flow_control = _flow;
+}
+
+// Sets the state DTR and RTS are put in on open_port()
+void SerialPortWin32::set_control_lines(LineState _dtr, LineState _rts)
+{
+	dtr_state = _dtr;
+	rts_state = _rts;
+}
+
+// Switches the open port to another baud rate without closing it.
+// Returns 0 if OK, -1 on error.
+int SerialPortWin32::set_baud(int _baud)
+{
+	dcb.DCBlength = sizeof(dcb);
+	if (!com || !GetCommState(com, &dcb))
+		return -1;
+
+	dcb.BaudRate = _baud;
+	if (!SetCommState(com, &dcb)) {
+#if PORTCON_DEBUG
+		std::cerr << "SerialPortWin32 set_baud: Couldn't set " << _baud << " baud" << std::endl;
+#endif
+		return -1;
+	}
+	baud_rate = _baud;
+	PurgeComm(com, PURGE_RXCLEAR);
+
+	return 0;
+}
+
+// Waits until the device prints a line containing banner, instead of
+// a fixed delay. Returns ms waited, -1 on error, -2 if deadline_ms expired.
+int SerialPortWin32::swait_ready(const std::string &banner, int deadline_ms)
+{
+	return this->swait_ready([&banner](const std::string &line) {
+		return line.find(banner) != std::string::npos;
+	}, deadline_ms);
+}
+
+// Waits until the device sends a line for which ready() returns true.
+// Returns ms waited, -1 on error, -2 if deadline_ms expired.
+int SerialPortWin32::swait_ready(std::function<bool(const std::string &)> ready,
+	int deadline_ms)
+{
+	auto start = std::chrono::steady_clock::now();
+	std::string line;
+
+	while (1)
+	{
+		int waited = static_cast<int>(std::chrono::duration_cast<
+			std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+		if (waited >= deadline_ms)
+			return -2;		// Timed out
+
+		uint8_t b;
+		int n = this->sread(b);
+		if (n == -1)
+			return -1;		// Couldn't read
+		if (n != 1)
+			continue;		// Read timeout, check deadline again
+
+		line += static_cast<char>(b);
+		if (b == '\n') {
+			if (ready(line))
+				return waited;
+			line.clear();
+		}
+	}
+}
+
 // Write single byte
 int SerialPortWin32::swrite(uint8_t byte)
 {
@@ -381,18 +1240,35 @@ int SerialPortWin32::swrite(uint8_t byte)
 // Write full string
 int SerialPortWin32::swrite(const std::string str)
 {
-	DWORD len = str.size();
-	DWORD nBytesWritten;
-	WriteFile(com, str.c_str(), len, &nBytesWritten, NULL); 
+	return this->swrite(reinterpret_cast<const uint8_t *>(str.data()),
+	                    static_cast<int>(str.size()));
+}
 
-	if (nBytesWritten != len) {
+// Write len bytes from buf. WriteFile blocks while the peer holds us off
+// (CTS low or XOFF), up to the write timeouts set in open_port(), so keep
+// going until everything is out or a call makes no progress.
+// Returns number of bytes written, -1 on error, -2 if timed out.
+int SerialPortWin32::swrite(const uint8_t *buf, int len)
+{
+	if (!com)
+		return -1;
+
+	int total = 0;
+	while (total < len)
+	{
+		DWORD nBytesWritten = 0;
+		if (!WriteFile(com, buf + total, len - total, &nBytesWritten, NULL))
+			return -1;
+		if (nBytesWritten == 0) {
 #if PORTCON_DEBUG
-		std::cout << "SerialPort swrite: couldn't write whole string" << std::endl;
+			std::cout << "SerialPort swrite: timed out" << std::endl;
 #endif
-		return -1;
+			return -2;		// Timed out
+		}
+		total += nBytesWritten;
 	}
 
-	return nBytesWritten;       // Return number of bytes written
+	return total;       // Return number of bytes written
 }
 
 // Read single byte (note argument passed byref)
@@ -402,6 +1278,8 @@ int SerialPortWin32::sread(uint8_t &byte)
 		DWORD nBytesRead;
 
 		ReadFile(com, &byte, sizeof(byte), &nBytesRead, NULL);
+		if (nBytesRead > 0)
+			rx_stamp = SerialClock::now();
 		
 		return static_cast<int>(nBytesRead);
 	}
@@ -409,6 +1287,24 @@ int SerialPortWin32::sread(uint8_t &byte)
 	return -1;		// Couldn't read any bytes
 }
 
+// Read up to max_size bytes into buf, returning as soon as the read
+// timeouts set in open_port() expire.
+// Returns number of bytes read, -1 on error, -2 if timed out.
+int SerialPortWin32::sread(uint8_t *buf, int max_size)
+{
+	if (!com)
+		return -1;		// Couldn't read any bytes
+
+	DWORD nBytesRead = 0;
+	if (!ReadFile(com, buf, max_size, &nBytesRead, NULL))
+		return -1;
+	if (nBytesRead == 0)
+		return -2;		// Timed out
+	rx_stamp = SerialClock::now();
+
+	return static_cast<int>(nBytesRead);
+}
+
 // Read number of bytes defined in size argument (note byref input)
 int SerialPortWin32::sread(std::vector<uint8_t> &vec_bytes, int size)
 {
@@ -454,17 +1350,21 @@ int SerialPortWin32::sread_until(std::vector<uint8_t> &vec_bytes,
 {
 	uint8_t b;
 	int i = 0;
+	SerialClock::time_point first;
 
 	do
 	{
 		int n = this->sread(b);
 		if (n == 1) {
 			vec_bytes.push_back(b);
+			if (i == 0)
+				first = rx_stamp;
 		}
 		else
 			return n;      // Timed out or read error
 		i++;
 	} while (b != until && i + 1 < max_size);
+	rx_stamp = first;		// Line is stamped with its first byte
 
 	return static_cast<int>(vec_bytes.size());
 }
@@ -479,4 +1379,117 @@ int SerialPortWin32::sclose()
 	}
 	return 0;			// Couldn't close port
 }
-#endif
\ No newline at end of file
+
+// Flush serial connection: transmit whatever is still queued for output,
+// then discard input until nothing new arrives for quiet_ms (gives up
+// waiting for quiet after 10 * quiet_ms).
+// Returns 0 on success, -1 on error.
+int SerialPortWin32::sflush(int quiet_ms)
+{
+	if (this->sdrain() == -1)
+		return -1;
+
+	// Sleep() can oversleep by a whole scheduler tick, so bound the total
+	// time rather than the number of rounds
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(10 * quiet_ms);
+
+	while (std::chrono::steady_clock::now() < deadline)
+	{
+		if (this->sdiscard_input() < 0)
+			return -1;
+		Sleep(quiet_ms);
+		if (this->sinput_pending() == 0)
+			return 0;		// Line quiet, nothing left in flight
+	}
+
+	return this->sdiscard_input();
+}
+
+// Wait until all queued output has been transmitted.
+// Returns 0 on success, -1 on error, -2 if timeout_ms expired.
+int SerialPortWin32::sdrain(int timeout_ms)
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+	while (1)
+	{
+		int pending = this->soutput_pending();
+		if (pending == -1)
+			return -1;
+		if (pending == 0)
+			return 0;
+		if (std::chrono::steady_clock::now() >= deadline)
+			return -2;		// Timed out
+		Sleep(1);		// At least 1ms, often a whole tick
+	}
+}
+
+// Discard bytes received but not read yet
+int SerialPortWin32::sdiscard_input()
+{
+	if (com && PurgeComm(com, PURGE_RXCLEAR))
+		return 0;
+	return -1;
+}
+
+// Discard bytes written but not transmitted yet
+int SerialPortWin32::sdiscard_output()
+{
+	if (com && PurgeComm(com, PURGE_TXCLEAR))
+		return 0;
+	return -1;
+}
+
+// Returns number of bytes waiting in the input queue, -1 on error
+int SerialPortWin32::sinput_pending()
+{
+	COMSTAT status;
+	DWORD errors;
+	if (!com || !ClearCommError(com, &errors, &status))
+		return -1;
+
+	return static_cast<int>(status.cbInQue);
+}
+
+// Returns number of bytes waiting in the output queue, -1 on error
+int SerialPortWin32::soutput_pending()
+{
+	COMSTAT status;
+	DWORD errors;
+	if (!com || !ClearCommError(com, &errors, &status))
+		return -1;
+
+	return static_cast<int>(status.cbOutQue);
+}
+#endif
+// *************************************************************
+// Common helpers
+// *************************************************************
+
+#if defined(SERIAL_PORT)
+// Opens ports[i] on names[i] in parallel, one thread per port, and
+// optionally waits for each device's readiness banner
+std::vector<int> open_ports(std::vector<SERIAL_PORT *> &ports,
+                            const std::vector<PSTRING> &names,
+                            int baud, int timeout,
+                            const std::string &banner, int deadline_ms)
+{
+    std::vector<int> results(ports.size(), -1);
+    std::vector<std::thread> threads;
+
+    for(size_t i = 0; i < ports.size() && i < names.size(); i++)
+    {
+        threads.push_back(std::thread([&, i]() {
+            // Keep whatever flow control the port was set up with
+            if(ports[i]->open_port(names[i], baud, timeout, ports[i]->get_flow_control()) < 0)
+                return;         // Couldn't open, leave -1
+            results[i] = banner.empty() ? 0 :
+                ports[i]->swait_ready(banner, deadline_ms);
+        }));
+    }
+    for(std::thread &t : threads)
+        t.join();
+
+    return results;
+}
+#endif
@@ -13,11 +13,14 @@
 
 #pragma once
 
-#if defined(__APPLE__)
+#if defined(__APPLE__) || defined(__linux__)
     #include <unistd.h>   // UNIX standard function definitions
     #include <fcntl.h>    // File control definitions
     #include <errno.h>    // Error number definitions
+    #include <string.h>   // strerror()
     #include <termios.h>  // POSIX terminal control definitions
+    #include <poll.h>     // poll() used to wait on output backpressure
+    #include <sys/ioctl.h> // FIONREAD / TIOCOUTQ queue sizes
 #elif defined(_WIN32)
     #include <windows.h>
 #endif
@@ -25,8 +28,13 @@
 #include <string>     
 #include <iostream>
 #include <vector>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
-#if defined(__APPLE__)
+#if defined(__APPLE__) || defined(__linux__)
     #define SERIAL_PORT SerialPort
 #elif defined(_WIN32)
     #define SERIAL_PORT SerialPortWin32
@@ -46,31 +54,187 @@
 
 #define PORTCON_DEBUG 1    // Set to 1 to print error messages to console output
 
-#if defined(__APPLE__)
+#define SERIAL_RX_CHUNK 256 // Bytes taken from the driver per read() when reading lines
+
+// Monotonic clock used to timestamp received data
+typedef std::chrono::steady_clock SerialClock;
+
+// Flow control modes, selected when opening the port
+enum class FlowControl
+{
+    NONE,           // No flow control (default, what most Arduino boards expect)
+    HARDWARE,       // RTS/CTS handshake lines
+    SOFTWARE        // XON/XOFF characters sent in-band by the peer
+};
+
+// State to put a modem control line (DTR, RTS) in when opening the port
+enum class LineState
+{
+    DEFAULT,        // Leave it as the driver sets it on open
+    ASSERTED,
+    DEASSERTED
+};
+
+#if defined(__APPLE__) || defined(__linux__)
+// Maps a numeric baud rate to its termios speed constant, or 0 if the
+// platform has none. constexpr so compile time configurations (see
+// serial_port_static.h) can check their rate at build time.
+constexpr speed_t baud_to_speed(int baud)
+{
+    return baud == 4800   ? B4800   :
+           baud == 9600   ? B9600   :
+#ifdef B14400
+           baud == 14400  ? B14400  :
+#endif
+           baud == 19200  ? B19200  :
+#ifdef B28800
+           baud == 28800  ? B28800  :
+#endif
+           baud == 38400  ? B38400  :
+           baud == 57600  ? B57600  :
+           baud == 115200 ? B115200 :
+#ifdef B230400
+           baud == 230400 ? B230400 :
+#endif
+#ifdef B460800
+           baud == 460800 ? B460800 :
+#endif
+#ifdef B500000
+           baud == 500000 ? B500000 :
+#endif
+#ifdef B921600
+           baud == 921600 ? B921600 :
+#endif
+#ifdef B1000000
+           baud == 1000000 ? B1000000 :
+#endif
+#ifdef B1500000
+           baud == 1500000 ? B1500000 :
+#endif
+#ifdef B2000000
+           baud == 2000000 ? B2000000 :
+#endif
+           0;
+}
+
+// Concurrency: one thread may read (sread*, sreadline, sread_until,
+// swait_ready) while any number of threads write (swrite*), without a
+// shared lock. Writers push their request on a lock-free queue and one of
+// them at a time writes out the queued requests in order, so each write
+// goes out whole and is never interleaved with another. Reads touch only
+// the reader side. Everything else (open, close, set_*, flush/drain) is
+// not synchronized and must not overlap with I/O. Reconnects may be
+// started from either side and are serialized internally.
 class SerialPort
 {
 public:
     SerialPort();
-    SerialPort(const std::string _portname, int _baud, int _timeout = 0);
+    SerialPort(const std::string _portname, int _baud, int _timeout = 0,
+               FlowControl _flow = FlowControl::NONE);
+    ~SerialPort();
+
+    SerialPort(const SerialPort &) = delete;                // Owns the fd, not copyable
+    SerialPort &operator=(const SerialPort &) = delete;
 
     int open_port();
     int open_port(const std::string _portname, int _baud, 
-                  int _timeout = 0);                                // Open port (if used default constructor)
+                  int _timeout = 0,
+                  FlowControl _flow = FlowControl::NONE);          // Open port (if used default constructor)
+    void set_write_timeout(int _timeout);                           // Max ms to wait on backpressure (-1 = forever)
+    void set_flow_control(FlowControl _flow);                       // Flow control applied on open
+    void set_control_lines(LineState _dtr, LineState _rts);         // DTR/RTS state applied on open
+    void set_auto_reset(bool enable);                               // false = keep DTR up on close, no reset on reopen
+    void set_termios_hook(std::function<void(struct termios &)> hook);  // Adjust settings before they're applied
+    int set_baud(int _baud);                                        // Change speed in place, without reopening
+    int detect_baud(const std::vector<int> &candidates = std::vector<int>(),
+                    int window_ms = 100, bool text = true);         // Find and switch to the device's rate
+    int swait_ready(const std::string &banner, int deadline_ms);    // Wait for banner from the device
+    int swait_ready(std::function<bool(const std::string &)> ready,
+                    int deadline_ms);                               // Wait for a line accepted by ready()
     int swrite(uint8_t byte);                                       // Write single byte
     int swrite(const std::string str);                              // Write string
+    int swrite(const uint8_t *buf, int len);                        // Write buffer, waiting while peer holds us off
     int sread(uint8_t &byte);                                       // Read single byte
+    int sread(uint8_t *buf, int max_size);                          // Read whatever is available, up to max_size
     int sread(std::vector<uint8_t> &vec_bytes, int size);           // Read size bytes
     int sreadline(std::string &read_str, int max_size = 256);       // Read line into string
     int sread_until(std::vector<uint8_t> &vec_bytes, char until, 
                    int max_size = 256);                             // Read until passed character
-    int sclose();        // Close the port
-    int sflush();        // Flush the port
+    int sclose();                           // Close the port
+    int sflush(int quiet_ms = 20);          // Drain output, then discard input until the line goes quiet
+    int sdrain(int timeout_ms = 1000);      // Wait until all output has been transmitted
+    int sdiscard_input();                   // Discard received but unread bytes
+    int sdiscard_output();                  // Discard written but untransmitted bytes
+    int sinput_pending();                   // Number of bytes waiting to be read
+    int soutput_pending();                  // Number of bytes waiting to be transmitted
+    int get_fd() const { return fd; }       // Underlying fd, for event loops (-1 if closed)
+    FlowControl get_flow_control() const { return flow_control; }  // Flow control used when (re)opening
+    SerialClock::time_point last_rx_time() const { return rx_stamp; }  // When the data last read arrived
+
+    void set_reconnect(bool enable, int timeout_ms = 1000,
+                       bool keep_pending_writes = false);           // Reopen the device when it goes away
+    void set_device_locator(std::function<std::string()> locate);  // Finds the device's current path
+    int reconnect();                                                // Close and reopen the same device
+    int last_reconnect_ms() const { return last_reconnect; }       // Time the last reconnect took
+    int reconnect_count() const { return reconnects; }             // Reconnects since construction
 
 private:
+    // Queued write, lives on the writing thread's stack until done
+    struct WriteRequest
+    {
+        const uint8_t *buf;
+        int len;
+        int result;
+        std::atomic<bool> done;
+        std::atomic<WriteRequest *> next;
+    };
+
+    int read_chunk(uint8_t *buf, int max_size);
+    WriteRequest *wq_pop();
+    int write_now(const uint8_t *buf, int len);
+    int write_all(const uint8_t *buf, int len, int &written);
+    void flush_pending();
+    int recover(int err, int generation);
+    int reopen();
+    static bool is_disconnect(int err);
+
     std::string port_name;
     int baudrate;
-    int fd; 
+    std::atomic<int> fd;
     int timeout;       
+    int write_timeout;
+    FlowControl flow_control;
+    LineState dtr_state;
+    LineState rts_state;
+    bool auto_reset;
+    std::function<void(struct termios &)> termios_hook;
+
+    bool reconnect_enabled;
+    int reconnect_timeout;
+    bool keep_pending;
+    std::atomic<int> last_reconnect;
+    std::atomic<int> reconnects;        // Also the reconnect generation
+    std::mutex reconnect_lock;
+    std::function<std::string()> locator;
+    std::vector<uint8_t> pending_tx;    // Writes held back while disconnected
+
+    // Reader side: line reads take whole chunks from the driver and keep
+    // the rest here, together with the time the chunk came out of read()
+    uint8_t rx_buf[SERIAL_RX_CHUNK];
+    int rx_head;                        // First unread byte
+    int rx_tail;                        // One past the last buffered byte
+    SerialClock::time_point rx_time;    // When the last chunk was read
+    SerialClock::time_point rx_stamp;   // Arrival of the data last returned
+
+    // Intrusive MPSC write queue (Vyukov), writers push at wq_head and
+    // whoever holds the combining flag pops at wq_tail
+    std::atomic<WriteRequest *> wq_head;
+    WriteRequest *wq_tail;
+    WriteRequest wq_stub;
+    std::atomic<bool> combining;
+    std::atomic<int> wq_waiters;        // Writers asleep on wq_wake, or about to be
+    std::mutex wq_lock;                 // Only for sleeping on wq_wake
+    std::condition_variable wq_wake;    // Combining writer done with its round
 };
 #endif
 
@@ -80,19 +244,37 @@ class SerialPortWin32
 {
 public:
     SerialPortWin32();
-	SerialPortWin32(const PSTRING _pname, int _baud, int _timeout = 0);
+	SerialPortWin32(const PSTRING _pname, int _baud, int _timeout = 0,
+		FlowControl _flow = FlowControl::NONE);
     ~SerialPortWin32();
     
 	int open_port();
-	int open_port(const PSTRING _pname, int _baud, int _timeout = 0);	// Open port (if used default constructor)
+	int open_port(const PSTRING _pname, int _baud, int _timeout = 0,
+		FlowControl _flow = FlowControl::NONE);							// Open port (if used default constructor)
+	void set_flow_control(FlowControl _flow);							// Flow control applied on open
+	void set_control_lines(LineState _dtr, LineState _rts);				// DTR/RTS state applied on open
+	int set_baud(int _baud);											// Change speed in place, without reopening
+	int swait_ready(const std::string &banner, int deadline_ms);		// Wait for banner from the device
+	int swait_ready(std::function<bool(const std::string &)> ready,
+		int deadline_ms);												// Wait for a line accepted by ready()
 	int swrite(uint8_t byte);											// Write single byte
 	int swrite(const std::string str);										// Write string
+	int swrite(const uint8_t *buf, int len);							// Write buffer, waiting while peer holds us off
 	int sread(uint8_t &byte);											// Read single byte
+	int sread(uint8_t *buf, int max_size);								// Read whatever is available, up to max_size
 	int sread(std::vector<uint8_t> &vec_bytes, int size);				// Read size bytes
 	int sreadline(std::string &read_str, int max_size = 256);				// Read line into string
 	int sread_until(std::vector<uint8_t> &vec_bytes, char until,
 		int max_size = 256);											// Read until passed character
 	int sclose();														// Close the port
+	int sflush(int quiet_ms = 20);										// Drain output, then discard input until the line goes quiet
+	int sdrain(int timeout_ms = 1000);									// Wait until all output has been transmitted
+	int sdiscard_input();												// Discard received but unread bytes
+	int sdiscard_output();												// Discard written but untransmitted bytes
+	int sinput_pending();												// Number of bytes waiting to be read
+	int soutput_pending();												// Number of bytes waiting to be transmitted
+	SerialClock::time_point last_rx_time() const { return rx_stamp; }	// When the data last read arrived
+	FlowControl get_flow_control() const { return flow_control; }		// Flow control used when (re)opening
 
 private:
     HANDLE com;
@@ -102,5 +284,22 @@ private:
 	PSTRING port_name;
 	DWORD baud_rate;
 	int timeout;
+	FlowControl flow_control;
+	LineState dtr_state;
+	LineState rts_state;
+	SerialClock::time_point rx_stamp;
 };
+#endif
+
+#if defined(SERIAL_PORT)
+// Opens ports[i] on names[i], all at the same time, and if banner is not
+// empty waits for each device to print it. Startup then takes as long as
+// the slowest board instead of the sum of all of them.
+// Returns per port: ms until ready (0 if no banner), -1 if it couldn't
+// be opened, -2 if the banner didn't arrive within deadline_ms.
+std::vector<int> open_ports(std::vector<SERIAL_PORT *> &ports,
+                            const std::vector<PSTRING> &names,
+                            int baud, int timeout = 0,
+                            const std::string &banner = "",
+                            int deadline_ms = 3000);
 #endif
\ No newline at end of file
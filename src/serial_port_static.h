@@ -0,0 +1,248 @@
+//
+//  serial_port_static.h
+//
+//  Compile time configured serial port. Baud rate, receive buffer
+//  size, line terminators and framing are template parameters, so the
+//  baud lookup is checked at build time, the receive buffer lives inline
+//  in the object (no heap) and the line scanning loop is specialized for
+//  the terminator set.
+//
+//  Opening, writing, flow control and reconnect are left to the runtime
+//  SerialPort class, which BasicSerialPort wraps. Example:
+//
+//    typedef SerialConfig<115200, 512, Terminators<'\n'>> Config;
+//    BasicSerialPort<Config> serial("/dev/tty.usbmodem431", 50);
+//    std::string line;
+//    serial.sreadline(line);
+//
+
+#pragma once
+
+#include "serial_port.h"
+
+#if defined(__APPLE__) || defined(__linux__)
+
+// *************************************************************
+// Framing policies, applied on top of the SerialPort defaults
+// *************************************************************
+
+struct Framing8N1
+{
+    static void apply(struct termios &t)
+    {
+        t.c_cflag &= ~(PARENB | CSTOPB | CSIZE);
+        t.c_cflag |= CS8;
+    }
+};
+
+struct Framing8E1
+{
+    static void apply(struct termios &t)
+    {
+        t.c_cflag &= ~(PARODD | CSTOPB | CSIZE);
+        t.c_cflag |= PARENB | CS8;
+    }
+};
+
+struct Framing7E1
+{
+    static void apply(struct termios &t)
+    {
+        t.c_cflag &= ~(PARODD | CSTOPB | CSIZE);
+        t.c_cflag |= PARENB | CS7;
+    }
+};
+
+struct Framing8N2
+{
+    static void apply(struct termios &t)
+    {
+        t.c_cflag &= ~(PARENB | CSIZE);
+        t.c_cflag |= CSTOPB | CS8;
+    }
+};
+
+// *************************************************************
+// Terminator sets
+// *************************************************************
+
+// Any of the listed characters ends a line
+template <char... Terms>
+struct Terminators;
+
+template <char T, char... Rest>
+struct Terminators<T, Rest...>
+{
+    static bool match(uint8_t b)
+    {
+        return b == static_cast<uint8_t>(T) || Terminators<Rest...>::match(b);
+    }
+
+    // Returns the first terminator in [begin, end), or end
+    static const uint8_t *find(const uint8_t *begin, const uint8_t *end)
+    {
+        for(const uint8_t *p = begin; p != end; p++)
+        {
+            if(match(*p))
+                return p;
+        }
+        return end;
+    }
+};
+
+// Single terminator, the common case, searched with memchr
+template <char T>
+struct Terminators<T>
+{
+    static bool match(uint8_t b)
+    {
+        return b == static_cast<uint8_t>(T);
+    }
+
+    static const uint8_t *find(const uint8_t *begin, const uint8_t *end)
+    {
+        const void *p = memchr(begin, static_cast<uint8_t>(T), end - begin);
+        return p ? static_cast<const uint8_t *>(p) : end;
+    }
+};
+
+// *************************************************************
+// Configuration
+// *************************************************************
+
+// Baud = baud rate, must have a termios constant on this platform
+// BufferSize = inline receive buffer, also the longest line returned
+// Terms = line terminator set
+// Framing = data bits / parity / stop bits policy
+template <int Baud, int BufferSize = 256,
+          class Terms = Terminators<'\n'>, class Framing = Framing8N1>
+struct SerialConfig
+{
+    static constexpr int baud = Baud;
+    static constexpr speed_t speed = baud_to_speed(Baud);
+    static constexpr int buffer_size = BufferSize;
+    typedef Terms terminators;
+    typedef Framing framing;
+
+    static_assert(speed != 0, "SerialConfig: baud rate has no termios constant");
+    static_assert(BufferSize > 0, "SerialConfig: buffer size must be positive");
+};
+
+// *************************************************************
+// Port
+// *************************************************************
+
+template <class Config>
+class BasicSerialPort
+{
+public:
+    BasicSerialPort()
+    {
+        rx_head = 0;
+        rx_scan = 0;
+        rx_tail = 0;
+        port.set_termios_hook(&Config::framing::apply);
+    }
+
+    // _portname = name of serial port (eg: "dev/tty.usbmodem431", etc)
+    // _timeout = timeout in ms for each read attempt (default 0ms)
+    BasicSerialPort(const std::string _portname, int _timeout = 0)
+        : BasicSerialPort()
+    {
+        this->open_port(_portname, _timeout);
+    }
+
+    // Open port at the configured baud rate and framing, with the flow
+    // control set through runtime()
+    int open_port(const std::string _portname, int _timeout = 0)
+    {
+        rx_head = rx_scan = rx_tail = 0;
+        return port.open_port(_portname, Config::baud, _timeout, port.get_flow_control());
+    }
+
+    int swrite(const uint8_t *buf, int len) { return port.swrite(buf, len); }
+    int swrite(const std::string str) { return port.swrite(str); }
+
+    // Read whatever is buffered or available, up to max_size bytes
+    int sread(uint8_t *buf, int max_size)
+    {
+        if(rx_head == rx_tail)
+            return port.sread(buf, max_size);
+
+        int count = rx_tail - rx_head;
+        if(count > max_size)
+            count = max_size;
+        memcpy(buf, rx_buf + rx_head, count);
+        this->consume(count);
+
+        return count;
+    }
+
+    // Read full line (ending with any of the configured terminators, or
+    // a full buffer, whatever happens first) and append it to read_str.
+    // A partial line stays buffered on timeout, so the next call picks it
+    // up where this one left off.
+    // Returns number of bytes read, -1 on error, -2 if timed out.
+    int sreadline(std::string &read_str)
+    {
+        while(1)
+        {
+            const uint8_t *end = rx_buf + rx_tail;
+            const uint8_t *term = Config::terminators::find(rx_buf + rx_scan, end);
+
+            if(term != end || rx_tail - rx_head == Config::buffer_size) {
+                int len = static_cast<int>((term != end ? term + 1 : end) - (rx_buf + rx_head));
+                read_str.append(reinterpret_cast<const char *>(rx_buf + rx_head), len);
+                this->consume(len);
+                return len;
+            }
+            rx_scan = rx_tail;      // Nothing up to here, don't scan it again
+
+            int n = this->fill();
+            if(n < 0)
+                return n;           // Timed out or read error
+        }
+    }
+
+    int sclose() { return port.sclose(); }
+
+    // Runtime settings not covered by the configuration (flow control,
+    // reconnect, control lines, ...)
+    SerialPort &runtime() { return port; }
+
+private:
+    // Reads more input into the free end of the buffer, moving the
+    // unread part to the front first if needed
+    int fill()
+    {
+        if(rx_tail == Config::buffer_size && rx_head > 0) {
+            memmove(rx_buf, rx_buf + rx_head, rx_tail - rx_head);
+            rx_scan -= rx_head;
+            rx_tail -= rx_head;
+            rx_head = 0;
+        }
+
+        int n = port.sread(rx_buf + rx_tail, Config::buffer_size - rx_tail);
+        if(n > 0)
+            rx_tail += n;
+
+        return n;
+    }
+
+    void consume(int count)
+    {
+        rx_head += count;
+        if(rx_scan < rx_head)
+            rx_scan = rx_head;
+        if(rx_head == rx_tail)
+            rx_head = rx_scan = rx_tail = 0;
+    }
+
+    SerialPort port;
+    uint8_t rx_buf[Config::buffer_size];
+    int rx_head;        // First unread byte
+    int rx_scan;        // Bytes before this were already searched for terminators
+    int rx_tail;        // One past the last buffered byte
+};
+
+#endif
@@ -0,0 +1,495 @@
+//
+//  serial_portset.cpp
+//
+//  Waits on and reads from many ports at once, through io_uring where
+//  available and poll() otherwise.
+//
+
+#include "serial_portset.h"
+
+#if defined(__APPLE__) || defined(__linux__)
+
+#if SERIAL_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#endif
+
+#define OP_POLL  1ULL       // user_data = op << 32 | port index
+#define OP_READ  2ULL
+#define OP_WRITE 3ULL
+
+// try_io_uring = use io_uring if the kernel allows it
+// _buf_size = bytes read per port per wakeup
+PortSet::PortSet(bool try_io_uring, int _buf_size)
+{
+    buf_size = _buf_size;
+    want_uring = try_io_uring;
+    calls = 0;
+#if SERIAL_IO_URING
+    ring_fd = -1;
+    sq_ptr = cq_ptr = NULL;
+    sqes = NULL;
+    to_submit = 0;
+    registered = 0;
+    in_flight = 0;
+#endif
+}
+
+PortSet::~PortSet()
+{
+#if SERIAL_IO_URING
+    this->ring_teardown();
+#endif
+}
+
+// Adds an already opened port. Returns its index (passed to the data
+// handler), -1 if the port isn't open.
+int PortSet::add(SerialPort &port)
+{
+    if(port.get_fd() == -1)
+        return -1;
+
+    Port p;
+    p.port = &port;
+    p.fd = port.get_fd();
+    p.buf.resize(buf_size);
+    p.polling = false;
+    p.reading = false;
+    p.hangup = false;
+    ports.push_back(std::move(p));
+
+    return static_cast<int>(ports.size()) - 1;
+}
+
+PortSetBackend PortSet::backend() const
+{
+#if SERIAL_IO_URING
+    if(ring_fd != -1 || (want_uring && ports.empty()))
+        return PortSetBackend::IO_URING;
+#endif
+    return PortSetBackend::POLL;
+}
+
+// Reports a port as failed and leaves it out from now on
+void PortSet::fail(int index, PortDataHandler &on_data)
+{
+    if(ports[index].fd == -1)
+        return;
+
+    ports[index].fd = -1;
+    on_data(index, NULL, -1, SerialClock::now());
+
+#if SERIAL_IO_URING
+    // Stop its multishot poll
+    if(ring_fd != -1 && ports[index].polling) {
+        struct io_uring_sqe *sqe = this->ring_sqe();
+        if(sqe) {
+            sqe->opcode = IORING_OP_POLL_REMOVE;
+            sqe->addr = (OP_POLL << 32) | index;
+            sqe->user_data = 0;
+        }
+    }
+#endif
+}
+
+// Waits up to timeout_ms (-1 = forever) for any port to have data, then
+// reads every ready port once and calls on_data for each chunk.
+// Returns number of chunks delivered, -1 on error.
+int PortSet::wait(int timeout_ms, PortDataHandler on_data)
+{
+#if SERIAL_IO_URING
+    if(want_uring && ring_fd == -1 && this->ring_setup() < 0)
+        want_uring = false;         // Not available, stay on poll()
+    if(ring_fd != -1)
+        return this->wait_ring(timeout_ms, on_data);
+#endif
+    return this->wait_poll(timeout_ms, on_data);
+}
+
+// Writes len bytes to port index. On io_uring the data is copied and
+// goes out with the next wait(), together with the other ports' writes;
+// on poll() it is written straight away with swrite().
+// Returns len if OK, -1 on error.
+int PortSet::write(int index, const uint8_t *buf, int len)
+{
+    if(index < 0 || index >= static_cast<int>(ports.size()) || ports[index].fd == -1)
+        return -1;
+
+#if SERIAL_IO_URING
+    if(ring_fd != -1) {
+        ports[index].tx.insert(ports[index].tx.end(), buf, buf + len);
+        return len;
+    }
+#endif
+    calls++;
+    return ports[index].port->swrite(buf, len);
+}
+
+// *************************************************************
+// poll() backend
+// *************************************************************
+
+int PortSet::wait_poll(int timeout_ms, PortDataHandler &on_data)
+{
+    if(pfds.size() != ports.size()) {
+        pfds.resize(ports.size());
+        for(size_t i = 0; i < ports.size(); i++)
+        {
+            pfds[i].fd = ports[i].fd;
+            pfds[i].events = POLLIN;
+        }
+    }
+
+    calls++;
+    int n = poll(pfds.data(), pfds.size(), timeout_ms);
+    if(n < 0)
+        return errno == EINTR ? 0 : -1;
+
+    auto now = SerialClock::now();
+    int chunks = 0;
+
+    for(size_t i = 0; i < pfds.size() && n > 0; i++)
+    {
+        if(pfds[i].revents == 0)
+            continue;
+        n--;
+
+        bool hangup = pfds[i].revents & (POLLHUP | POLLERR);
+
+        if(pfds[i].revents & POLLIN) {
+            calls++;
+            int r = static_cast<int>(read(pfds[i].fd, ports[i].buf.data(), buf_size));
+            if(r > 0) {
+                on_data(static_cast<int>(i), ports[i].buf.data(), r, now);
+                chunks++;
+                continue;
+            }
+            if(r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+                continue;
+            if(r == 0 && !hangup)
+                continue;
+        }
+        else if(!(pfds[i].revents & (POLLHUP | POLLERR | POLLNVAL)))
+            continue;
+
+        this->fail(static_cast<int>(i), on_data);
+        pfds[i].fd = -1;            // poll() skips negative fds
+    }
+
+    return chunks;
+}
+
+// *************************************************************
+// io_uring backend, straight on the system calls
+// *************************************************************
+
+#if SERIAL_IO_URING
+
+// Sets up the ring and maps its queues. Returns 0 if OK, -1 if io_uring
+// can't be used (no kernel support, disabled, or too old for EXT_ARG).
+int PortSet::ring_setup()
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    // Room for a poll, a read and a write per port
+    unsigned entries = 64;
+    while(entries < 3 * ports.size())
+        entries *= 2;
+
+    int fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+    if(fd < 0) {
+#if PORTCON_DEBUG
+        std::cerr << "PortSet: io_uring unavailable (" << strerror(errno) <<
+            "), using poll()" << std::endl;
+#endif
+        return -1;
+    }
+    if(!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_NODROP)) {
+        close(fd);
+        return -1;
+    }
+    ring_fd = fd;
+
+    sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    sq_ptr = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ring_fd, IORING_OFF_SQ_RING);
+    cq_ptr = mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ring_fd, IORING_OFF_CQ_RING);
+    void *s = mmap(NULL, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ring_fd, IORING_OFF_SQES);
+    if(sq_ptr == MAP_FAILED || cq_ptr == MAP_FAILED || s == MAP_FAILED) {
+        if(sq_ptr == MAP_FAILED) sq_ptr = NULL;
+        if(cq_ptr == MAP_FAILED) cq_ptr = NULL;
+        if(s != MAP_FAILED) munmap(s, sqes_len);
+        this->ring_teardown();
+        return -1;
+    }
+    sqes = static_cast<struct io_uring_sqe *>(s);
+
+    char *sq = static_cast<char *>(sq_ptr);
+    sq_head = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+    char *cq = static_cast<char *>(cq_ptr);
+    cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe *>(cq + p.cq_off.cqes);
+    sq_entries = p.sq_entries;
+
+    return 0;
+}
+
+void PortSet::ring_teardown()
+{
+    if(sqes)
+        munmap(sqes, sqes_len);
+    if(sq_ptr)
+        munmap(sq_ptr, sq_len);
+    if(cq_ptr)
+        munmap(cq_ptr, cq_len);
+    if(ring_fd != -1)
+        close(ring_fd);
+    sqes = NULL;
+    sq_ptr = cq_ptr = NULL;
+    ring_fd = -1;
+}
+
+// Registers the read buffers of all ports, again when ports were added
+// (only possible while no read is in flight). Returns 0 if OK, -1 on error.
+int PortSet::ring_register()
+{
+    if(registered == ports.size() || in_flight > 0)
+        return 0;
+
+    if(registered > 0) {
+        calls++;
+        syscall(__NR_io_uring_register, ring_fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+    }
+
+    std::vector<struct iovec> iov(ports.size());
+    for(size_t i = 0; i < ports.size(); i++)
+    {
+        iov[i].iov_base = ports[i].buf.data();
+        iov[i].iov_len = ports[i].buf.size();
+    }
+    calls++;
+    if(syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS,
+               iov.data(), static_cast<unsigned>(iov.size())) < 0) {
+        registered = 0;
+        return -1;
+    }
+    registered = ports.size();
+
+    return 0;
+}
+
+// Returns the next free SQE, submitting what's queued first if the ring
+// is full
+struct io_uring_sqe *PortSet::ring_sqe()
+{
+    unsigned tail = *sq_tail;
+
+    if(tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+        this->ring_enter(0, 0);
+        tail = *sq_tail;
+        if(tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries)
+            return NULL;
+    }
+
+    unsigned index = tail & *sq_mask;
+    struct io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    to_submit++;
+
+    return sqe;
+}
+
+// Submits the queued SQEs and, if min_complete > 0, waits up to
+// timeout_ms (-1 = forever) for that many completions.
+// Returns 0 if OK (also on timeout), -1 on error.
+int PortSet::ring_enter(unsigned min_complete, int timeout_ms)
+{
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    unsigned flags = IORING_ENTER_EXT_ARG;
+
+    if(min_complete > 0) {
+        flags |= IORING_ENTER_GETEVENTS;
+        if(timeout_ms >= 0) {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+            arg.ts = reinterpret_cast<uint64_t>(&ts);
+        }
+    }
+
+    calls++;
+    int r = static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit,
+                                     min_complete, flags, &arg, sizeof(arg)));
+    if(r >= 0)
+        to_submit -= r;
+    else if(errno != ETIME && errno != EINTR && errno != EBUSY)
+        return -1;
+
+    return 0;
+}
+
+// Queues a read of port index into its registered buffer.
+// Returns true if queued.
+bool PortSet::ring_read(int index)
+{
+    struct io_uring_sqe *sqe = this->ring_sqe();
+    if(!sqe)
+        return false;           // Ring full, the next poll event retries
+
+    Port &p = ports[index];
+    sqe->opcode = IORING_OP_READ_FIXED;
+    sqe->fd = p.fd;
+    sqe->addr = reinterpret_cast<uint64_t>(p.buf.data());
+    sqe->len = buf_size;
+    sqe->buf_index = static_cast<uint16_t>(index);
+    sqe->user_data = (OP_READ << 32) | index;
+    p.reading = true;
+    in_flight++;
+
+    return true;
+}
+
+// Handles the completions waiting in the CQ: data goes to on_data,
+// ready ports get a read queued (counted in reads_queued), finished
+// writes are followed up. Returns number of chunks delivered.
+int PortSet::ring_reap(PortDataHandler &on_data, int &reads_queued)
+{
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    auto now = SerialClock::now();
+    int chunks = 0;
+
+    for(; head != tail; head++)
+    {
+        struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+        unsigned long long op = cqe->user_data >> 32;
+        int i = static_cast<int>(cqe->user_data & 0xFFFFFFFF);
+        int res = cqe->res;
+        Port &p = ports[i];
+
+        if(op == 0)
+            continue;           // Poll removal
+        if(op == OP_POLL) {
+            if(!(cqe->flags & IORING_CQE_F_MORE))
+                p.polling = false;      // Poll ended, rearmed on the next wait()
+            if(p.fd == -1)
+                continue;
+            if(res < 0 || (!(res & POLLIN) && (res & (POLLHUP | POLLERR)))) {
+                this->fail(i, on_data);
+                continue;
+            }
+            p.hangup = res & (POLLHUP | POLLERR);   // Read what's left, then fail
+            if(!p.reading && this->ring_read(i))
+                reads_queued++;
+        }
+        else if(op == OP_READ) {
+            p.reading = false;
+            in_flight--;
+            if(res > 0) {
+                on_data(i, p.buf.data(), res, now);
+                chunks++;
+                // The poll only fires on new input, so a full buffer
+                // means read again right away for what's left
+                if(res == buf_size && p.fd != -1 && this->ring_read(i))
+                    reads_queued++;
+            }
+            else if((res < 0 && res != -EAGAIN && res != -EINTR) || (res == 0 && p.hangup))
+                this->fail(i, on_data);
+        }
+        else if(op == OP_WRITE) {
+            in_flight--;
+            if(res > 0)
+                p.tx_busy.erase(p.tx_busy.begin(), p.tx_busy.begin() + res);
+            if(res == -EAGAIN && p.fd != -1) {
+                // Driver queue full, finish it the blocking way
+                calls++;
+                p.port->swrite(p.tx_busy.data(), static_cast<int>(p.tx_busy.size()));
+                p.tx_busy.clear();
+            }
+            else if(res < 0)
+                this->fail(i, on_data);
+            // Whatever is left goes first in the next batch
+            p.tx.insert(p.tx.begin(), p.tx_busy.begin(), p.tx_busy.end());
+            p.tx_busy.clear();
+        }
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+    return chunks;
+}
+
+int PortSet::wait_ring(int timeout_ms, PortDataHandler &on_data)
+{
+    if(this->ring_register() < 0)
+        return -1;
+
+    // Arm polls for new ports, queue the writes
+    for(size_t i = 0; i < ports.size(); i++)
+    {
+        Port &p = ports[i];
+        if(p.fd == -1)
+            continue;
+
+        if(!p.polling && i < registered) {
+            struct io_uring_sqe *sqe = this->ring_sqe();
+            if(!sqe)
+                return -1;
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = p.fd;
+            sqe->poll32_events = POLLIN;
+            sqe->len = IORING_POLL_ADD_MULTI;
+            sqe->user_data = (OP_POLL << 32) | i;
+            p.polling = true;
+        }
+        if(!p.tx.empty() && p.tx_busy.empty()) {
+            struct io_uring_sqe *sqe = this->ring_sqe();
+            if(!sqe)
+                return -1;
+            p.tx_busy.swap(p.tx);
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->fd = p.fd;
+            sqe->addr = reinterpret_cast<uint64_t>(p.tx_busy.data());
+            sqe->len = static_cast<unsigned>(p.tx_busy.size());
+            sqe->user_data = (OP_WRITE << 32) | i;
+            in_flight++;
+        }
+    }
+
+    // Submit and wait for the first events
+    if(this->ring_enter(1, timeout_ms) < 0)
+        return -1;
+
+    int reads = 0;
+    int chunks = this->ring_reap(on_data, reads);
+
+    // The ports that woke us up have data waiting, so their reads
+    // complete inline: one more enter submits and collects them all
+    while(reads > 0)
+    {
+        if(this->ring_enter(reads, -1) < 0)
+            return -1;
+        reads = 0;
+        chunks += this->ring_reap(on_data, reads);
+    }
+
+    return chunks;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,120 @@
+//
+//  serial_portset.h
+//
+//  Reads from many ports with one wait, for hosts with dozens or
+//  hundreds of USB serial adapters. wait() blocks until any port has
+//  data and hands each ready port's chunk to a callback, stamped with
+//  the time it was read.
+//
+//  Two backends:
+//  - poll(): one poll() per wakeup plus one read() per ready port.
+//  - io_uring (Linux): each port has a multishot poll armed once and a
+//    read buffer registered with the kernel. Reads for all the ready
+//    ports are submitted and completed together, so a wakeup costs two
+//    io_uring_enter() calls however many ports had data. Writes queued
+//    with write() go out in the same batch.
+//  io_uring is used when the kernel allows it (it's often disabled in
+//  containers, see /proc/sys/kernel/io_uring_disabled), otherwise the
+//  set falls back to poll() on its own.
+//
+//  The set drives the ports' fds directly, so don't read them with
+//  sread*/sreadline while they're in a set, and SerialPort's reconnect
+//  is bypassed. A port that fails or hangs up is reported once with
+//  len = -1 and then left out.
+//
+//  macOS / Linux only (io_uring on Linux only, no liburing needed).
+//
+
+#pragma once
+
+#include "serial_port.h"
+
+#if defined(__APPLE__) || defined(__linux__)
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define SERIAL_IO_URING 1
+#endif
+#endif
+
+#if SERIAL_IO_URING
+struct io_uring_sqe;
+struct io_uring_cqe;
+#endif
+
+enum class PortSetBackend
+{
+    POLL,
+    IO_URING
+};
+
+// Called with the port index, its data and when it was read. len = -1
+// when the port failed
+typedef std::function<void(int index, const uint8_t *buf, int len,
+                           SerialClock::time_point time)> PortDataHandler;
+
+class PortSet
+{
+public:
+    PortSet(bool try_io_uring = true, int _buf_size = 4096);
+    ~PortSet();
+
+    PortSet(const PortSet &) = delete;
+    PortSet &operator=(const PortSet &) = delete;
+
+    int add(SerialPort &port);                          // Add an open port, returns its index
+    int wait(int timeout_ms, PortDataHandler on_data);  // Wait for data, read all ready ports
+    int write(int index, const uint8_t *buf, int len);  // Write to a port (batched on io_uring)
+    PortSetBackend backend() const;                     // Backend in use
+    unsigned long syscalls() const { return calls; }    // System calls made by wait() and write()
+
+private:
+    struct Port
+    {
+        SerialPort *port;
+        int fd;                     // -1 once failed
+        std::vector<uint8_t> buf;   // Read buffer (registered on io_uring)
+        std::vector<uint8_t> tx;    // Queued for the next batch
+        std::vector<uint8_t> tx_busy;   // Being written
+        bool polling;               // Multishot poll armed
+        bool reading;               // Read in flight
+        bool hangup;                // Poll saw a hangup, fail after the last read
+    };
+
+    void fail(int index, PortDataHandler &on_data);
+    int wait_poll(int timeout_ms, PortDataHandler &on_data);
+
+    std::vector<Port> ports;
+    int buf_size;
+    bool want_uring;
+    unsigned long calls;
+    std::vector<struct pollfd> pfds;
+
+#if SERIAL_IO_URING
+    int ring_setup();
+    void ring_teardown();
+    struct io_uring_sqe *ring_sqe();
+    int ring_enter(unsigned min_complete, int timeout_ms);
+    bool ring_read(int index);
+    int ring_reap(PortDataHandler &on_data, int &reads_queued);
+    int ring_register();
+    int wait_ring(int timeout_ms, PortDataHandler &on_data);
+
+    int ring_fd;                // -1 if not (yet) set up
+    void *sq_ptr;
+    size_t sq_len;
+    void *cq_ptr;
+    size_t cq_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned sq_entries;
+    unsigned to_submit;         // SQEs filled since the last enter
+    size_t registered;          // Ports whose buffers are registered
+    int in_flight;              // Reads and writes not completed yet
+#endif
+};
+
+#endif
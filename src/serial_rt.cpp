@@ -0,0 +1,287 @@
+//
+//  serial_rt.cpp
+//
+//  Real time reading profile: pinned SCHED_FIFO reader thread, locked
+//  preallocated buffers, wake to deliver latency histogram.
+//
+
+#include "serial_rt.h"
+
+#if defined(__APPLE__) || defined(__linux__)
+
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+
+// _port = already opened serial port
+// _config = see RtConfig. All memory is allocated here, start() and the
+// reader thread don't allocate
+RtReader::RtReader(SerialPort &_port, const RtConfig &_config)
+    : port(_port), config(_config), hist(64 * SUB_BUCKETS)
+{
+    // Rounded up to a power of two so the free running head / tail
+    // counters map to the same slot when they wrap
+    int slots = 1;
+    while(slots < config.slots && slots < (1 << 30))
+        slots <<= 1;
+    config.slots = slots;
+    config.slot_size = std::max(1, config.slot_size);
+
+    // One spare slot takes reads while the ring is full
+    storage.assign(static_cast<size_t>(config.slots + 1) * config.slot_size, 0);
+    chunks.resize(config.slots + 1);
+    for(int i = 0; i <= config.slots; i++)
+    {
+        chunks[i].len = 0;
+        chunks[i].data = storage.data() + static_cast<size_t>(i) * config.slot_size;
+    }
+
+    head = 0;
+    tail = 0;
+    max_ns = 0;
+    running = false;
+    overrun = 0;
+    read_error = 0;
+    wake_pipe[0] = wake_pipe[1] = -1;
+}
+
+RtReader::~RtReader()
+{
+    this->stop();
+    if(config.lock_memory) {
+        munlock(storage.data(), storage.size());
+        munlock(chunks.data(), chunks.size() * sizeof(RtChunk));
+        munlock(hist.data(), hist.size() * sizeof(hist[0]));
+    }
+}
+
+// Sets a function called on the reader thread with each chunk, instead
+// of queueing it for front() / pop(). It runs with the reader's
+// priority: it must not block, allocate or log either.
+void RtReader::set_handler(std::function<void(const RtChunk &)> handler)
+{
+    on_chunk = handler;
+}
+
+// Locks the memory, starts the reader thread and applies the affinity
+// and priority. Settings that can't be applied (missing privileges,
+// unsupported platform) are described in warnings, the reader runs
+// without them.
+// Returns 0 if started, -1 on error.
+int RtReader::start(std::string *warnings)
+{
+    std::string notes;
+
+    if(running || port.get_fd() == -1 || pipe(wake_pipe) < 0)
+        return -1;
+
+    if(config.lock_all && mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+        notes += std::string("mlockall: ") + strerror(errno) + "\n";
+    if(config.lock_memory) {
+        if(mlock(storage.data(), storage.size()) < 0 ||
+           mlock(chunks.data(), chunks.size() * sizeof(RtChunk)) < 0 ||
+           mlock(hist.data(), hist.size() * sizeof(hist[0])) < 0)
+            notes += std::string("mlock: ") + strerror(errno) + "\n";
+    }
+
+    running = true;
+    reader = std::thread(&RtReader::run, this);
+
+#if defined(__linux__)
+    if(config.cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(config.cpu, &set);
+        int r = pthread_setaffinity_np(reader.native_handle(), sizeof(set), &set);
+        if(r != 0)
+            notes += std::string("CPU affinity: ") + strerror(r) + "\n";
+    }
+    if(config.priority > 0) {
+        struct sched_param sp;
+        sp.sched_priority = config.priority;
+        int r = pthread_setschedparam(reader.native_handle(), SCHED_FIFO, &sp);
+        if(r != 0)
+            notes += std::string("SCHED_FIFO: ") + strerror(r) + "\n";
+    }
+#else
+    if(config.cpu >= 0 || config.priority > 0)
+        notes += "CPU affinity / SCHED_FIFO: not supported on this platform\n";
+#endif
+
+#if PORTCON_DEBUG
+    if(!notes.empty())
+        std::cerr << "RtReader start: running without\n" << notes;
+#endif
+    if(warnings)
+        *warnings = notes;
+
+    return 0;
+}
+
+// Stops the reader thread and waits for it to exit
+void RtReader::stop()
+{
+    if(running) {
+        running = false;
+        uint8_t b = 0;
+        if(write(wake_pipe[1], &b, 1) < 0) { }   // poll() sees it either way
+    }
+    if(reader.joinable())
+        reader.join();
+    if(wake_pipe[0] != -1) {
+        close(wake_pipe[0]);
+        close(wake_pipe[1]);
+        wake_pipe[0] = wake_pipe[1] = -1;
+    }
+}
+
+// Returns the oldest chunk not popped yet, NULL if none. It stays
+// valid until pop().
+const RtChunk *RtReader::front()
+{
+    unsigned t = tail.load(std::memory_order_relaxed);
+    if(t == head.load(std::memory_order_acquire))
+        return NULL;
+
+    return &chunks[t & (config.slots - 1)];
+}
+
+// Releases the chunk returned by front()
+void RtReader::pop()
+{
+    unsigned t = tail.load(std::memory_order_relaxed);
+    if(t != head.load(std::memory_order_acquire))
+        tail.store(t + 1, std::memory_order_release);
+}
+
+// Adds one wake to deliver time to the histogram
+void RtReader::record(long long ns)
+{
+    int index;
+    if(ns < SUB_BUCKETS)
+        index = static_cast<int>(ns < 0 ? 0 : ns);
+    else {
+        int msb = 63 - __builtin_clzll(static_cast<unsigned long long>(ns));
+        int sub = static_cast<int>((ns >> (msb - 4)) & (SUB_BUCKETS - 1));
+        index = (msb - 3) * SUB_BUCKETS + sub;
+    }
+    hist[index].fetch_add(1, std::memory_order_relaxed);
+
+    long long m = max_ns.load(std::memory_order_relaxed);
+    if(ns > m)
+        max_ns.store(ns, std::memory_order_relaxed);    // Only the reader writes it
+}
+
+void RtReader::run()
+{
+    // Fault the stack in now rather than on the first deep call
+    volatile uint8_t stack[64 * 1024];
+    for(size_t i = 0; i < sizeof(stack); i += 4096)
+        stack[i] = 0;
+
+    int fd = port.get_fd();
+    struct pollfd fds[2];
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = wake_pipe[0];
+    fds[1].events = POLLIN;
+
+    while(running)
+    {
+        fds[0].revents = fds[1].revents = 0;
+        if(poll(fds, 2, -1) < 0) {
+            if(errno == EINTR)
+                continue;
+            read_error = errno;
+            break;
+        }
+        auto wake = SerialClock::now();
+        if(fds[1].revents)
+            break;                      // stop()
+
+        if(!(fds[0].revents & POLLIN)) {
+            if(fds[0].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+                read_error = EIO;
+                break;
+            }
+            continue;
+        }
+
+        // Ring full (or handler mode): read into the spare slot
+        unsigned h = head.load(std::memory_order_relaxed);
+        bool full = h - tail.load(std::memory_order_acquire) >= static_cast<unsigned>(config.slots);
+        RtChunk &c = (on_chunk || full) ? chunks[config.slots] : chunks[h & (config.slots - 1)];
+
+        int n = static_cast<int>(read(fd, const_cast<uint8_t *>(c.data), config.slot_size));
+        if(n <= 0) {
+            if(n == 0 && (fds[0].revents & POLLHUP)) {
+                read_error = EIO;
+                break;
+            }
+            if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                read_error = errno;
+                break;
+            }
+            continue;
+        }
+        c.time = SerialClock::now();
+        c.len = n;
+
+        if(on_chunk)
+            on_chunk(c);
+        else if(full)
+            overrun.fetch_add(1, std::memory_order_relaxed);
+        else
+            head.store(h + 1, std::memory_order_release);
+
+        this->record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            SerialClock::now() - wake).count());
+    }
+}
+
+// Upper bound of the bucket holding the p-th fraction of the samples
+double RtReader::percentile(double p, unsigned long long total) const
+{
+    unsigned long long target = static_cast<unsigned long long>(p * total);
+    if(target < 1)
+        target = 1;
+    unsigned long long seen = 0;
+
+    for(int i = 0; i < static_cast<int>(hist.size()); i++)
+    {
+        seen += hist[i].load(std::memory_order_relaxed);
+        if(seen < target)
+            continue;
+
+        long long upper;
+        if(i < SUB_BUCKETS)
+            upper = i;
+        else {
+            int msb = i / SUB_BUCKETS + 3;
+            upper = ((static_cast<long long>(SUB_BUCKETS + i % SUB_BUCKETS + 1)) << (msb - 4)) - 1;
+        }
+        return std::min(upper, max_ns.load(std::memory_order_relaxed)) / 1000.0;
+    }
+
+    return max_ns.load(std::memory_order_relaxed) / 1000.0;
+}
+
+// Wake to deliver times so far: from poll() returning to the chunk being
+// queued (or the handler returning)
+RtLatency RtReader::latency() const
+{
+    RtLatency l;
+    l.count = 0;
+    for(const auto &b : hist)
+        l.count += b.load(std::memory_order_relaxed);
+
+    l.p50_us = this->percentile(0.5, l.count);
+    l.p99_us = this->percentile(0.99, l.count);
+    l.p9999_us = this->percentile(0.9999, l.count);
+    l.max_us = max_ns.load(std::memory_order_relaxed) / 1000.0;
+
+    return l;
+}
+
+#endif
@@ -0,0 +1,107 @@
+//
+//  serial_rt.h
+//
+//  Real time reading profile, for control loops where the worst case
+//  delay matters more than the average. A dedicated thread, optionally
+//  pinned to a CPU and running under SCHED_FIFO, waits on the port and
+//  moves each chunk into a ring of preallocated, locked slots (or hands
+//  it straight to a callback on that thread). Nothing on that path
+//  allocates, logs or takes a lock, so it never waits on the allocator,
+//  a page fault or another thread.
+//
+//  Every wakeup is timed from the moment poll() returns to the moment
+//  the chunk is delivered, into a fixed histogram that reports p99.99
+//  and max alongside the usual percentiles.
+//
+//  Affinity, priority and memory locking need privileges (root,
+//  CAP_SYS_NICE / CAP_IPC_LOCK, or matching rtprio / memlock limits).
+//  What can't be applied is reported by start() and the thread runs
+//  without it.
+//
+//  The thread reads the port's fd directly, so don't read the port
+//  with sread*/sreadline while it runs, and SerialPort's reconnect is
+//  bypassed.
+//
+//  macOS / Linux only (affinity and SCHED_FIFO on Linux only).
+//
+
+#pragma once
+
+#include "serial_port.h"
+
+#if defined(__APPLE__) || defined(__linux__)
+
+#include <thread>
+
+struct RtConfig
+{
+    int cpu = -1;               // CPU to pin the reader to, -1 = don't pin
+    int priority = 0;           // SCHED_FIFO priority (1..99), 0 = keep normal scheduling
+    bool lock_memory = true;    // mlock() the ring and histogram, prefault the stack
+    bool lock_all = false;      // mlockall() the whole process, current and future pages
+    int slots = 1024;           // Chunks the ring holds, rounded up to a power of two
+    int slot_size = 256;        // Bytes per chunk
+};
+
+struct RtChunk
+{
+    SerialClock::time_point time;   // When read() returned it
+    int len;
+    const uint8_t *data;
+};
+
+struct RtLatency
+{
+    unsigned long long count;       // Wakeups measured
+    double p50_us;
+    double p99_us;
+    double p9999_us;
+    double max_us;
+};
+
+class RtReader
+{
+public:
+    RtReader(SerialPort &_port, const RtConfig &_config = RtConfig());
+    ~RtReader();
+
+    RtReader(const RtReader &) = delete;
+    RtReader &operator=(const RtReader &) = delete;
+
+    void set_handler(std::function<void(const RtChunk &)> handler);    // Deliver on the reader thread instead
+    int start(std::string *warnings = NULL);    // Start the reader thread
+    void stop();                                // Stop and join it
+    const RtChunk *front();                     // Oldest undelivered chunk, NULL if none
+    void pop();                                 // Release the chunk from front()
+    RtLatency latency() const;                  // Wake to deliver statistics
+    unsigned long overruns() const { return overrun; }  // Chunks dropped, ring full
+    int error() const { return read_error; }    // errno that stopped the reader, 0 if none
+
+private:
+    void run();
+    void record(long long ns);
+    double percentile(double p, unsigned long long total) const;
+
+    SerialPort &port;
+    RtConfig config;
+    std::function<void(const RtChunk &)> on_chunk;
+
+    // SPSC ring, the reader thread produces and the consumer pops
+    std::vector<uint8_t> storage;           // slots * slot_size bytes
+    std::vector<RtChunk> chunks;
+    std::atomic<unsigned> head;             // Next slot to fill
+    std::atomic<unsigned> tail;             // Next slot to pop
+
+    // Latency histogram: 64 power of two ranges of ns, 16 steps each
+    static const int SUB_BUCKETS = 16;
+    std::vector<std::atomic<unsigned long long>> hist;
+    std::atomic<long long> max_ns;
+
+    std::thread reader;
+    int wake_pipe[2];                       // Written by stop() to wake poll()
+    std::atomic<bool> running;
+    std::atomic<unsigned long> overrun;
+    std::atomic<int> read_error;
+};
+
+#endif
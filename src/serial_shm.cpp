@@ -0,0 +1,283 @@
+//
+//  serial_shm.cpp
+//
+//  Shared memory ring so several processes can consume the data of one
+//  serial device.
+//
+
+#include "serial_shm.h"
+
+#if defined(__APPLE__) || defined(__linux__)
+
+#include <chrono>
+#include <thread>
+#include <new>
+
+// *************************************************************
+// Writer
+// *************************************************************
+
+ShmRingWriter::ShmRingWriter()
+{
+    header = nullptr;
+    map_size = 0;
+}
+
+ShmRingWriter::~ShmRingWriter()
+{
+    this->destroy();
+}
+
+// Creates the shared memory object _name (eg "/arduino0") holding a ring
+// of _capacity bytes, rounded up to a power of 2. An existing ring with
+// the same name is replaced. Returns 0 on success, -1 on error.
+int ShmRingWriter::create(const std::string _name, uint64_t _capacity)
+{
+    this->destroy();
+
+    uint64_t capacity = 1;
+    while(capacity < _capacity)
+        capacity <<= 1;
+
+    shm_unlink(_name.c_str());
+    int shm = shm_open(_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(shm == -1) {
+#if PORTCON_DEBUG
+        std::cerr << "ShmRingWriter create: couldn't create " << _name << " " <<
+            strerror(errno) << std::endl;
+#endif
+        return -1;
+    }
+
+    size_t size = offsetof(ShmRingHeader, data) + capacity;
+    if(ftruncate(shm, size) < 0) {
+        close(shm);
+        shm_unlink(_name.c_str());
+        return -1;
+    }
+
+    void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+    close(shm);
+    if(mem == MAP_FAILED) {
+        shm_unlink(_name.c_str());
+        return -1;
+    }
+
+    header = new (mem) ShmRingHeader;
+    header->capacity = capacity;
+    header->reserve_pos = 0;
+    header->commit_pos = 0;
+    header->version = SHM_RING_VERSION;
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = SHM_RING_MAGIC;      // Readers check this last
+
+    name = _name;
+    map_size = size;
+
+    return 0;
+}
+
+// Appends len bytes to the ring. Never blocks: readers that are more
+// than a ring behind lose the oldest bytes.
+// Returns number of bytes published, -1 if the ring isn't created.
+int ShmRingWriter::publish(const uint8_t *buf, int len)
+{
+    if(header == nullptr)
+        return -1;
+
+    uint64_t mask = header->capacity - 1;
+    uint64_t pos = header->commit_pos.load(std::memory_order_relaxed);
+
+    // Only the tail of an oversized write can survive anyway
+    if(static_cast<uint64_t>(len) > header->capacity) {
+        pos += len - header->capacity;
+        buf += len - header->capacity;
+        len = static_cast<int>(header->capacity);
+    }
+
+    header->reserve_pos.store(pos + len, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    uint64_t off = pos & mask;
+    uint64_t first = std::min<uint64_t>(len, header->capacity - off);
+    memcpy(header->data + off, buf, first);
+    memcpy(header->data, buf + first, len - first);
+
+    header->commit_pos.store(pos + len, std::memory_order_release);
+
+    return len;
+}
+
+// Reads whatever the port has directly into the ring (up to the wrap
+// point), so bytes are copied once, by the kernel.
+// Returns number of bytes published, or the port's sread() error code.
+int ShmRingWriter::publish_from(SerialPort &port)
+{
+    if(header == nullptr)
+        return -1;
+
+    uint64_t mask = header->capacity - 1;
+    uint64_t pos = header->commit_pos.load(std::memory_order_relaxed);
+    uint64_t off = pos & mask;
+    int room = static_cast<int>(std::min<uint64_t>(header->capacity - off, 65536));
+
+    // Claim the space first, read() writes into it as soon as it's called
+    header->reserve_pos.store(pos + room, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    // Give back what read() didn't fill, readers take the reserved space
+    // as overwritten until the next publish
+    int n = port.sread(header->data + off, room);
+    header->reserve_pos.store(pos + std::max(n, 0), std::memory_order_relaxed);
+    if(n <= 0)
+        return n;
+
+    header->commit_pos.store(pos + n, std::memory_order_release);
+
+    return n;
+}
+
+// Unmaps and removes the ring. Attached readers keep their mapping.
+void ShmRingWriter::destroy()
+{
+    if(header == nullptr)
+        return;
+
+    munmap(header, map_size);
+    shm_unlink(name.c_str());
+    header = nullptr;
+    map_size = 0;
+}
+
+// *************************************************************
+// Reader
+// *************************************************************
+
+ShmRingReader::ShmRingReader()
+{
+    header = nullptr;
+    map_size = 0;
+    cursor = 0;
+    lost_bytes = 0;
+}
+
+ShmRingReader::~ShmRingReader()
+{
+    this->detach();
+}
+
+// Maps an existing ring read-only. Starts at the newest data, or at the
+// oldest data still in the ring if from_oldest is set.
+// Returns 0 on success, -1 on error.
+int ShmRingReader::attach(const std::string name, bool from_oldest)
+{
+    this->detach();
+
+    int shm = shm_open(name.c_str(), O_RDONLY, 0);
+    if(shm == -1) {
+#if PORTCON_DEBUG
+        std::cerr << "ShmRingReader attach: couldn't open " << name << " " <<
+            strerror(errno) << std::endl;
+#endif
+        return -1;
+    }
+
+    struct stat st;
+    if(fstat(shm, &st) < 0 ||
+       static_cast<size_t>(st.st_size) < offsetof(ShmRingHeader, data)) {
+        close(shm);
+        return -1;
+    }
+
+    void *mem = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, shm, 0);
+    close(shm);
+    if(mem == MAP_FAILED)
+        return -1;
+
+    const ShmRingHeader *h = static_cast<const ShmRingHeader *>(mem);
+    if(h->magic != SHM_RING_MAGIC || h->version != SHM_RING_VERSION ||
+       offsetof(ShmRingHeader, data) + h->capacity > static_cast<uint64_t>(st.st_size)) {
+        munmap(mem, st.st_size);
+        return -1;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    header = h;
+    map_size = st.st_size;
+    cursor = header->commit_pos.load(std::memory_order_acquire);
+    if(from_oldest)
+        cursor = (cursor > header->capacity) ? cursor - header->capacity : 0;
+    lost_bytes = 0;
+
+    return 0;
+}
+
+// Copies up to max_size new bytes into buf. Spins (yielding the CPU)
+// up to timeout_ms waiting for data, which keeps latency well under a
+// microsecond on an idle core. Bytes the writer overwrote before we got
+// to them are skipped and counted in lost().
+// Returns number of bytes read, -1 if not attached, -2 if timed out.
+int ShmRingReader::read(uint8_t *buf, int max_size, int timeout_ms)
+{
+    if(header == nullptr)
+        return -1;
+
+    uint64_t capacity = header->capacity;
+    uint64_t mask = capacity - 1;
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(timeout_ms);
+
+    while(1)
+    {
+        uint64_t commit = header->commit_pos.load(std::memory_order_acquire);
+
+        if(commit != cursor) {
+            // Lapped, jump to the oldest byte that can still be intact
+            if(commit - cursor > capacity) {
+                lost_bytes += commit - cursor - capacity;
+                cursor = commit - capacity;
+            }
+
+            uint64_t avail = std::min<uint64_t>(commit - cursor, max_size);
+            uint64_t off = cursor & mask;
+            uint64_t first = std::min<uint64_t>(avail, capacity - off);
+            memcpy(buf, header->data + off, first);
+            memcpy(buf + first, header->data, avail - first);
+
+            // Anything the writer claimed since may have overwritten the
+            // start of what we copied, drop that part
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t reserve = header->reserve_pos.load(std::memory_order_relaxed);
+            uint64_t valid_from = (reserve > capacity) ? reserve - capacity : 0;
+            if(valid_from > cursor) {
+                uint64_t bad = std::min<uint64_t>(valid_from - cursor, avail);
+                lost_bytes += bad;
+                cursor += bad;
+                avail -= bad;
+                memmove(buf, buf + bad, avail);
+                if(avail == 0)
+                    continue;
+            }
+
+            cursor += avail;
+            return static_cast<int>(avail);
+        }
+
+        if(std::chrono::steady_clock::now() >= deadline)
+            return -2;          // Timed out
+        std::this_thread::yield();
+    }
+}
+
+// Unmaps the ring
+void ShmRingReader::detach()
+{
+    if(header == nullptr)
+        return;
+
+    munmap(const_cast<ShmRingHeader *>(header), map_size);
+    header = nullptr;
+    map_size = 0;
+}
+
+#endif
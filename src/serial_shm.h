@@ -0,0 +1,91 @@
+//
+//  serial_shm.h
+//
+//  Shared memory ring so several processes can consume the data of one
+//  serial device. The process owning the SerialPort publishes received
+//  bytes into a POSIX shared memory ring (ShmRingWriter); any number of
+//  other processes attach read-only (ShmRingReader), each with its own
+//  cursor kept on its side, so readers never write to the ring and never
+//  slow the owner down. A reader that falls more than a ring behind
+//  loses the overwritten bytes and is told how many.
+//
+//  Memory layout, for readers written in other languages (eg Python
+//  mmap + struct), all fields little endian on the usual hosts:
+//    offset  0: uint32 magic (SHM_RING_MAGIC)
+//    offset  4: uint32 version (SHM_RING_VERSION)
+//    offset  8: uint64 capacity in bytes (power of 2)
+//    offset 64: uint64 reserve position (bytes claimed by the writer)
+//    offset 128: uint64 commit position (bytes fully written)
+//    offset 192: data, byte at stream position p is at data[p % capacity]
+//  A reader copies [cursor, commit) and then checks that reserve is no
+//  more than capacity ahead of where it started, otherwise that part was
+//  overwritten while it was copying.
+//
+//  macOS / Linux only.
+//
+
+#pragma once
+
+#include "serial_port.h"
+
+#if defined(__APPLE__) || defined(__linux__)
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstddef>
+
+#define SHM_RING_MAGIC   0x53524E47     // "SRNG"
+#define SHM_RING_VERSION 1
+
+// Lives at the start of the shared memory object
+struct ShmRingHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    alignas(64) std::atomic<uint64_t> reserve_pos;  // Bumped before copying data in
+    alignas(64) std::atomic<uint64_t> commit_pos;   // Bumped once the data is in
+    alignas(64) uint8_t data[1];
+};
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+              "ShmRing needs lock free 64 bit atomics to share them between processes");
+
+// Owner side, the only writer of the ring
+class ShmRingWriter
+{
+public:
+    ShmRingWriter();
+    ~ShmRingWriter();
+
+    int create(const std::string _name, uint64_t _capacity);       // Create (or replace) the ring
+    int publish(const uint8_t *buf, int len);                       // Append bytes
+    int publish_from(SerialPort &port);                             // Read from port straight into the ring
+    void destroy();                                                 // Unmap and remove the ring
+
+private:
+    std::string name;
+    ShmRingHeader *header;
+    size_t map_size;
+};
+
+// Consumer side, attaches read-only
+class ShmRingReader
+{
+public:
+    ShmRingReader();
+    ~ShmRingReader();
+
+    int attach(const std::string name, bool from_oldest = false);  // Map an existing ring
+    int read(uint8_t *buf, int max_size, int timeout_ms = 0);      // Read new bytes
+    unsigned long long lost() const { return lost_bytes; }         // Bytes overwritten before read
+    void detach();
+
+private:
+    const ShmRingHeader *header;
+    size_t map_size;
+    uint64_t cursor;
+    unsigned long long lost_bytes;
+};
+
+#endif
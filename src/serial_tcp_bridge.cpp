@@ -0,0 +1,99 @@
+//
+// serial_tcp_bridge.cpp
+//
+// Bridge daemon exposing serial devices on local TCP ports (like ser2net),
+// built on serial_bridge.h. Each device gets its own TCP port; connect to
+// it with telnet, nc, or any tool that talks TCP, and bytes are forwarded
+// both ways. Per connection throughput is printed every 5 seconds.
+//
+// Usage: serial_tcp_bridge [-b bind_address] device:baud:tcp_port [...]
+//   eg:  serial_tcp_bridge /dev/ttyACM0:115200:7000 /dev/ttyUSB0:9600:7001
+//
+// bind_address defaults to 127.0.0.1, use 0.0.0.0 to accept remote
+// connections. Exit with Ctrl+C.
+//
+
+#include "serial_port.h"
+#include "serial_bridge.h"
+
+#include <csignal>		// So std::signal can work
+#include <memory>
+
+volatile std::sig_atomic_t quit = 0;
+
+// Ctrl+C handler function
+void sig_handler(int) {
+    quit = 1;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string bind_address = "127.0.0.1";
+    std::vector<std::string> specs;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "-b" && i + 1 < argc)
+            bind_address = argv[++i];
+        else
+            specs.push_back(arg);
+    }
+    if (specs.empty()) {
+        std::cout << "Usage: " << argv[0] <<
+            " [-b bind_address] device:baud:tcp_port [...]" << std::endl;
+        return 0;
+    }
+
+    SerialBridge bridge(bind_address);
+    std::vector<std::unique_ptr<SerialPort>> ports;
+
+    for (const std::string &spec : specs)
+    {
+        size_t c2 = spec.rfind(':');
+        size_t c1 = (c2 == std::string::npos || c2 == 0) ?
+            std::string::npos : spec.rfind(':', c2 - 1);
+        if (c1 == std::string::npos) {
+            std::cout << "Bad device spec: " << spec << std::endl;
+            return 1;
+        }
+        std::string device = spec.substr(0, c1);
+        int baud = std::stoi(spec.substr(c1 + 1, c2 - c1 - 1));
+        int tcp_port = std::stoi(spec.substr(c2 + 1));
+
+        ports.push_back(std::unique_ptr<SerialPort>(new SerialPort()));
+        if (ports.back()->open_port(device, baud) < 0) {
+            std::cout << "Couldn't open " << device << std::endl;
+            return 1;
+        }
+        if (bridge.add_device(*ports.back(), device, tcp_port) < 0)
+            return 1;
+        std::cout << device << " on " << bind_address << ":" << tcp_port << std::endl;
+    }
+
+    std::signal(SIGINT, sig_handler);
+    std::signal(SIGPIPE, SIG_IGN);		// Client disconnects show up as write errors
+
+    auto last_report = std::chrono::steady_clock::now();
+    while (!quit)
+    {
+        if (bridge.run_once(500) < 0)
+            break;
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - last_report >= std::chrono::seconds(5)) {
+            last_report = now;
+            for (const BridgeStats &st : bridge.stats())
+            {
+                if (!st.connected)
+                    continue;
+                std::cout << st.device << " :" << st.tcp_port <<
+                    "  to client " << st.to_client << " B (" << st.to_client_rate << " B/s)" <<
+                    "  to device " << st.to_device << " B (" << st.to_device_rate << " B/s)" <<
+                    std::endl;
+            }
+        }
+    }
+
+    return 0;
+}
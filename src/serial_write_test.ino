@@ -21,7 +21,8 @@ void setup() {
   // Initialize the LED pin. If not using the built-in LED, change pin accordingly
   pinMode(LED_BUILTIN, OUTPUT);
   
-  delay(1000);
+  // Tell the host we're up, instead of making it wait a fixed delay
+  Serial.println("READY");
 }
 
 void loop() {
@@ -0,0 +1,197 @@
+//
+// test_serial_aggregate.cpp
+//
+// Checks StreamAggregator (serial_aggregate.h) against brute force, no
+// hardware needed for the first part.
+//
+//  1. windows: 8 channels at 5kHz for 20s (noisy sines, with a missing
+//     value now and then) go through push_block() in one call, for
+//     100ms tumbling windows and 1s windows sliding by 100ms. Every
+//     window emitted is recomputed from the raw samples it covers: the
+//     counts, min and max must match exactly, mean and RMS to rounding.
+//     The same records through push() one at a time must give the same
+//     number of windows, and both rates are printed.
+//  2. text stream: a thread plays a device on a pseudo terminal sending
+//     CSV like lines with an empty field in them, read with feed().
+//     Every line's counter has to end up in the windows, and the empty
+//     field in none.
+//
+// Usage: test_serial_aggregate [channels] [rate_hz] [secs]
+//   eg:  test_serial_aggregate 8 5000 20
+//
+// macOS/Linux only (uses openpty, link with -lutil on Linux).
+//
+
+#include "serial_port.h"
+#include "serial_aggregate.h"
+
+#include <thread>
+#include <random>
+#include <cmath>
+#if defined(__APPLE__)
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+#define TEXT_LINES 20000
+
+// Aggregates data (records x channels) with window_ms / hop_ms and
+// checks every window. Returns true if all of them match.
+static bool run(const std::vector<double> &data, int channels, long records,
+                SerialClock::duration period, int window_ms, int hop_ms)
+{
+    SerialClock::time_point t0 = SerialClock::time_point() + std::chrono::seconds(1000);
+    SerialClock::time_point after = t0 + period * records + std::chrono::seconds(5);
+
+    std::vector<AggregateWindow> got;
+    StreamAggregator block(channels, window_ms, hop_ms);
+    block.set_handler([&](const AggregateWindow &w) { got.push_back(w); });
+
+    auto start = std::chrono::steady_clock::now();
+    block.push_block(t0, period, data.data(), static_cast<int>(records));
+    block.flush(after);
+    double block_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    StreamAggregator single(channels, window_ms, hop_ms);
+    start = std::chrono::steady_clock::now();
+    for(long r = 0; r < records; r++)
+        single.push(t0 + period * r, &data[r * channels]);
+    single.flush(after);
+    double single_secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Brute force over the records each window covers
+    long bad = 0;
+    double max_err = 0;
+    for(const AggregateWindow &w : got)
+    {
+        long r0 = std::max<long>(0, (w.start - t0) / period);
+        long r1 = std::min<long>(records, (w.end - t0) / period);
+
+        for(int c = 0; c < channels; c++)
+        {
+            double sum = 0, sumsq = 0, lo = INFINITY, hi = -INFINITY;
+            unsigned long n = 0;
+            for(long r = r0; r < r1; r++)
+            {
+                double x = data[r * channels + c];
+                if(std::isnan(x))
+                    continue;
+                sum += x;
+                sumsq += x * x;
+                lo = std::min(lo, x);
+                hi = std::max(hi, x);
+                n++;
+            }
+            if(n != w.count[c] || lo != w.min[c] || hi != w.max[c]) {
+                bad++;
+                continue;
+            }
+            max_err = std::max(max_err, std::fabs(sum / n - w.mean[c]));
+            max_err = std::max(max_err, std::fabs(sqrt(sumsq / n) - w.rms[c]));
+        }
+    }
+
+    bool ok = !got.empty() && bad == 0 && max_err < 1e-6 && single.windows() == got.size();
+    printf("%-8s %4d/%3d ms: %s, %zu windows (%lu through push()), %ld mismatched, max error %.2g, "
+           "push_block() %.0f M values/s, push() %.0f M values/s\n",
+           window_ms == hop_ms ? "tumbling" : "sliding", window_ms, hop_ms, ok ? "ok" : "FAILED",
+           got.size(), single.windows(), bad, max_err,
+           records * channels / block_secs / 1e6, records * channels / single_secs / 1e6);
+    return ok;
+}
+
+// Feeds CSV like lines from a simulated device through feed()
+static bool run_text()
+{
+    int master, slave;
+    char name[128];
+    if(openpty(&master, &slave, name, NULL, NULL) < 0) {
+        std::cerr << "openpty failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+    struct termios t;
+    tcgetattr(master, &t);
+    cfmakeraw(&t);
+    tcsetattr(master, TCSANOW, &t);
+
+    SerialPort port;
+    if(port.open_port(name, 115200, 100) < 0)
+        return false;
+
+    // "T=20.30,H=40.0,<counter>,,<-counter>": the fourth field is empty
+    std::thread dev([&] {
+        std::string out;
+        for(int r = 0; r < TEXT_LINES; r++)
+        {
+            char line[128];
+            snprintf(line, sizeof(line), "T=%.2f,H=%.1f,%d,,%d\r\n", 20 + r % 10 * 0.1, 40.0, r, -r);
+            out += line;
+            if(out.size() > 4000 || r == TEXT_LINES - 1) {
+                if(write(master, out.data(), out.size()) < 0)
+                    return;
+                out.clear();
+                std::this_thread::sleep_for(std::chrono::microseconds(800));
+            }
+        }
+    });
+
+    StreamAggregator agg(5, 100);
+    unsigned long samples = 0, empty = 0;
+    double sum = 0;
+    agg.set_handler([&](const AggregateWindow &w) {
+        samples += w.count[2];
+        sum += w.mean[2] * w.count[2];
+        empty += w.count[3];
+    });
+
+    long lines = 0;
+    auto start = std::chrono::steady_clock::now();
+    while(lines < TEXT_LINES && agg.feed(port) >= 0)
+        lines++;
+    agg.flush(SerialClock::now() + std::chrono::seconds(1));
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    dev.join();
+
+    // Counter 0 .. TEXT_LINES - 1 sums to n(n-1)/2
+    double expect = static_cast<double>(TEXT_LINES) * (TEXT_LINES - 1) / 2;
+    bool ok = lines == TEXT_LINES && samples == TEXT_LINES && empty == 0 && std::fabs(sum - expect) < 1;
+    printf("text stream:       %s, %ld lines in %.2f s, %lu windows, %lu samples, %lu in the empty field\n",
+           ok ? "ok" : "FAILED", lines, secs, agg.windows(), samples, empty);
+
+    port.sclose();
+    close(slave);
+    close(master);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    int channels = argc > 1 ? atoi(argv[1]) : 8;
+    int rate = argc > 2 ? atoi(argv[2]) : 5000;
+    int secs = argc > 3 ? atoi(argv[3]) : 20;
+    long records = static_cast<long>(rate) * secs;
+
+    std::mt19937 rng(1);
+    std::normal_distribution<double> noise;
+    std::vector<double> data(records * channels);
+    for(long r = 0; r < records; r++)
+    {
+        for(int c = 0; c < channels; c++)
+        {
+            if(r % 997 == 0 && c == channels / 2)
+                data[r * channels + c] = NAN;       // Missing value
+            else
+                data[r * channels + c] = sin(r * 0.001 * (c + 1)) * 100 + noise(rng);
+        }
+    }
+    printf("%d channels at %d Hz for %d s\n", channels, rate, secs);
+
+    SerialClock::duration period = std::chrono::duration_cast<SerialClock::duration>(
+        std::chrono::duration<double>(1.0 / rate));
+    bool tumbling_ok = run(data, channels, records, period, 100, 100);
+    bool sliding_ok = run(data, channels, records, period, 1000, 100);
+    bool text_ok = run_text();
+
+    return (tumbling_ok && sliding_ok && text_ok) ? 0 : 1;
+}
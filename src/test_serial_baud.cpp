@@ -0,0 +1,248 @@
+//
+// test_serial_baud.cpp
+//
+// Runs detect_baud() against an emulated UART on a pseudo terminal, no
+// hardware needed. A pty has no line, so a thread plays the device and
+// the UART in between: the device sends NMEA style text at its own
+// rate, filling load of the line, and the thread samples that bit
+// stream the way a receiver running at the host's current termios
+// speed would (start bit edge, 8 data bits, stop bit), marking framing
+// errors with 0xFF 0x00 while PARMRK is set, like the line discipline
+// does. At the right speed the text comes through as is.
+//
+// Each device rate is detected from the port opened at 9600, and the
+// line read after detection must be one the device sent.
+//
+// Usage: test_serial_baud [load]
+//   eg:  test_serial_baud 0.3     (default runs 1.0 and 0.3)
+//
+// macOS/Linux only (uses openpty, link with -lutil on Linux).
+//
+
+#include "serial_port.h"
+
+#include <thread>
+#include <atomic>
+#include <cmath>
+#if defined(__APPLE__)
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+static const char *device_text =
+    "$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*47\r\n"
+    "T=23.51 H=40.2 P=1013.2\r\n";
+
+static const int device_bauds[] = {115200, 9600, 57600, 2000000, 4800, 460800, 38400};
+
+// Numeric rate of a termios speed, 0 if not one detect_baud() tries
+static int speed_to_baud(speed_t speed)
+{
+    static const int rates[] = {4800, 9600, 14400, 19200, 28800, 38400, 57600, 115200, 230400,
+                                250000, 460800, 500000, 921600, 1000000, 1500000, 2000000};
+    for(int rate : rates)
+    {
+        if(baud_to_speed(rate) != 0 && baud_to_speed(rate) == speed)
+            return rate;
+    }
+    return 0;
+}
+
+// The device and its line: character c of the text starts at c * period
+class SimUart
+{
+public:
+    SimUart(int _master, int _baud, double load)
+    {
+        master = _master;
+        bit = 1.0 / _baud;
+        period = 10 * bit / load;
+        text_len = static_cast<long>(strlen(device_text));
+        quit = false;
+    }
+
+    void start() { dev = std::thread(&SimUart::run, this); }
+    void stop() { quit = true; dev.join(); }
+
+private:
+    // Line level at time x (s): start bit 0, data LSB first, stop / idle 1
+    int level(double x) const
+    {
+        long c = static_cast<long>(floor(x / period));
+        int b = static_cast<int>(floor((x - c * period) / bit));
+        if(b == 0)
+            return 0;
+        if(b >= 9)
+            return 1;
+        return (device_text[c % text_len] >> (b - 1)) & 1;
+    }
+
+    // Samples the line from t to now at host_baud, appending what a UART
+    // would receive to out. Returns the time sampled up to.
+    double receive(double t, double now, int host_baud, bool mark, std::vector<uint8_t> &out) const
+    {
+        double host_bit = 1.0 / host_baud;
+        double step = host_bit / 16;
+
+        while(t + 10 * host_bit < now && out.size() < 4000)
+        {
+            // Next falling edge
+            int prev = this->level(t);
+            double x = t + step;
+            while(x < now && !(prev == 1 && this->level(x) == 0))
+            {
+                prev = this->level(x);
+                x += step;
+            }
+            if(x >= now)
+                return x;
+            if(this->level(x + host_bit / 2) != 0) {
+                t = x + step;           // Glitch, not a start bit
+                continue;
+            }
+
+            int v = 0;
+            for(int k = 0; k < 8; k++)
+                v |= this->level(x + host_bit * (1.5 + k)) << k;
+            bool framed = this->level(x + host_bit * 9.5) == 1;
+
+            if(!framed && mark) {
+                out.push_back(0xFF);        // PARMRK: 0xFF 0x00 before a bad character
+                out.push_back(0x00);
+            }
+            else if(framed && mark && v == 0xFF)
+                out.push_back(0xFF);        // PARMRK escapes a real 0xFF
+            out.push_back(static_cast<uint8_t>(v));
+            t = x + host_bit * 9.5;
+        }
+        return t;
+    }
+
+    void run()
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        double sampled = 0;
+        long next = -1;         // Next whole character at the right speed, -1 = from sampled
+        std::vector<uint8_t> out;
+
+        while(!quit)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+            double now = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+            // The host side's settings, as the line discipline sees them
+            struct termios t;
+            tcgetattr(master, &t);
+            bool mark = (t.c_iflag & PARMRK) && !(t.c_iflag & IGNPAR);
+            int host_baud = speed_to_baud(cfgetispeed(&t));
+            if(host_baud == 0) {
+                sampled = now;
+                next = -1;
+                continue;
+            }
+
+            out.clear();
+            if(host_baud == static_cast<int>(lround(1.0 / bit))) {
+                // Right speed: whole characters, as sent
+                if(next < 0)
+                    next = static_cast<long>(ceil(sampled / period));
+                long last = static_cast<long>(floor(now / period));
+                for(; next < last; next++)
+                    out.push_back(static_cast<uint8_t>(device_text[next % text_len]));
+                sampled = std::max(sampled, next * period);
+            }
+            else {
+                sampled = this->receive(sampled, now, host_baud, mark, out);
+                next = -1;
+            }
+
+            if(!out.empty() && write(master, out.data(), out.size()) < 0)
+                return;
+        }
+    }
+
+    int master;
+    double bit;             // Seconds per bit at the device's rate
+    double period;          // Seconds per character, idle time included
+    long text_len;
+    std::atomic<bool> quit;
+    std::thread dev;
+};
+
+// Detects every device rate at load. Returns the number detected right.
+static int run(double load)
+{
+    int right = 0;
+    double min_ms = 1e9, max_ms = 0;
+    printf("line load %.0f%%:\n", load * 100);
+
+    for(int baud : device_bauds)
+    {
+        int master, slave;
+        char name[128];
+        if(openpty(&master, &slave, name, NULL, NULL) < 0) {
+            std::cerr << "openpty failed: " << strerror(errno) << std::endl;
+            exit(1);
+        }
+        struct termios t;
+        tcgetattr(master, &t);
+        cfmakeraw(&t);
+        tcsetattr(master, TCSANOW, &t);
+
+        SerialPort port;
+        if(port.open_port(name, 9600, 100) < 0)
+            exit(1);
+
+        SimUart uart(master, baud, load);
+        uart.start();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        auto start = std::chrono::steady_clock::now();
+        int detected = port.detect_baud();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        // The first line may be cut, the second one must be whole
+        std::string line;
+        port.sreadline(line);
+        line.clear();
+        port.sreadline(line);
+        std::string text(device_text);
+        size_t second = text.find('\n') + 1;
+        bool line_ok = line == text.substr(0, second) || line == text.substr(second);
+        if(!line.empty() && line[line.size() - 1] == '\n')
+            line.erase(line.size() - 2);
+
+        bool ok = detected == baud && line_ok;
+        if(ok)
+            right++;
+        min_ms = std::min(min_ms, ms);
+        max_ms = std::max(max_ms, ms);
+        printf("  device %7d: %s, detected %7d in %4.0f ms, next line \"%s\"\n", baud,
+               ok ? "ok" : "FAILED", detected, ms, line.c_str());
+
+        uart.stop();
+        port.sclose();
+        close(slave);
+        close(master);
+    }
+
+    printf("  %d of %zu detected, %.0f-%.0f ms\n", right, sizeof(device_bauds) / sizeof(device_bauds[0]),
+           min_ms, max_ms);
+    return right;
+}
+
+int main(int argc, char **argv)
+{
+    int count = static_cast<int>(sizeof(device_bauds) / sizeof(device_bauds[0]));
+    bool ok;
+
+    if(argc > 1)
+        ok = run(atof(argv[1])) == count;
+    else {
+        ok = run(1.0) == count;
+        ok = run(0.3) == count && ok;
+    }
+
+    return ok ? 0 : 1;
+}
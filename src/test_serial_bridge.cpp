@@ -0,0 +1,245 @@
+//
+// test_serial_bridge.cpp
+//
+// File for testing serial_bridge.h without any hardware. A pseudo
+// terminal stands in for the device, reached through a symlink the way
+// /dev/serial/by-id/ paths are, and a TCP client connects to the bridge:
+//
+//  1. loopback: bytes go both ways, a block of data device -> client
+//     arrives intact
+//  2. client gone: the client resets the connection while the device
+//     keeps sending, the bridge must drop it without being killed by
+//     SIGPIPE (the test doesn't ignore it) and take the next client
+//  3. hangup: the pty master is closed (device unplugged), the client
+//     must see the connection close and the bridge must not spin on the
+//     dead tty
+//  4. reconnect: the symlink is pointed at a new pty (device plugged
+//     back), a new client must reach it through the same TCP port
+//
+// Usage: test_serial_bridge [tcp_port] [KB]
+//   eg:  test_serial_bridge 7100 1024
+//
+// macOS/Linux only (uses openpty, link with -lutil on Linux).
+//
+
+#include "serial_port.h"
+#include "serial_bridge.h"
+
+#include <thread>
+#include <atomic>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#if defined(__APPLE__)
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+#define GONE_ROUNDS 50
+
+static int open_pty(int &master, int &slave, std::string &name)
+{
+    char path[128];
+    if(openpty(&master, &slave, path, NULL, NULL) < 0)
+        return -1;
+
+    struct termios t;
+    tcgetattr(master, &t);
+    cfmakeraw(&t);
+    tcsetattr(master, TCSANOW, &t);
+    name = path;
+
+    return 0;
+}
+
+static int connect_client(int tcp_port)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(tcp_port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+    if(connect(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Reads exactly len bytes from fd, waiting up to timeout_ms for each
+// chunk. Returns bytes read, less on timeout or EOF.
+static int read_exact(int fd, uint8_t *buf, int len, int timeout_ms)
+{
+    int got = 0;
+    while(got < len)
+    {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if(poll(&pfd, 1, timeout_ms) <= 0)
+            break;
+        int n = static_cast<int>(read(fd, buf + got, len - got));
+        if(n <= 0)
+            break;
+        got += n;
+    }
+    return got;
+}
+
+// Sends a line each way and a block device -> client.
+// Returns true if everything arrived intact.
+static bool loopback(int master, int client, int size)
+{
+    const char up[] = "hello device\n";
+    const char down[] = "hello client\n";
+    uint8_t buf[32];
+
+    if(write(client, up, sizeof(up) - 1) < 0 ||
+       read_exact(master, buf, sizeof(up) - 1, 2000) != sizeof(up) - 1 ||
+       memcmp(buf, up, sizeof(up) - 1) != 0)
+        return false;
+    if(write(master, down, sizeof(down) - 1) < 0 ||
+       read_exact(client, buf, sizeof(down) - 1, 2000) != sizeof(down) - 1 ||
+       memcmp(buf, down, sizeof(down) - 1) != 0)
+        return false;
+
+    std::vector<uint8_t> data(size);
+    for(int i = 0; i < size; i++)
+        data[i] = static_cast<uint8_t>(i * 31 + (i >> 8));
+
+    std::thread device([&] {
+        int sent = 0;
+        while(sent < size)
+        {
+            int n = static_cast<int>(write(master, data.data() + sent, size - sent));
+            if(n > 0)
+                sent += n;
+            else if(n < 0 && errno != EAGAIN && errno != EINTR)
+                return;
+        }
+    });
+    std::vector<uint8_t> received(size);
+    int got = read_exact(client, received.data(), size, 2000);
+    device.join();
+
+    return got == size && received == data;
+}
+
+int main(int argc, char **argv)
+{
+    int tcp_port = argc > 1 ? atoi(argv[1]) : 7100;
+    int size = (argc > 2 ? atoi(argv[2]) : 1024) * 1024;
+
+    int master, slave;
+    std::string name;
+    if(open_pty(master, slave, name) < 0) {
+        std::cerr << "openpty failed: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    std::string link = "/tmp/test_serial_bridge." + std::to_string(getpid());
+    unlink(link.c_str());
+    if(symlink(name.c_str(), link.c_str()) < 0) {
+        std::cerr << "symlink failed: " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    SerialPort port;
+    SerialBridge bridge;
+    if(port.open_port(link, 115200) < 0 || bridge.add_device(port, link, tcp_port) < 0)
+        return 1;
+
+    std::atomic<bool> quit(false);
+    std::atomic<unsigned long> passes(0);
+    std::thread loop([&] {
+        while(!quit)
+        {
+            bridge.run_once(100);
+            passes++;
+        }
+    });
+
+    // 1. Loopback
+    int client = connect_client(tcp_port);
+    bool loop_ok = client != -1 && loopback(master, client, size);
+    std::cout << "loopback:  " << (loop_ok ? "ok" : "FAILED") << std::endl;
+
+    // 2. Client gone: clients reset (SO_LINGER 0) while the device streams to them
+    close(client);
+    std::atomic<bool> streaming(true);
+    std::thread device([&] {
+        uint8_t block[4096] = {0};
+        while(streaming)
+        {
+            struct pollfd out = {master, POLLOUT, 0};
+            if(poll(&out, 1, 10) > 0 && write(master, block, sizeof(block)) < 0 &&
+               errno != EAGAIN && errno != EINTR)
+                return;
+        }
+    });
+    int resets = 0;
+    for(int tries = 0; resets < GONE_ROUNDS && tries < 10 * GONE_ROUNDS; tries++)
+    {
+        // Turned away while the bridge hasn't noticed the last reset yet
+        uint8_t some[256];
+        client = connect_client(tcp_port);
+        if(client == -1 || read_exact(client, some, sizeof(some), 1000) != sizeof(some)) {
+            close(client);
+            continue;
+        }
+        struct linger reset = {1, 0};
+        setsockopt(client, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+        close(client);
+        resets++;
+    }
+    streaming = false;
+    device.join();
+
+    // What the device sent meanwhile is still in the tty, drain it first
+    uint8_t drain[4096];
+    client = connect_client(tcp_port);
+    while(read_exact(client, drain, sizeof(drain), 200) > 0)
+        ;
+    bool gone_ok = resets == GONE_ROUNDS && client != -1 && loopback(master, client, size);
+    std::cout << "gone:      " << (gone_ok ? "ok" : "FAILED") << ", " << resets <<
+        " clients reset mid-stream, the next one served" << std::endl;
+
+    // 3. Hangup: the client sees EOF, the loop idles while the device is gone
+    close(slave);
+    close(master);
+    uint8_t b;
+    struct pollfd pfd = {client, POLLIN, 0};
+    bool hup_ok = poll(&pfd, 1, 2000) > 0 && read(client, &b, 1) <= 0;
+    close(client);
+
+    unsigned long before = passes;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+    unsigned long idle = passes - before;
+    hup_ok = hup_ok && idle < 100;
+    std::cout << "hangup:    " << (hup_ok ? "ok" : "FAILED") << ", client closed, " <<
+        idle << " loop passes in 1s with the device gone" << std::endl;
+
+    // 4. Reconnect: the device comes back under the same path
+    if(open_pty(master, slave, name) < 0)
+        return 1;
+    unlink(link.c_str());
+    if(symlink(name.c_str(), link.c_str()) < 0)
+        return 1;
+
+    auto start = std::chrono::steady_clock::now();
+    client = connect_client(tcp_port);      // Waits in the backlog until the port is back
+    bool back_ok = client != -1 && loopback(master, client, size);
+    int ms = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count());
+    std::cout << "reconnect: " << (back_ok ? "ok" : "FAILED") << ", loopback through the new device after " <<
+        ms << " ms" << std::endl;
+
+    quit = true;
+    loop.join();
+    close(client);
+    close(slave);
+    close(master);
+    unlink(link.c_str());
+
+    return (loop_ok && gone_ok && hup_ok && back_ok) ? 0 : 1;
+}
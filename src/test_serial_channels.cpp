@@ -0,0 +1,211 @@
+//
+// test_serial_channels.cpp
+//
+// File for testing the fragment reassembly in serial_channels.h without
+// any hardware. Two pseudo terminals stand in for the two ends of a
+// serial link and a relay between them drops one frame out of every
+// drop_every, like a noisy line would once the CRC has thrown the frame
+// away. One ChannelLink sends multi-fragment messages on a bulk channel,
+// interleaved with short control messages, and the other checks that
+// every message it delivers is one that was sent, byte for byte. Lost
+// messages are expected; a spliced or truncated one is a failure.
+//
+// Before that, a FrameDecoder is fed line noise that COBS decodes to
+// more bytes than the largest frame (a long run of 0x01), which must be
+// dropped as one bad frame without writing past the decode buffer (run
+// it under -fsanitize=address to be sure), followed by a good frame.
+//
+// Usage: test_serial_channels [messages] [drop_every]
+//   eg:  test_serial_channels 2000 37
+//
+// macOS/Linux only (uses openpty, link with -lutil on Linux).
+//
+
+#include "serial_port.h"
+#include "serial_channels.h"
+
+#include <thread>
+#include <atomic>
+#if defined(__APPLE__)
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+#define CTL_CHANNEL 0
+#define BULK_CHANNEL 1
+
+// Copies frames from in_fd to out_fd, dropping every drop_every-th one
+static void relay(int in_fd, int out_fd, int drop_every,
+                  std::atomic<bool> &quit, std::atomic<unsigned long> &dropped)
+{
+    std::vector<uint8_t> frame;
+    unsigned long count = 0;
+    uint8_t buf[256];
+
+    while(!quit)
+    {
+        struct pollfd pfd = {in_fd, POLLIN, 0};
+        if(poll(&pfd, 1, 10) <= 0)
+            continue;
+
+        int n = static_cast<int>(read(in_fd, buf, sizeof(buf)));
+        for(int i = 0; i < n; i++)
+        {
+            frame.push_back(buf[i]);
+            if(buf[i] != FRAME_DELIMITER)
+                continue;
+
+            if(++count % drop_every == 0)
+                dropped++;
+            else if(write(out_fd, frame.data(), frame.size()) < 0)
+                return;
+            frame.clear();
+        }
+    }
+}
+
+static int open_pty(int &master, std::string &name)
+{
+    int slave;
+    char path[128];
+    if(openpty(&master, &slave, path, NULL, NULL) < 0)
+        return -1;
+
+    struct termios t;
+    tcgetattr(master, &t);
+    cfmakeraw(&t);
+    tcsetattr(master, TCSANOW, &t);
+    name = path;
+
+    return 0;   // Slave stays open so the master never sees a hangup
+}
+
+// Message i of a channel: its index, then a pattern derived from it.
+// Bulk messages span 1 to 5 fragments of 64 bytes.
+static std::vector<uint8_t> make_message(uint8_t channel, int i)
+{
+    int len = channel == CTL_CHANNEL ? 8 : 4 + (i * 53) % 300;
+    std::vector<uint8_t> msg(len);
+    for(int k = 0; k < 4; k++)
+        msg[k] = static_cast<uint8_t>(i >> (8 * k));
+    for(int k = 4; k < len; k++)
+        msg[k] = static_cast<uint8_t>(i * 7 + k * 13 + channel);
+    return msg;
+}
+
+// Returns true if msg is exactly one of the messages sent on channel
+static bool is_sent(uint8_t channel, const std::vector<uint8_t> &msg, int count)
+{
+    if(msg.size() < 4)
+        return false;
+    int i = msg[0] | (msg[1] << 8) | (msg[2] << 16) | (msg[3] << 24);
+    return i >= 0 && i < count && msg == make_message(channel, i);
+}
+
+// Feeds a FrameDecoder a run of 0x01 as long as it accepts, then a good
+// frame. Returns true if only the good frame is delivered.
+static bool noise_check()
+{
+    const int max_frame = 1024;
+    FrameDecoder decoder(max_frame);
+    int max_encoded = max_frame + 2 + (max_frame + 2) / 254 + 1;
+
+    std::vector<uint8_t> noise(max_encoded, 0x01);
+    noise.push_back(FRAME_DELIMITER);
+    std::vector<uint8_t> payload(max_frame, 0x55);
+    frame_encode(payload.data(), max_frame, noise);
+
+    int delivered = 0;
+    bool intact = false;
+    decoder.feed(noise.data(), static_cast<int>(noise.size()), [&](const uint8_t *buf, int len) {
+        delivered++;
+        intact = len == max_frame && std::vector<uint8_t>(buf, buf + len) == payload;
+    });
+
+    bool ok = delivered == 1 && intact && decoder.errors() == 1;
+    std::cout << "noise: " << (ok ? "ok" : "FAILED") << ", run of " << max_encoded <<
+        " 0x01 bytes dropped as " << decoder.errors() << " bad frame, next frame " <<
+        (intact ? "intact" : "LOST") << std::endl;
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    int messages = argc > 1 ? atoi(argv[1]) : 2000;
+    int drop_every = argc > 2 ? atoi(argv[2]) : 37;
+
+    bool noise_ok = noise_check();
+
+    int master_a, master_b;
+    std::string name_a, name_b;
+    if(open_pty(master_a, name_a) < 0 || open_pty(master_b, name_b) < 0) {
+        std::cerr << "openpty failed: " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    SerialPort port_a, port_b;
+    if(port_a.open_port(name_a, 115200, 1) < 0 || port_b.open_port(name_b, 115200, 1) < 0)
+        return 1;
+
+    ChannelLink sender(port_a, 64, 128);
+    ChannelLink receiver(port_b, 64, 128);
+    sender.add_channel(CTL_CHANNEL, 10);
+    sender.add_channel(BULK_CHANNEL, 0);
+    receiver.add_channel(CTL_CHANNEL, 10);
+    receiver.add_channel(BULK_CHANNEL, 0);
+
+    std::atomic<bool> quit(false);
+    std::atomic<unsigned long> dropped(0);
+    std::thread ab(relay, master_a, master_b, drop_every, std::ref(quit), std::ref(dropped));
+
+    int good[2] = {0, 0};
+    int bad[2] = {0, 0};
+    std::atomic<bool> sent(false);
+    std::thread rx([&] {
+        std::vector<uint8_t> msg;
+        auto idle = std::chrono::steady_clock::now();
+        while(!sent || std::chrono::steady_clock::now() - idle < std::chrono::milliseconds(500))
+        {
+            if(receiver.pump() > 0)
+                idle = std::chrono::steady_clock::now();
+            for(uint8_t ch = CTL_CHANNEL; ch <= BULK_CHANNEL; ch++)
+            {
+                while(receiver.receive(ch, msg) >= 0)
+                {
+                    if(is_sent(ch, msg, messages))
+                        good[ch]++;
+                    else
+                        bad[ch]++;
+                }
+            }
+        }
+    });
+
+    for(int i = 0; i < messages; i++)
+    {
+        std::vector<uint8_t> bulk = make_message(BULK_CHANNEL, i);
+        sender.send(BULK_CHANNEL, bulk.data(), static_cast<int>(bulk.size()));
+        if(i % 4 == 0) {
+            std::vector<uint8_t> ctl = make_message(CTL_CHANNEL, i / 4);
+            sender.send(CTL_CHANNEL, ctl.data(), static_cast<int>(ctl.size()));
+        }
+        sender.pump();
+    }
+    while(sender.tx_pending(CTL_CHANNEL) > 0 || sender.tx_pending(BULK_CHANNEL) > 0)
+        sender.pump();
+    sent = true;
+
+    rx.join();
+    quit = true;
+    ab.join();
+
+    std::cout << "dropped 1 frame in " << drop_every << " (" << dropped << " frames)" << std::endl;
+    std::cout << "  control: " << good[CTL_CHANNEL] << " of " << (messages + 3) / 4 <<
+        " delivered intact, " << bad[CTL_CHANNEL] << " damaged" << std::endl;
+    std::cout << "  bulk:    " << good[BULK_CHANNEL] << " of " << messages <<
+        " delivered intact, " << bad[BULK_CHANNEL] << " damaged" << std::endl;
+    std::cout << "  receiver reported " << receiver.errors() << " errors" << std::endl;
+
+    return (noise_ok && !bad[CTL_CHANNEL] && !bad[BULK_CHANNEL]) ? 0 : 1;
+}
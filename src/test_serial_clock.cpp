@@ -0,0 +1,189 @@
+//
+// test_serial_clock.cpp
+//
+// Checks receive timestamps and ClockSync (serial_clock.h) against a
+// simulated device on a pseudo terminal, no hardware needed.
+//
+//  1. clock sync: a thread plays a board whose micros() runs drift_ppm
+//     fast and starts 1.5s before it wraps around. It answers PING
+//     after an exponentially distributed delay (mean 300us) and holds
+//     the PONG back by another one, like USB polling and scheduling do,
+//     with a DATA line in front of it that ping() has to skip. After
+//     the pings, the drift estimate and the error of to_host() are
+//     compared with the simulated clock.
+//  2. timestamps: lines arrive in bursts of 10 and the reader spends
+//     1ms on each one. last_rx_time() keeps the time the burst came in;
+//     taking the time after sreadline() returns drifts by the work done
+//     on the lines before.
+//
+// Usage: test_serial_clock [drift_ppm] [pings]
+//   eg:  test_serial_clock 800 60
+//
+// macOS/Linux only (uses openpty, link with -lutil on Linux).
+//
+
+#include "serial_port.h"
+#include "serial_clock.h"
+
+#include <thread>
+#include <atomic>
+#include <random>
+#include <cmath>
+#if defined(__APPLE__)
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+#define SIM_JITTER_US 300.0     // Mean extra delay each way
+#define BURST_LINES 10
+#define BURSTS 20
+
+// The simulated board's micros(), drift_ppm fast and about to wrap
+class SimClock
+{
+public:
+    SimClock(double _drift_ppm)
+    {
+        drift_ppm = _drift_ppm;
+        base = SerialClock::now();
+        start_us = 4294967296.0 - 1.5e6;
+    }
+
+    uint32_t micros(SerialClock::time_point t) const
+    {
+        double host_us = std::chrono::duration<double, std::micro>(t - base).count();
+        return static_cast<uint32_t>(static_cast<uint64_t>(start_us + host_us * (1 + drift_ppm * 1e-6)));
+    }
+
+private:
+    double drift_ppm;
+    double start_us;
+    SerialClock::time_point base;
+};
+
+// Answers PING lines on master with "DATA" and "PONG <micros>" until quit
+static void device(int master, const SimClock &clock, std::atomic<bool> &quit)
+{
+    std::mt19937 rng(3);
+    std::exponential_distribution<double> jitter(1 / SIM_JITTER_US);
+    std::string line;
+    char c;
+
+    while(!quit)
+    {
+        struct pollfd pfd = {master, POLLIN, 0};
+        if(poll(&pfd, 1, 10) <= 0)
+            continue;
+        while(read(master, &c, 1) == 1)
+        {
+            line += c;
+            if(c != '\n')
+                continue;
+            if(line == "PING\n") {
+                std::this_thread::sleep_for(std::chrono::microseconds(static_cast<int>(jitter(rng))));
+                uint32_t now = clock.micros(SerialClock::now());
+                std::this_thread::sleep_for(std::chrono::microseconds(static_cast<int>(jitter(rng))));
+
+                std::string reply = "DATA 42\nPONG " + std::to_string(now) + "\n";
+                if(write(master, reply.data(), reply.size()) < 0)
+                    return;
+            }
+            line.clear();
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    double drift_ppm = argc > 1 ? atof(argv[1]) : 800;
+    int pings = argc > 2 ? atoi(argv[2]) : 60;
+
+    int master, slave;
+    char name[128];
+    if(openpty(&master, &slave, name, NULL, NULL) < 0) {
+        std::cerr << "openpty failed: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    struct termios t;
+    tcgetattr(master, &t);
+    cfmakeraw(&t);
+    tcsetattr(master, TCSANOW, &t);
+    fcntl(master, F_SETFL, O_NONBLOCK);
+
+    SerialPort port;
+    if(port.open_port(name, 115200, 5) < 0)
+        return 1;
+
+    // 1. Clock sync, across the wrap of the 32 bit counter
+    SimClock clock(drift_ppm);
+    std::atomic<bool> quit(false);
+    std::thread dev(device, master, std::cref(clock), std::ref(quit));
+
+    ClockSync sync;
+    int failed = 0;
+    for(int i = 0; i < pings; i++)
+    {
+        if(sync.ping(port, 100) < 0)
+            failed++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    quit = true;
+    dev.join();
+
+    auto probe = SerialClock::now();
+    double error_us = std::chrono::duration<double, std::micro>(sync.to_host(clock.micros(probe)) - probe).count();
+    bool sync_ok = failed == 0 && std::fabs(sync.drift_ppm() - drift_ppm) < 200 && std::fabs(error_us) < 500;
+    printf("clock sync: %s, drift %.0f ppm (simulated %.0f), to_host() error %.0f us, "
+           "uncertainty %.0f us, %d samples, %d pings failed\n",
+           sync_ok ? "ok" : "FAILED", sync.drift_ppm(), drift_ppm, error_us,
+           sync.uncertainty_us(), sync.samples(), failed);
+
+    // 2. Timestamps of lines that arrive together
+    std::vector<SerialClock::time_point> sent(BURSTS * BURST_LINES);
+    std::thread burst([&] {
+        std::string lines;
+        for(int k = 0; k < BURST_LINES; k++)
+            lines += "line 0123456789\n";
+        for(int b = 0; b < BURSTS; b++)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            auto now = SerialClock::now();
+            for(int k = 0; k < BURST_LINES; k++)
+                sent[b * BURST_LINES + k] = now;
+            if(write(master, lines.data(), lines.size()) < 0)
+                return;
+        }
+    });
+
+    double stamp_sum = 0, stamp_max = 0, after_sum = 0, after_max = 0;
+    int n = 0;
+    while(n < BURSTS * BURST_LINES)
+    {
+        std::string line;
+        if(port.sreadline(line) <= 0)
+            continue;
+        double stamp = std::chrono::duration<double, std::micro>(port.last_rx_time() - sent[n]).count();
+        double after = std::chrono::duration<double, std::micro>(SerialClock::now() - sent[n]).count();
+        stamp_sum += stamp;
+        stamp_max = std::max(stamp_max, stamp);
+        after_sum += after;
+        after_max = std::max(after_max, after);
+        n++;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));     // Work on the line
+    }
+    burst.join();
+
+    bool stamp_ok = stamp_max < 1000;
+    printf("timestamps: %s, bursts of %d lines, 1 ms of work per line\n", stamp_ok ? "ok" : "FAILED", BURST_LINES);
+    printf("  last_rx_time():        mean %6.0f us, max %6.0f us after the burst was sent\n",
+           stamp_sum / n, stamp_max);
+    printf("  now() after sreadline: mean %6.0f us, max %6.0f us\n", after_sum / n, after_max);
+
+    port.sclose();
+    close(slave);
+    close(master);
+
+    return (sync_ok && stamp_ok) ? 0 : 1;
+}
@@ -0,0 +1,106 @@
+//
+// test_serial_compress.cpp
+//
+// File for testing the delta compression in serial_compress.h, by
+// receiving compressed analog samples from the Arduino and reporting
+// the sample rate and the link capacity it works out to.
+//
+// Use the serial_compress_test.ino sketch in conjunction with this file.
+// That sketch sends blocks of delta encoded records in COBS + CRC16
+// frames. Look into its code for more details.
+// Exit program execution by pressing Ctrl+C.
+//
+
+#include "serial_port.h"
+#include "serial_devices.h"
+#include "serial_frame.h"
+#include "serial_compress.h"
+
+#include <csignal>		// So std::signal can work
+#include <chrono>
+
+#define CHANNELS 6      // Must match serial_compress_test.ino
+
+// Ctrl+C handler function
+void sig_handler(int s) {
+    printf("Caught signal %d\n", s);
+    exit(1);
+}
+
+int main()
+{
+    // Define the Ctrl+C handler function
+    std::signal(SIGINT, sig_handler);
+
+    SERIAL_PORT serial;
+    INTERFACE_CLASS enum_ports;
+
+    std::vector<SerialDevice> vec_ports;
+
+    // List available ports for user choice
+    vec_ports = enum_ports.GetDevices();
+
+    int i = 0;
+    for (SerialDevice dev : vec_ports)
+    {
+        PCOUT << i << " : " << dev.name << " - " << dev.calloutDevice << std::endl;
+        i++;
+    }
+    if (vec_ports.size() == 0) {
+        PCOUT << "No serial ports found on device. Quitting." << std::endl;
+        return 0;
+    }
+
+    // Ask user for serial port choice
+    std::cout << "Enter serial port index to connect to: ";
+    std::string p_str;
+    std::getline(std::cin, p_str);
+    int p = std::stoi(p_str);
+
+    int sres = serial.open_port(vec_ports.at(p).calloutDevice, 115200, 100);
+
+    if(sres < 0)
+        return 0;
+
+    FrameDecoder decoder;
+    std::vector<int32_t> values;
+    unsigned long samples = 0;
+    unsigned long wire_bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    while (1)		// At runtime, break loop execution with Ctrl+C
+    {
+        uint8_t buf[256];
+        int n = serial.sread(buf, sizeof(buf));
+        if(n <= 0)
+            continue;
+        wire_bytes += n;
+
+        decoder.feed(buf, n, [&](const uint8_t *block, int len) {
+            values.clear();
+            if(delta_decode(block, len, CHANNELS, values) > 0)
+                samples += values.size();
+        });
+
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if(secs < 2.0 || samples == 0)
+            continue;
+
+        // Last record received, then the rates. Bytes per sample on the
+        // wire (framing included) sets the sample rate each baud rate allows
+        double per_sample = static_cast<double>(wire_bytes) / samples;
+        for(int c = 0; c < CHANNELS; c++)
+            std::cout << values[values.size() - CHANNELS + c] << " ";
+        std::cout << "| " << static_cast<int>(samples / secs) << " samples/s, " <<
+            per_sample << " bytes/sample, " << decoder.errors() << " bad frames" << std::endl;
+        for(int baud : {9600, 57600, 115200})
+            std::cout << "  " << baud << " baud: up to " <<
+                static_cast<int>(baud / 10 / per_sample) << " samples/s" << std::endl;
+
+        samples = 0;
+        wire_bytes = 0;
+        start = std::chrono::steady_clock::now();
+    }
+
+    return 0;
+}
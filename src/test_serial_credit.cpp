@@ -0,0 +1,89 @@
+//
+// test_serial_credit.cpp
+//
+// File for testing the credit based flow control in serial_credit.h, by
+// streaming a block of data to the Arduino as fast as it can take it and
+// reading back the byte count it reports.
+//
+// Use the serial_credit_test.ino sketch in conjunction with this file. That
+// sketch grants credit as it consumes bytes and prints the total it got on
+// every '\n'. Look into its code for more details.
+//
+
+#include "serial_port.h"
+#include "serial_devices.h"
+#include "serial_credit.h"
+
+#include <csignal>		// So std::signal can work
+#include <chrono>
+
+// Ctrl+C handler function
+void sig_handler(int s) {
+    printf("Caught signal %d\n", s);
+    exit(1);
+}
+
+int main()
+{
+    // Define the Ctrl+C handler function
+    std::signal(SIGINT, sig_handler);
+
+    SERIAL_PORT serial;
+    INTERFACE_CLASS enum_ports;
+
+    std::vector<SerialDevice> vec_ports;
+
+    // List available ports for user choice
+    vec_ports = enum_ports.GetDevices();
+
+    int i = 0;
+    for (SerialDevice dev : vec_ports)
+    {
+        PCOUT << i << " : " << dev.name << " - " << dev.calloutDevice << std::endl;
+        i++;
+    }
+    if (vec_ports.size() == 0) {
+        PCOUT << "No serial ports found on device. Quitting." << std::endl;
+        return 0;
+    }
+
+    // Ask user for serial port choice and amount of data to stream
+    std::cout << "Enter serial port index to connect to: ";
+    std::string p_str;
+    std::getline(std::cin, p_str);
+    int p = std::stoi(p_str);
+
+    std::string size_str;
+    std::cout << "Enter the number of KB to stream: ";
+    std::getline(std::cin, size_str);
+    int size = std::stoi(size_str) * 1024;
+
+    // The sketch runs at 115200, read timeout doubles as credit poll interval
+    int sres = serial.open_port(vec_ports.at(p).calloutDevice, 115200, 10);
+
+    if(sres < 0)
+        return 0;
+
+    // Block of printable data, one line every 64 bytes
+    std::vector<uint8_t> data(size);
+    for(int j = 0; j < size; j++)
+        data[j] = (j % 64 == 63) ? '\n' : static_cast<uint8_t>('A' + j % 26);
+
+    CreditLink link(serial);
+
+    auto start = std::chrono::steady_clock::now();
+    int nout = link.send(data.data(), size, 5000);
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << "Sent: " << nout << " bytes in " << secs << " s (" <<
+        nout / secs << " bytes/s)" << std::endl;
+
+    // Print whatever the device reported back, trying several times
+    // as the sketch may still be working through its buffer
+    std::vector<uint8_t> vec_in;
+    for(int j = 0; j < 100; j++)
+        link.receive(vec_in);
+    std::cout << std::string(vec_in.begin(), vec_in.end()) << std::endl;
+
+    return 0;
+}
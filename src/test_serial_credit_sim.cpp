@@ -0,0 +1,228 @@
+//
+// test_serial_credit_sim.cpp
+//
+// Runs the credit based flow control in serial_credit.h against a
+// simulated serial_credit_test.ino, no hardware needed. A thread plays
+// the board on a pseudo terminal: a 64 byte receive ring (bytes that
+// arrive while it is full are lost, like a UART overrun), a sketch loop
+// that spends us_per_byte on each byte, grants credit back in batches
+// of 16 and prints "Received N bytes" on every '\n'.
+//
+// The same block is streamed twice: first with plain swrite(), which
+// overruns the ring, then through a CreditLink, which must get every
+// byte across intact and read the board's reports back with the
+// grants stripped.
+//
+// Usage: test_serial_credit_sim [KB] [us per byte]
+//   eg:  test_serial_credit_sim 64 100
+//
+// macOS/Linux only (uses openpty, link with -lutil on Linux).
+//
+
+#include "serial_port.h"
+#include "serial_credit.h"
+
+#include <thread>
+#include <atomic>
+#if defined(__APPLE__)
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+#define SIM_RX_BUFFER 64        // Same as the sketch's RX_BUFFER
+#define SIM_GRANT_BATCH 16      // Same as the sketch's GRANT_BATCH
+
+// The simulated board, see serial_credit_test.ino
+class SimBoard
+{
+public:
+    SimBoard(int _master, int _us_per_byte)
+    {
+        master = _master;
+        us_per_byte = _us_per_byte;
+        quit = false;
+        total = 0;
+        overruns = 0;
+        mismatches = 0;
+    }
+
+    void start() { board = std::thread(&SimBoard::run, this); }
+    void stop() { quit = true; board.join(); }
+
+    std::atomic<long> total;        // Bytes consumed by the sketch
+    std::atomic<long> overruns;     // Bytes lost to a full ring
+    std::atomic<long> mismatches;   // Bytes that weren't the expected ones
+
+private:
+    void send(const uint8_t *buf, int len)
+    {
+        while(len > 0)
+        {
+            int n = static_cast<int>(write(master, buf, len));
+            if(n < 0 && errno == EAGAIN) {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+                continue;           // Host isn't reading, like a full USB FIFO
+            }
+            if(n < 0)
+                return;
+            buf += n;
+            len -= n;
+        }
+    }
+
+    void grant(uint8_t n)
+    {
+        uint8_t g[2] = {CREDIT_MARKER, n};
+        this->send(g, 2);
+    }
+
+    void run()
+    {
+        uint8_t ring[SIM_RX_BUFFER];
+        int head = 0, count = 0;
+        int consumed = 0;
+        auto next = std::chrono::steady_clock::now();
+
+        this->grant(SIM_RX_BUFFER - 1);     // setup(): the ring holds one byte less than its size
+
+        while(!quit)
+        {
+            // Whatever the host sent lands in the ring, or is lost
+            uint8_t buf[256];
+            int n = static_cast<int>(read(master, buf, sizeof(buf)));
+            for(int i = 0; i < n; i++)
+            {
+                if(count == SIM_RX_BUFFER - 1)
+                    overruns++;
+                else
+                    ring[(head + count++) % SIM_RX_BUFFER] = buf[i];
+            }
+
+            if(count == 0) {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+                next = std::chrono::steady_clock::now();   // Idle, don't bank time
+                continue;
+            }
+
+            // loop(): one byte per us_per_byte on average
+            uint8_t b = ring[head];
+            head = (head + 1) % SIM_RX_BUFFER;
+            count--;
+            next += std::chrono::microseconds(us_per_byte);
+            std::this_thread::sleep_until(next);
+
+            uint8_t expected = (total % 64 == 63) ? '\n' : static_cast<uint8_t>('A' + total % 26);
+            if(b != expected)
+                mismatches++;
+            total++;
+            consumed++;
+            if(consumed >= SIM_GRANT_BATCH) {
+                this->grant(static_cast<uint8_t>(consumed));
+                consumed = 0;
+            }
+            if(b == '\n') {
+                std::string msg = "Received " + std::to_string(total) + " bytes\r\n";
+                this->send(reinterpret_cast<const uint8_t *>(msg.data()), static_cast<int>(msg.size()));
+            }
+        }
+    }
+
+    int master;
+    int us_per_byte;
+    std::atomic<bool> quit;
+    std::thread board;
+};
+
+static int open_pty(int &master, std::string &name)
+{
+    int slave;
+    char path[128];
+    if(openpty(&master, &slave, path, NULL, NULL) < 0)
+        return -1;
+
+    struct termios t;
+    tcgetattr(master, &t);
+    cfmakeraw(&t);
+    tcsetattr(master, TCSANOW, &t);
+    fcntl(master, F_SETFL, O_NONBLOCK);
+    name = path;
+
+    return 0;   // Slave stays open so the master never sees a hangup
+}
+
+int main(int argc, char **argv)
+{
+    int size = (argc > 1 ? atoi(argv[1]) : 64) * 1024;
+    int us_per_byte = argc > 2 ? atoi(argv[2]) : 100;
+
+    // Same block as test_serial_credit.cpp, one line every 64 bytes
+    std::vector<uint8_t> data(size);
+    for(int j = 0; j < size; j++)
+        data[j] = (j % 64 == 63) ? '\n' : static_cast<uint8_t>('A' + j % 26);
+
+    // Without flow control: the ring overruns
+    {
+        int master;
+        std::string name;
+        if(open_pty(master, name) < 0) {
+            std::cerr << "openpty failed: " << strerror(errno) << std::endl;
+            return 1;
+        }
+        SerialPort port;
+        if(port.open_port(name, 115200, 10) < 0)
+            return 1;
+
+        SimBoard board(master, us_per_byte);
+        board.start();
+        port.swrite(data.data(), size);
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        board.stop();
+
+        std::cout << "plain swrite: " << board.total << " of " << size << " bytes consumed, " <<
+            board.overruns << " lost to overruns" << std::endl;
+        port.sclose();
+        close(master);
+    }
+
+    // With credit: every byte gets through
+    int master;
+    std::string name;
+    if(open_pty(master, name) < 0)
+        return 1;
+    SerialPort port;
+    if(port.open_port(name, 115200, 10) < 0)
+        return 1;
+
+    SimBoard board(master, us_per_byte);
+    board.start();
+
+    CreditLink link(port);
+    auto start = std::chrono::steady_clock::now();
+    int nout = link.send(data.data(), size, 60000);
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // The last report comes after the sketch works through its ring
+    std::vector<uint8_t> vec_in;
+    std::string last = "Received " + std::to_string(size) + " bytes";
+    for(int j = 0; j < 200 && std::string(vec_in.begin(), vec_in.end()).find(last) == std::string::npos; j++)
+        link.receive(vec_in, 4096);
+    board.stop();
+
+    std::string reports(vec_in.begin(), vec_in.end());
+    bool reports_ok = reports.find(last) != std::string::npos &&
+                      reports.find(static_cast<char>(CREDIT_MARKER)) == std::string::npos;
+    bool ok = nout == size && board.total == size && board.overruns == 0 &&
+              board.mismatches == 0 && reports_ok;
+
+    std::cout << "CreditLink:   " << board.total << " of " << size << " bytes consumed, " <<
+        board.overruns << " lost to overruns, " << board.mismatches << " damaged, " <<
+        static_cast<int>(nout / secs) << " B/s (sketch limit " << 1000000 / std::max(1, us_per_byte) <<
+        " B/s)" << std::endl;
+    std::cout << "  reports " << (reports_ok ? "ok" : "MISSING") << ", last: \"" << last << "\"" << std::endl;
+
+    port.sclose();
+    close(master);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,154 @@
+//
+// test_serial_discovery.cpp
+//
+// Runs discover_devices() against simulated boards on pseudo terminals,
+// no hardware needed. Each board acts like an Arduino that resets when
+// the port is opened: from the first byte it receives it ignores input
+// for boot_ms plus 50ms per board (reset and bootloader), then answers
+// "ID?" with a line of boot noise and "ID <role>". One more port never
+// answers at all, so discovery runs into its deadline.
+//
+// Checks that every board is found on its own port, that discovery
+// returns at the deadline with every probe finished (so the ports can
+// be opened again right away), and compares the time taken with the
+// sum of the probe times, which is what probing one port after the
+// other would take.
+//
+// Usage: test_serial_discovery [boards] [boot_ms] [deadline_ms]
+//   eg:  test_serial_discovery 8 2500 4000
+//
+// macOS/Linux only (uses openpty, link with -lutil on Linux).
+//
+
+#include "serial_port.h"
+#include "serial_discovery.h"
+
+#include <thread>
+#include <atomic>
+#if defined(__APPLE__)
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+// Role of board i
+static std::string role(int i)
+{
+    return (i % 2 ? "sensor" : "motor") + std::to_string(i);
+}
+
+// One simulated board on master, see above. A silent board never answers.
+static void board(int master, int i, int boot_ms, bool silent, std::atomic<bool> &quit)
+{
+    bool reset = false;
+    std::chrono::steady_clock::time_point booted;
+    std::string in;
+    char buf[256];
+
+    while(!quit)
+    {
+        struct pollfd pfd = {master, POLLIN, 0};
+        if(poll(&pfd, 1, 10) <= 0)
+            continue;
+        int n = static_cast<int>(read(master, buf, sizeof(buf)));
+        if(n <= 0 || silent)
+            continue;
+
+        if(!reset) {
+            reset = true;
+            booted = std::chrono::steady_clock::now() + std::chrono::milliseconds(boot_ms + 50 * i);
+        }
+        if(std::chrono::steady_clock::now() < booted)
+            continue;           // The bootloader eats it
+
+        in.append(buf, n);
+        size_t pos;
+        while((pos = in.find('\n')) != std::string::npos)
+        {
+            if(in.compare(0, pos, "ID?") == 0) {
+                std::string reply = "boot noise\nID " + role(i) + "\r\n";
+                if(write(master, reply.data(), reply.size()) < 0)
+                    return;
+            }
+            in.erase(0, pos + 1);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int boards = argc > 1 ? atoi(argv[1]) : 8;
+    int boot_ms = argc > 2 ? atoi(argv[2]) : 2500;
+    int deadline_ms = argc > 3 ? atoi(argv[3]) : 4000;
+
+    std::vector<std::string> names;
+    std::vector<int> masters, slaves;
+    std::vector<std::thread> sims;
+    std::atomic<bool> quit(false);
+
+    for(int i = 0; i <= boards; i++)
+    {
+        int master, slave;
+        char name[128];
+        if(openpty(&master, &slave, name, NULL, NULL) < 0) {
+            std::cerr << "openpty failed: " << strerror(errno) << std::endl;
+            return 1;
+        }
+        struct termios t;
+        tcgetattr(master, &t);
+        cfmakeraw(&t);
+        tcsetattr(master, TCSANOW, &t);
+
+        names.push_back(name);
+        masters.push_back(master);
+        slaves.push_back(slave);
+        sims.emplace_back(board, master, i, boot_ms, i == boards, std::ref(quit));    // Last one is silent
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto found = discover_devices(names, 115200, identify_probe("ID?\n", "ID "), deadline_ms);
+    int ms = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count());
+
+    int right = 0, sum_ms = 0;
+    for(int i = 0; i < boards; i++)
+    {
+        auto it = found.find(role(i));
+        if(it != found.end() && it->second.port == names[i]) {
+            right++;
+            sum_ms += it->second.probe_ms;
+            printf("  %-8s on %s, probe took %d ms\n", it->first.c_str(), it->second.port.c_str(),
+                   it->second.probe_ms);
+        }
+    }
+    sum_ms += deadline_ms;      // The silent port, one by one it costs a full timeout
+
+    bool found_ok = right == boards && static_cast<int>(found.size()) == boards;
+    bool time_ok = ms < deadline_ms + 200;
+    printf("discovery: %s, %d of %d boards identified in %d ms (deadline %d ms, %s), "
+           "one port at a time would take about %d ms\n",
+           (found_ok && time_ok) ? "ok" : "FAILED", right, boards, ms, deadline_ms,
+           time_ok ? "met" : "MISSED", sum_ms);
+
+    // Every probe is done, the port is free to open and talk to now
+    bool reopen_ok = false;
+    if(found_ok) {
+        SerialPort port;
+        if(port.open_port(found[role(0)].port, 115200, 10) >= 0)
+            reopen_ok = identify_probe("ID?\n", "ID ")(port, 500) == role(0);
+        port.sclose();
+    }
+    printf("reopen:    %s, %s answers on %s right after discovery\n", reopen_ok ? "ok" : "FAILED",
+           role(0).c_str(), names[0].c_str());
+
+    quit = true;
+    for(std::thread &sim : sims)
+        sim.join();
+    for(size_t i = 0; i < masters.size(); i++)
+    {
+        close(slaves[i]);
+        close(masters[i]);
+    }
+
+    return (found_ok && time_ok && reopen_ok) ? 0 : 1;
+}
@@ -0,0 +1,302 @@
+//
+// test_serial_firmata.cpp
+//
+// Runs FirmataClient against a simulated StandardFirmata board on a
+// pseudo terminal, no hardware needed. The host queues the setup for
+// fast analog sampling (1ms interval, 6 analog pins reporting, a
+// firmware query) plus a burst of digital writes and sends it all with
+// one flush(). A thread plays the board: it parses what the host sent,
+// answers the firmware query and then streams analog samples on every
+// enabled channel, with a digital port report now and then, as fast as
+// the pty accepts them (far above any real board's rate) and in chunks
+// that split messages.
+//
+// The host checks that the setup arrived whole with the digital writes
+// collapsed into one port message, that every sample decodes to the
+// value sent, in order, and that the firmware name, version and last
+// digital state were picked up.
+//
+// Usage: test_serial_firmata [samples]
+//   eg:  test_serial_firmata 3000000
+//
+// macOS/Linux only (uses openpty, link with -lutil on Linux).
+//
+
+#include "serial_port.h"
+#include "serial_firmata.h"
+
+#include <thread>
+#include <atomic>
+#if defined(__APPLE__)
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+#define SIM_CHANNELS 6
+#define SIM_CHUNK 1021          // Odd size, so writes end inside messages
+
+// Sample k of analog channel ch
+static int sample_value(unsigned long k, int ch)
+{
+    return static_cast<int>((k + ch * 100) & 0x3FF);
+}
+
+// The simulated board: parses host messages, answers REPORT_FIRMWARE,
+// then streams samples
+class SimFirmata
+{
+public:
+    SimFirmata(int _master, long _samples)
+    {
+        master = _master;
+        samples = _samples;
+        interval = 0;
+        pin_modes = 0;
+        enabled = 0;
+        port0 = -1;
+        port_messages = 0;
+        host_bytes = 0;
+        last_port1 = 0;
+    }
+
+    void start() { board = std::thread(&SimFirmata::run, this); }
+    void join() { board.join(); }
+
+    // What the host's setup turned into, valid after join()
+    int interval;               // Sampling interval set, ms
+    int pin_modes;              // SET_PIN_MODE messages
+    int enabled;                // REPORT_ANALOG enabled channels, one bit each
+    int port0;                  // Last DIGITAL_MESSAGE for port 0, -1 if none
+    int port_messages;          // DIGITAL_MESSAGEs received
+    long host_bytes;
+    uint8_t last_port1;         // Last port 1 state streamed to the host
+
+private:
+    void send(const uint8_t *buf, size_t len)
+    {
+        size_t off = 0;
+        while(off < len)
+        {
+            ssize_t n = write(master, buf + off, len - off);
+            if(n > 0)
+                off += n;
+            else if(n < 0 && errno != EAGAIN && errno != EINTR)
+                return;
+        }
+    }
+
+    // Reads host messages until the firmware query, returns false on error
+    bool setup()
+    {
+        std::vector<uint8_t> in;
+        uint8_t buf[256];
+        size_t i = 0;
+
+        while(true)
+        {
+            ssize_t n = read(master, buf, sizeof(buf));
+            if(n <= 0)
+                return false;
+            in.insert(in.end(), buf, buf + n);
+            host_bytes += n;
+
+            while(i < in.size())
+            {
+                uint8_t b = in[i];
+                size_t need = (b == FIRMATA_START_SYSEX) ? 0 : ((b & 0xF0) == FIRMATA_REPORT_ANALOG ? 2 : 3);
+                if(b == FIRMATA_START_SYSEX) {
+                    size_t end = i;
+                    while(end < in.size() && in[end] != FIRMATA_END_SYSEX)
+                        end++;
+                    if(end == in.size())
+                        break;
+                    if(in[i + 1] == FIRMATA_SAMPLING_INTERVAL)
+                        interval = in[i + 2] | (in[i + 3] << 7);
+                    bool query = in[i + 1] == FIRMATA_REPORT_FIRMWARE;
+                    i = end + 1;
+                    if(query)
+                        return this->drain_setup(in, i);
+                    continue;
+                }
+                if(i + need > in.size())
+                    break;
+                if(b == FIRMATA_SET_PIN_MODE)
+                    pin_modes++;
+                else if((b & 0xF0) == FIRMATA_REPORT_ANALOG && in[i + 1])
+                    enabled |= 1 << (b & 0x0F);
+                else if((b & 0xF0) == FIRMATA_DIGITAL_MESSAGE) {
+                    port_messages++;
+                    if((b & 0x0F) == 0)
+                        port0 = in[i + 1] | (in[i + 2] << 7);
+                }
+                i += need;
+            }
+        }
+    }
+
+    // flush() queues port messages after the query, pick those up too
+    bool drain_setup(std::vector<uint8_t> &in, size_t i)
+    {
+        struct pollfd pfd = {master, POLLIN, 0};
+        while(poll(&pfd, 1, 50) > 0)
+        {
+            uint8_t buf[256];
+            ssize_t n = read(master, buf, sizeof(buf));
+            if(n <= 0)
+                break;
+            in.insert(in.end(), buf, buf + n);
+            host_bytes += n;
+        }
+        for(; i + 2 < in.size(); i += 3)
+        {
+            if((in[i] & 0xF0) != FIRMATA_DIGITAL_MESSAGE)
+                return false;
+            port_messages++;
+            if((in[i] & 0x0F) == 0)
+                port0 = in[i + 1] | (in[i + 2] << 7);
+        }
+        return true;
+    }
+
+    void run()
+    {
+        if(!this->setup())
+            return;
+
+        const uint8_t fw[] = {FIRMATA_START_SYSEX, FIRMATA_REPORT_FIRMWARE, 2, 5,
+                              'S', 0, 'i', 0, 'm', 0, FIRMATA_END_SYSEX};
+        this->send(fw, sizeof(fw));
+
+        std::vector<uint8_t> out;
+        long sent = 0;
+        for(unsigned long k = 0; sent < samples; k++)
+        {
+            for(int ch = 0; ch < SIM_CHANNELS && sent < samples; ch++)
+            {
+                if(!(enabled & (1 << ch)))
+                    continue;
+                int v = sample_value(k, ch);
+                out.push_back(static_cast<uint8_t>(FIRMATA_ANALOG_MESSAGE | ch));
+                out.push_back(static_cast<uint8_t>(v & 0x7F));
+                out.push_back(static_cast<uint8_t>(v >> 7));
+                sent++;
+            }
+            if(k % 50 == 0) {
+                last_port1 = static_cast<uint8_t>(k / 50);
+                out.push_back(FIRMATA_DIGITAL_MESSAGE | 1);
+                out.push_back(last_port1 & 0x7F);
+                out.push_back(last_port1 >> 7);
+            }
+            if(out.size() >= SIM_CHUNK) {
+                this->send(out.data(), SIM_CHUNK);
+                out.erase(out.begin(), out.begin() + SIM_CHUNK);
+            }
+        }
+        this->send(out.data(), out.size());
+    }
+
+    int master;
+    long samples;
+    std::thread board;
+};
+
+int main(int argc, char **argv)
+{
+    long samples = argc > 1 ? atol(argv[1]) : 3000000;
+
+    int master, slave;
+    char name[128];
+    if(openpty(&master, &slave, name, NULL, NULL) < 0) {
+        std::cerr << "openpty failed: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    struct termios t;
+    tcgetattr(master, &t);
+    cfmakeraw(&t);
+    tcsetattr(master, TCSANOW, &t);
+
+    SerialPort port;
+    if(port.open_port(name, 57600, 1) < 0)
+        return 1;
+
+    SimFirmata board(master, samples);
+    board.start();
+
+    // Setup for fast sampling plus digital writes that collapse into
+    // one port message, all in one write
+    FirmataClient firmata(port);
+    firmata.set_sampling_interval(1);
+    for(int ch = 0; ch < SIM_CHANNELS; ch++)
+    {
+        firmata.pin_mode(14 + ch, FIRMATA_ANALOG);
+        firmata.report_analog(ch, true);
+    }
+    firmata.query_firmware();
+    uint8_t port0 = 0;
+    for(int w = 0; w < 16; w++)
+    {
+        int pin = 2 + w % 6;
+        firmata.digital_write(pin, w & 1);
+        if(w & 1)
+            port0 |= static_cast<uint8_t>(1 << pin);
+        else
+            port0 &= static_cast<uint8_t>(~(1 << pin));
+    }
+    int setup_bytes = firmata.flush();
+
+    // Every sample, in order per channel
+    std::vector<unsigned long> next(SIM_CHANNELS, 0);
+    long decoded = 0, mismatches = 0;
+    firmata.set_analog_handler([&](int ch, int value) {
+        if(ch >= SIM_CHANNELS || value != sample_value(next[ch]++, ch))
+            mismatches++;
+        decoded++;
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    auto last = start;
+    long bytes = 0;
+    while(decoded < samples &&
+          std::chrono::steady_clock::now() - last < std::chrono::seconds(2))
+    {
+        int n = firmata.pump();
+        if(n == -1)
+            break;
+        if(n > 0) {
+            bytes += n;
+            last = std::chrono::steady_clock::now();
+        }
+    }
+    double secs = std::chrono::duration<double>(last - start).count();
+    board.join();
+
+    int port1 = 0;
+    for(int pin = 8; pin < 16; pin++)
+        port1 |= std::max(0, firmata.digital_read(pin)) << (pin - 8);
+
+    bool setup_ok = setup_bytes == board.host_bytes && board.interval == 1 &&
+                    board.pin_modes == SIM_CHANNELS && board.enabled == (1 << SIM_CHANNELS) - 1 &&
+                    board.port_messages == 1 && board.port0 == port0;
+    bool stream_ok = decoded == samples && mismatches == 0 && firmata.errors() == 0 &&
+                     firmata.firmware() == "Sim" && firmata.version_major() == 2 &&
+                     firmata.version_minor() == 5 && port1 == board.last_port1;
+
+    printf("setup:  %s, one %d byte write: interval %d ms, %d pin modes, channels 0x%02X, "
+           "16 digital writes as %d port message (0x%02X)\n",
+           setup_ok ? "ok" : "FAILED", setup_bytes, board.interval, board.pin_modes,
+           board.enabled, board.port_messages, board.port0 < 0 ? 0 : board.port0);
+    printf("stream: %s, %ld of %ld samples in %.2f s (%.1f M samples/s, %.0f MB/s), "
+           "%ld mismatched, %lu decode errors\n",
+           stream_ok ? "ok" : "FAILED", decoded, samples, secs, decoded / secs / 1e6,
+           bytes / secs / 1e6, mismatches, firmata.errors());
+    printf("        firmware \"%s\" %d.%d, port 1 = 0x%02X (last sent 0x%02X)\n",
+           firmata.firmware().c_str(), firmata.version_major(), firmata.version_minor(),
+           port1, board.last_port1);
+
+    port.sclose();
+    close(slave);
+    close(master);
+
+    return (setup_ok && stream_ok) ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+//
+// test_serial_flow.cpp
+//
+// Sustained bulk writes under XON/XOFF flow control, no hardware
+// needed. The port is opened with FlowControl::SOFTWARE on a pseudo
+// terminal and a thread plays a slow device on the other end: every
+// pause_every reads it sends XOFF, stops reading for pause_ms, then
+// sends XON. While it is held off the writer's output queue fills up,
+// which is where a plain write() comes back short.
+//
+// A block goes out through swrite() twice, as a buffer and as a
+// std::string, and the device checks every byte. Before that, one plain
+// write() of the same block shows how much the kernel takes in a single
+// call (the rest would be up to the caller to retry).
+//
+// Usage: test_serial_flow [KB] [pause_every] [pause_ms]
+//   eg:  test_serial_flow 1024 50 2
+//
+// macOS/Linux only (uses openpty, link with -lutil on Linux).
+//
+
+#include "serial_port.h"
+
+#include <thread>
+#include <atomic>
+#if defined(__APPLE__)
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+#define XON 0x11
+#define XOFF 0x13
+
+// Reads size bytes as the device, holding the writer off now and then.
+// Returns number of bytes that didn't match data.
+static long device(int master, const std::vector<uint8_t> &data, int pause_every, int pause_ms,
+                   std::atomic<size_t> &got)
+{
+    const uint8_t xoff = XOFF, xon = XON;
+    uint8_t buf[4096];
+    long bad = 0;
+    int reads = 0;
+
+    while(got < data.size())
+    {
+        if(++reads % pause_every == 0) {
+            if(write(master, &xoff, 1) < 0)
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(pause_ms));
+            if(write(master, &xon, 1) < 0)
+                break;
+        }
+
+        struct pollfd pfd = {master, POLLIN, 0};
+        if(poll(&pfd, 1, 2000) <= 0)
+            break;                  // Writer gave up
+        int n = static_cast<int>(read(master, buf, sizeof(buf)));
+        if(n <= 0)
+            break;
+        for(int i = 0; i < n && got + i < data.size(); i++)
+        {
+            if(buf[i] != data[got + i])
+                bad++;
+        }
+        got += n;
+    }
+
+    return bad;
+}
+
+// Streams data with write_fn while the device holds the writer off.
+// Returns true if every byte arrived intact.
+static bool run(const char *label, int master, const std::vector<uint8_t> &data,
+                int pause_every, int pause_ms, std::function<int()> write_fn)
+{
+    std::atomic<size_t> got(0);
+    long bad = 0;
+    std::thread dev([&] { bad = device(master, data, pause_every, pause_ms, got); });
+
+    auto start = std::chrono::steady_clock::now();
+    int w = write_fn();
+    dev.join();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    bool ok = w == static_cast<int>(data.size()) && got == data.size() && bad == 0;
+    printf("%-16s %s, returned %d, %zu of %zu bytes received, %ld damaged, %.1f MB/s\n",
+           label, ok ? "ok" : "FAILED", w, static_cast<size_t>(got), data.size(), bad,
+           data.size() / secs / 1e6);
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    int size = (argc > 1 ? atoi(argv[1]) : 1024) * 1024;
+    int pause_every = argc > 2 ? atoi(argv[2]) : 50;
+    int pause_ms = argc > 3 ? atoi(argv[3]) : 2;
+
+    int master, slave;
+    char name[128];
+    if(openpty(&master, &slave, name, NULL, NULL) < 0) {
+        std::cerr << "openpty failed: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    struct termios t;
+    tcgetattr(master, &t);
+    cfmakeraw(&t);
+    tcsetattr(master, TCSANOW, &t);
+
+    SerialPort port;
+    if(port.open_port(name, 115200, 10, FlowControl::SOFTWARE) < 0)
+        return 1;
+
+    // A link using XON/XOFF can't carry those two bytes as data
+    std::vector<uint8_t> data(size);
+    for(int i = 0; i < size; i++)
+    {
+        data[i] = static_cast<uint8_t>(i * 7 % 251);
+        if(data[i] == XON || data[i] == XOFF)
+            data[i] = ' ';
+    }
+
+    // One plain write() of the whole block: the rest was the caller's to retry
+    ssize_t once = write(port.get_fd(), data.data(), data.size());
+    printf("%-16s %zd of %zu bytes taken by one call\n", "plain write()", once, data.size());
+
+    // A pty hands output to the other side at once, drain it there
+    uint8_t drain[4096];
+    struct pollfd pfd = {master, POLLIN, 0};
+    while(poll(&pfd, 1, 100) > 0 && read(master, drain, sizeof(drain)) > 0)
+        ;
+
+    bool buf_ok = run("swrite(buffer)", master, data, pause_every, pause_ms, [&] {
+        return port.swrite(data.data(), size);
+    });
+    std::string str(data.begin(), data.end());
+    bool str_ok = run("swrite(string)", master, data, pause_every, pause_ms, [&] {
+        return port.swrite(str);
+    });
+
+    port.sclose();
+    close(slave);
+    close(master);
+
+    return (buf_ok && str_ok) ? 0 : 1;
+}
@@ -0,0 +1,110 @@
+//
+// test_serial_flush.cpp
+//
+// Reproduces the race the old 2 second sleep in sflush() was covering,
+// no hardware needed. A thread plays the device on a pseudo terminal:
+// when the flush starts it still has bytes on their way (like a USB
+// adapter holding a few ms of input) and keeps sending them for a few
+// ms, then sends a fresh line. Each flush variant is judged by the
+// first line read after it, which should be the fresh one:
+//
+//   tcflush          discards only what is queued at that instant
+//   sleep + tcflush  the old sflush(): clean, but always this slow
+//   sflush()         discards until the line goes quiet
+//
+// Usage: test_serial_flush [in flight ms] [old sleep ms]
+//   eg:  test_serial_flush 8 2000
+//
+// Output written before the flush is lost to TCOFLUSH only on real
+// UARTs; a pty passes it to the other side at once, so that half of
+// the race can't be shown here.
+//
+// macOS/Linux only (uses openpty, link with -lutil on Linux).
+//
+
+#include "serial_port.h"
+
+#include <thread>
+#if defined(__APPLE__)
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+// Runs one flush variant while the device still has input in flight.
+// Returns true if the first line read afterwards is the fresh one.
+static bool run(const char *label, SerialPort &port, int master, int in_flight_ms,
+                std::function<void()> flush)
+{
+    std::thread device([&] {
+        auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(in_flight_ms);
+        while(std::chrono::steady_clock::now() < end)
+        {
+            if(write(master, "stale", 5) < 0)
+                return;
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::microseconds(500));
+
+    auto start = std::chrono::steady_clock::now();
+    flush();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    device.join();
+    if(write(master, "fresh\n", 6) < 0)
+        return false;
+
+    std::string line;
+    port.sreadline(line);
+    bool clean = (line == "fresh\n");
+    if(!line.empty() && line[line.size() - 1] == '\n')
+        line.erase(line.size() - 1);
+
+    printf("%-16s %7.1f ms, first line after it: \"%s\" %s\n", label, ms, line.c_str(),
+           clean ? "" : "(STALE)");
+
+    // Leave nothing behind for the next variant
+    line.clear();
+    port.sflush();
+
+    return clean;
+}
+
+int main(int argc, char **argv)
+{
+    int in_flight_ms = argc > 1 ? atoi(argv[1]) : 8;
+    int old_sleep_ms = argc > 2 ? atoi(argv[2]) : 2000;
+
+    int master, slave;
+    char name[128];
+    if(openpty(&master, &slave, name, NULL, NULL) < 0) {
+        std::cerr << "openpty failed: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    struct termios t;
+    tcgetattr(master, &t);
+    cfmakeraw(&t);
+    tcsetattr(master, TCSANOW, &t);
+
+    SerialPort port;
+    if(port.open_port(name, 115200, 100) < 0)
+        return 1;
+
+    run("tcflush", port, master, in_flight_ms, [&] {
+        tcflush(port.get_fd(), TCIOFLUSH);
+    });
+    bool old_ok = run("sleep + tcflush", port, master, in_flight_ms, [&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(old_sleep_ms));
+        tcflush(port.get_fd(), TCIOFLUSH);
+    });
+    bool new_ok = run("sflush()", port, master, in_flight_ms, [&] {
+        port.sflush();
+    });
+
+    port.sclose();
+    close(slave);
+    close(master);
+
+    return (old_ok && new_ok) ? 0 : 1;
+}
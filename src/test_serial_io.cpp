@@ -63,6 +63,11 @@ int main()
     
     if(sres < 0)
         return 0;
+
+    // Opening the port resets most boards, wait for the sketch to boot
+    int ready_ms = serial.swait_ready("READY", 3000);
+    if(ready_ms >= 0)
+        std::cout << "Board ready after " << ready_ms << " ms" << std::endl;
     
     std::string out_str;
 	while(1)		// Type "quit" to exit loop
@@ -0,0 +1,145 @@
+//
+// test_serial_merge.cpp
+//
+// Simulation for serial_merge.h, no hardware (or pty) needed. 16
+// sources sample at 10kHz with +-20us of jitter and deliver their
+// samples in chunks of 10, each chunk after 0 to 20ms of random
+// transport delay (USB polling, scheduling), and a few samples are held
+// back by 200ms on top. The arrivals are replayed into a SampleMerger
+// in arrival order, with pop() seeing the arrival time as now.
+//
+// Checks that every sample comes out exactly once, either in time
+// order or through the late handler, that only the held back samples
+// are late when the window covers the transport delay, and that the
+// aligned sets come out at their rate. A second run with a window
+// below the transport delay shows what happens then: most samples end
+// up late.
+//
+// Usage: test_serial_merge [window_ms] [short_window_ms]
+//   eg:  test_serial_merge 30 5
+//
+
+#include "serial_merge.h"
+
+#include <random>
+#include <set>
+#include <algorithm>
+
+#define SOURCES 16
+#define SAMPLES 200000          // Per source, 20s at 10kHz
+#define PERIOD_US 100
+#define CHUNK 10
+#define MAX_DELAY_US 20000
+#define HELD_BACK 100
+#define ALIGN_HZ 1000.0
+
+struct Arrival
+{
+    SerialClock::time_point at;
+    MergeSample sample;
+};
+
+// Builds the arrivals of all sources, sorted by arrival time
+static std::vector<Arrival> simulate(SerialClock::time_point t0, std::set<size_t> &held)
+{
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<double> jitter(-20, 20);
+    std::uniform_real_distribution<double> delay(0, MAX_DELAY_US);
+    std::vector<Arrival> arrivals;
+    arrivals.reserve(SOURCES * SAMPLES);
+
+    for(int s = 0; s < SOURCES; s++)
+    {
+        double arrive_us = 0;
+        for(int i = 0; i < SAMPLES; i++)
+        {
+            double t_us = (i + 1) * PERIOD_US;
+            if(i % CHUNK == 0)          // Chunk complete after CHUNK - 1 more samples, plus transport
+                arrive_us = std::max(arrive_us, t_us + (CHUNK - 1) * PERIOD_US + delay(rng));
+
+            Arrival a;
+            a.at = t0 + std::chrono::microseconds(static_cast<long>(arrive_us));
+            a.sample.time = t0 + std::chrono::microseconds(static_cast<long>(t_us + jitter(rng)));
+            a.sample.source = s;
+            a.sample.value = i;
+            arrivals.push_back(a);
+        }
+    }
+
+    while(held.size() < HELD_BACK)
+        held.insert(rng() % arrivals.size());
+    for(size_t k : held)
+        arrivals[k].at += std::chrono::milliseconds(200);
+
+    std::stable_sort(arrivals.begin(), arrivals.end(), [](const Arrival &a, const Arrival &b) {
+        return a.at < b.at;
+    });
+    return arrivals;
+}
+
+// Replays arrivals through a merger with a window of window_ms.
+// Returns true if every sample came out once, in order or late.
+static bool run(const std::vector<Arrival> &arrivals, int window_ms, unsigned long &late)
+{
+    SampleMerger merger(SOURCES, window_ms);
+
+    size_t sets = 0;
+    merger.set_alignment(ALIGN_HZ, [&](SerialClock::time_point, const std::vector<double> &values) {
+        if(values.size() == SOURCES)
+            sets++;
+    });
+    unsigned long handled = 0;
+    merger.set_late_handler([&](const MergeSample &) { handled++; });
+
+    size_t out = 0, disorder = 0;
+    MergeSample sample;
+    SerialClock::time_point last;
+    auto take = [&]() {
+        if(out > 0 && sample.time < last)
+            disorder++;
+        last = sample.time;
+        out++;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for(const Arrival &a : arrivals)
+    {
+        merger.push(a.sample);
+        while(merger.pop(sample, a.at) > 0)
+            take();
+    }
+    while(merger.finish(sample) > 0)
+        take();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    late = merger.late_count();
+    bool ok = out + late == arrivals.size() && disorder == 0 && handled == late;
+    printf("window %2d ms: %s, %zu of %zu samples out in order, %lu late, %zu out of order, "
+           "%zu aligned sets, %.1f M samples/s\n",
+           window_ms, ok ? "ok" : "FAILED", out, arrivals.size(), late, disorder, sets,
+           arrivals.size() / secs / 1e6);
+
+    return ok;
+}
+
+int main(int argc, char **argv)
+{
+    int window_ms = argc > 1 ? atoi(argv[1]) : 30;
+    int short_window_ms = argc > 2 ? atoi(argv[2]) : 5;
+
+    std::set<size_t> held;
+    std::vector<Arrival> arrivals = simulate(SerialClock::now(), held);
+    printf("%d sources at %d Hz, chunks of %d, 0-%d ms transport delay, %d samples held back 200 ms\n",
+           SOURCES, 1000000 / PERIOD_US, CHUNK, MAX_DELAY_US / 1000, HELD_BACK);
+
+    // Wide enough: only the held back samples are late, sets at ALIGN_HZ
+    unsigned long late;
+    bool ok = run(arrivals, window_ms, late);
+    ok = ok && late == HELD_BACK;
+
+    // Too short for the transport delay: still in order, but mostly late
+    unsigned long short_late;
+    bool short_ok = run(arrivals, short_window_ms, short_late);
+
+    return (ok && short_ok) ? 0 : 1;
+}
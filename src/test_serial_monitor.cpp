@@ -60,6 +60,17 @@ int main()
 	// Attempt to open the selected port
 	int sres = serial.open_port(vec_ports.at(p).calloutDevice, baud);
 
+#if defined(__APPLE__)
+	// Survive cable glitches: reopen the board, following it by USB
+	// serial number in case it comes back on another tty
+	uint32_t serial_number = vec_ports.at(p).parent.serialNumber;
+	serial.set_reconnect(true, 5000);
+	if (serial_number != 0)
+		serial.set_device_locator([&]() {
+			return enum_ports.FindBySerialNumber(serial_number);
+		});
+#endif
+
     if(sres != -1)		// Open succeed, read the incoming lines
     {
 		std::string read_str;
@@ -0,0 +1,172 @@
+//
+// test_serial_monitor_rate.cpp
+//
+// Drives serial_monitor at line rate, no hardware needed. Each port is
+// a pseudo terminal with a writer pacing numbered 64 byte lines onto it
+// at bytes_per_s (1ms ticks), the monitor (run as a child process) reads
+// all of them and writes to one file. After secs the monitor is stopped
+// with SIGINT like Ctrl+C would, and the file is checked: every line of
+// every port has to be there once, in order, under its port's label.
+// The CPU time the monitor used is printed along with the load.
+//
+// Usage: test_serial_monitor_rate [monitor] [ports] [bytes_per_s] [secs]
+//   eg:  test_serial_monitor_rate ./serial_monitor 8 100000 5
+//
+// macOS/Linux only (uses openpty, link with -lutil on Linux).
+//
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#if defined(__APPLE__)
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+// Label of port i, as given to the monitor
+static std::string label(int i)
+{
+    return "p" + std::to_string(i);
+}
+
+int main(int argc, char **argv)
+{
+    std::string monitor = argc > 1 ? argv[1] : "./serial_monitor";
+    int ports = argc > 2 ? atoi(argv[2]) : 8;
+    long rate = argc > 3 ? atol(argv[3]) : 100000;
+    int secs = argc > 4 ? atoi(argv[4]) : 5;
+
+    char out_path[] = "/tmp/test_serial_monitor_XXXXXX";
+    int out_fd = mkstemp(out_path);
+    if(out_fd < 0) {
+        std::cerr << "mkstemp failed: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    close(out_fd);
+
+    std::vector<int> masters(ports), slaves(ports);
+    std::vector<std::string> args = {monitor, "-T", "-i", "0", "-o", out_path};
+    for(int i = 0; i < ports; i++)
+    {
+        char name[128];
+        if(openpty(&masters[i], &slaves[i], name, NULL, NULL) < 0) {
+            std::cerr << "openpty failed: " << strerror(errno) << std::endl;
+            return 1;
+        }
+        struct termios t;
+        tcgetattr(masters[i], &t);
+        cfmakeraw(&t);
+        tcsetattr(masters[i], TCSANOW, &t);
+        args.push_back(std::string(name) + ":1000000:" + label(i));
+    }
+
+    pid_t pid = fork();
+    if(pid == 0) {
+        std::vector<char *> argp;
+        for(std::string &arg : args)
+            argp.push_back(&arg[0]);
+        argp.push_back(NULL);
+        execv(monitor.c_str(), argp.data());
+        std::cerr << "Couldn't run " << monitor << ": " << strerror(errno) << std::endl;
+        _exit(1);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));     // Ports opened
+
+    // Paced writers, all ports from this thread
+    std::vector<long> lines(ports, 0), sent(ports, 0);
+    long stalls = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto tick = start;
+    while(std::chrono::steady_clock::now() - start < std::chrono::seconds(secs))
+    {
+        tick += std::chrono::milliseconds(1);
+        std::this_thread::sleep_until(tick);
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        for(int i = 0; i < ports; i++)
+        {
+            std::string out;
+            while(sent[i] + static_cast<long>(out.size()) < elapsed * rate)
+            {
+                char line[80];
+                snprintf(line, sizeof(line), "seq %08ld abcdefghijklmnopqrstuvwxyz0123456789ABCDEFGHIJKLMNOPQRS\n",
+                         lines[i]++);
+                out += line;
+            }
+            size_t done = 0;
+            while(done < out.size())
+            {
+                ssize_t w = write(masters[i], out.data() + done, out.size() - done);
+                if(w > 0)
+                    done += w;
+                else {
+                    stalls++;       // Monitor behind, the pty is full
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                }
+            }
+            sent[i] += out.size();
+        }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));     // Let it catch up
+
+    kill(pid, SIGINT);
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    double cpu = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+                 (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+
+    // "<label padded> | seq <n> ...", numbered from 0 on every port
+    std::vector<long> expect(ports, 0);
+    long total = 0, bad = 0;
+    std::ifstream file(out_path);
+    std::string line;
+    while(std::getline(file, line))
+    {
+        size_t bar = line.find(" | seq ");
+        std::string name = line.substr(0, std::min(bar, line.find(' ')));
+        int i = (name.size() > 1 && name[0] == 'p') ? atoi(name.c_str() + 1) : -1;
+        if(bar == std::string::npos || i < 0 || i >= ports || name != label(i) ||
+           atol(line.c_str() + bar + 7) != expect[i]) {
+            bad++;
+            continue;
+        }
+        expect[i]++;
+        total++;
+    }
+    unlink(out_path);
+
+    long want = 0, bytes = 0;
+    for(int i = 0; i < ports; i++)
+    {
+        want += lines[i];
+        bytes += sent[i];
+    }
+
+    bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 && total == want && bad == 0;
+    printf("%d ports x %ld B/s for %d s: %s, %ld of %ld lines in order, %ld out of place, "
+           "%.1f MB sent, monitor CPU %.2f s (%.1f%%), writer stalls %ld\n",
+           ports, rate, secs, ok ? "ok" : "FAILED", total, want, bad, bytes / 1e6, cpu,
+           100 * cpu / (secs + 0.6), stalls);
+
+    for(int i = 0; i < ports; i++)
+    {
+        close(slaves[i]);
+        close(masters[i]);
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,109 @@
+//
+// test_serial_portset.cpp
+//
+// Benchmark for serial_portset.h, no hardware needed. Opens N pseudo
+// terminals, a thread writes a chunk to each of them every millisecond
+// (like N boards streaming at once) and the main thread reads them all
+// through a PortSet, first with io_uring, then with poll(). Reports the
+// system calls and CPU time the reading thread spent per MB.
+//
+// Usage: test_serial_portset [ports] [chunk bytes] [seconds]
+//   eg:  test_serial_portset 128 64 3
+//
+// Linux only (io_uring, RUSAGE_THREAD; link with -lutil).
+//
+
+#include "serial_port.h"
+#include "serial_portset.h"
+
+#include <pty.h>
+#include <sys/resource.h>
+#include <thread>
+
+static double thread_cpu_seconds()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_THREAD, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static void run(bool use_uring, int nports, int chunk, int seconds)
+{
+    std::vector<int> masters(nports);
+    std::vector<SerialPort> ports(nports);
+    PortSet set(use_uring);
+
+    for(int i = 0; i < nports; i++)
+    {
+        int slave;
+        char name[128];
+        if(openpty(&masters[i], &slave, name, NULL, NULL) < 0) {
+            std::cerr << "openpty failed: " << strerror(errno) << std::endl;
+            exit(1);
+        }
+        struct termios t;
+        tcgetattr(masters[i], &t);
+        cfmakeraw(&t);
+        tcsetattr(masters[i], TCSANOW, &t);
+        ports[i].open_port(name, 115200);
+        set.add(ports[i]);
+    }
+
+    // The devices: a chunk on every port each millisecond
+    std::atomic<bool> quit(false);
+    std::thread devices([&] {
+        std::vector<uint8_t> data(chunk, 'x');
+        auto next = std::chrono::steady_clock::now();
+        while(!quit)
+        {
+            for(int i = 0; i < nports; i++)
+            {
+                if(write(masters[i], data.data(), chunk) < 0)
+                    return;
+            }
+            next += std::chrono::milliseconds(1);
+            std::this_thread::sleep_until(next);
+        }
+    });
+
+    unsigned long long bytes = 0;
+    auto on_data = [&](int, const uint8_t *, int len, SerialClock::time_point) {
+        if(len > 0)
+            bytes += len;
+    };
+
+    set.wait(0, on_data);           // Set up the backend before measuring
+    unsigned long calls = set.syscalls();
+    bytes = 0;
+    double cpu = thread_cpu_seconds();
+    auto start = std::chrono::steady_clock::now();
+
+    while(std::chrono::steady_clock::now() - start < std::chrono::seconds(seconds))
+        set.wait(100, on_data);
+
+    cpu = thread_cpu_seconds() - cpu;
+    calls = set.syscalls() - calls;
+    quit = true;
+    devices.join();
+    for(int m : masters)
+        close(m);
+
+    double mb = bytes / 1e6;
+    std::cout << (set.backend() == PortSetBackend::IO_URING ? "io_uring" : "poll    ") <<
+        "  " << nports << " ports: " << mb << " MB, " <<
+        static_cast<long>(calls / mb) << " syscalls/MB, " <<
+        cpu * 1000 / mb << " ms CPU/MB" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+    int nports = argc > 1 ? atoi(argv[1]) : 128;
+    int chunk = argc > 2 ? atoi(argv[2]) : 64;
+    int seconds = argc > 3 ? atoi(argv[3]) : 3;
+
+    run(true, nports, chunk, seconds);
+    run(false, nports, chunk, seconds);
+
+    return 0;
+}
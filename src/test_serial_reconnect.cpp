@@ -0,0 +1,190 @@
+//
+// test_serial_reconnect.cpp
+//
+// Unplugs and replugs a device under a port with reconnect enabled, no
+// hardware needed. A pseudo terminal stands in for the device, reached
+// through a symlink the way /dev/serial/by-id/ paths are. A reader
+// thread sits in sreadline() the whole time.
+//
+// The device is removed (symlink gone, pty closed) and a line is
+// written while it is away. It comes back plug_ms later on a new pty
+// under the same path, then:
+//  - the reader has to pick up the device's first line within
+//    reconnect_timeout of the device being removed
+//  - reconnect_count() has to have moved by exactly one, although the
+//    reader and the writer both ran into the dead port
+//  - with keep_pending_writes, the line written while the device was
+//    away has to reach the new device, ahead of the next one
+//
+// Usage: test_serial_reconnect [plug_ms] [reconnect_timeout_ms]
+//   eg:  test_serial_reconnect 300 2000
+//
+// macOS/Linux only (uses openpty, link with -lutil on Linux).
+//
+
+#include "serial_port.h"
+
+#include <thread>
+#include <atomic>
+#if defined(__APPLE__)
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+static int open_pty(int &master, int &slave, std::string &name)
+{
+    char path[128];
+    if(openpty(&master, &slave, path, NULL, NULL) < 0)
+        return -1;
+
+    struct termios t;
+    tcgetattr(master, &t);
+    cfmakeraw(&t);
+    tcsetattr(master, TCSANOW, &t);
+    name = path;
+
+    return 0;
+}
+
+// Reads from master until want has come in or timeout_ms passes.
+// Returns what was read.
+static std::string read_for(int master, const std::string &want, int timeout_ms)
+{
+    std::string got;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    while(got.size() < want.size() && std::chrono::steady_clock::now() < deadline)
+    {
+        char buf[256];
+        struct pollfd pfd = {master, POLLIN, 0};
+        if(poll(&pfd, 1, 10) <= 0)
+            continue;
+        int n = static_cast<int>(read(master, buf, sizeof(buf)));
+        if(n > 0)
+            got.append(buf, n);
+    }
+    return got;
+}
+
+int main(int argc, char **argv)
+{
+    int plug_ms = argc > 1 ? atoi(argv[1]) : 300;
+    int reconnect_timeout = argc > 2 ? atoi(argv[2]) : 2000;
+
+    int master, slave;
+    std::string name;
+    if(open_pty(master, slave, name) < 0) {
+        std::cerr << "openpty failed: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    std::string link = "/tmp/test_serial_reconnect." + std::to_string(getpid());
+    unlink(link.c_str());
+    if(symlink(name.c_str(), link.c_str()) < 0) {
+        std::cerr << "symlink failed: " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    SerialPort port;
+    if(port.open_port(link, 115200, 50) < 0)
+        return 1;
+    port.set_reconnect(true, reconnect_timeout, true);
+    close(slave);
+
+    // The reader keeps the time each line came in
+    std::atomic<bool> quit(false);
+    std::vector<std::string> lines;
+    std::vector<std::chrono::steady_clock::time_point> times;
+    std::mutex lines_lock;
+    std::thread reader([&] {
+        std::string line;
+        while(!quit)
+        {
+            if(port.sreadline(line) <= 0)
+                continue;
+            if(line[line.size() - 1] != '\n')
+                continue;       // Rest still to come
+            std::lock_guard<std::mutex> guard(lines_lock);
+            lines.push_back(line);
+            times.push_back(std::chrono::steady_clock::now());
+            line.clear();
+        }
+    });
+    auto wait_line = [&](const std::string &want, int timeout_ms, std::chrono::steady_clock::time_point &at) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        while(std::chrono::steady_clock::now() < deadline)
+        {
+            {
+                std::lock_guard<std::mutex> guard(lines_lock);
+                for(size_t i = 0; i < lines.size(); i++)
+                {
+                    if(lines[i] == want) {
+                        at = times[i];
+                        return true;
+                    }
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return false;
+    };
+
+    std::chrono::steady_clock::time_point at;
+    bool before_ok = write(master, "before\n", 7) == 7 && wait_line("before\n", 1000, at);
+    int generation = port.reconnect_count();
+
+    // Unplug, and plug back in after plug_ms on a new pty
+    unlink(link.c_str());
+    close(master);
+    auto removed = std::chrono::steady_clock::now();
+    std::atomic<int> new_master(-1);
+    std::thread plug([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(plug_ms));
+        int m, s;
+        std::string path;
+        if(open_pty(m, s, path) < 0 || symlink(path.c_str(), link.c_str()) < 0)
+            return;
+        close(s);
+        new_master = m;
+    });
+
+    // Written while the device is away, held until it's back
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    int queued = port.swrite(std::string("queued\n"));
+    plug.join();
+    if(new_master < 0) {
+        std::cerr << "replug failed: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    master = new_master;
+
+    // The held back line reaches the new device, which then talks
+    std::string held = read_for(master, "queued\n", reconnect_timeout);
+    bool back_ok = write(master, "back\n", 5) == 5 && wait_line("back\n", reconnect_timeout, at);
+    int ms = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(at - removed).count());
+    back_ok = back_ok && ms < reconnect_timeout;
+    printf("resume:     %s, reader got the device's first line %d ms after it was removed "
+           "(back after %d ms, reconnect_timeout %d ms), last reconnect took %d ms\n",
+           back_ok ? "ok" : "FAILED", ms, plug_ms, reconnect_timeout, port.last_reconnect_ms());
+
+    int moved = port.reconnect_count() - generation;
+    bool gen_ok = before_ok && moved == 1;
+    printf("generation: %s, reconnect_count() moved by %d\n", gen_ok ? "ok" : "FAILED", moved);
+
+    port.swrite(std::string("after\n"));
+    std::string rest = read_for(master, "after\n", 1000);
+    std::string got = held + rest;
+    bool pending_ok = queued == 7 && got == "queued\nafter\n";
+    for(size_t pos = 0; (pos = got.find('\n', pos)) != std::string::npos; pos += 2)
+        got.replace(pos, 1, "\\n");
+    printf("pending:    %s, swrite() while away returned %d, new device got \"%s\"\n",
+           pending_ok ? "ok" : "FAILED", queued, got.c_str());
+
+    quit = true;
+    reader.join();
+    port.sclose();
+    close(master);
+    unlink(link.c_str());
+
+    return (back_ok && gen_ok && pending_ok) ? 0 : 1;
+}
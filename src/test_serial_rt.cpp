@@ -0,0 +1,114 @@
+//
+// test_serial_rt.cpp
+//
+// Example for serial_rt.h, no hardware needed. A thread writes a short
+// message to a pseudo terminal every millisecond, stamped with the time
+// it was written, while other threads keep every CPU busy. The port is
+// read through an RtReader, first with normal scheduling, then pinned
+// under SCHED_FIFO. Reports the reader's wake to deliver latency and the
+// write to read delay of the messages.
+//
+// Usage: test_serial_rt [seconds] [priority] [cpu]
+//   eg:  sudo test_serial_rt 5 80 0
+//
+// Linux only (link with -lutil).
+//
+
+#include "serial_port.h"
+#include "serial_rt.h"
+
+#include <pty.h>
+#include <algorithm>
+
+static void run(int seconds, int priority, int cpu)
+{
+    int master, slave;
+    char name[128];
+    if(openpty(&master, &slave, name, NULL, NULL) < 0) {
+        std::cerr << "openpty failed: " << strerror(errno) << std::endl;
+        exit(1);
+    }
+    struct termios t;
+    tcgetattr(master, &t);
+    cfmakeraw(&t);
+    tcsetattr(master, TCSANOW, &t);
+
+    SerialPort port;
+    port.open_port(name, 115200);
+
+    RtConfig config;
+    config.priority = priority;
+    config.cpu = cpu;
+    RtReader reader(port, config);
+
+    // Write to read delay, computed on the reader thread into a
+    // preallocated vector (no allocation there)
+    std::vector<long long> delays;
+    delays.reserve(seconds * 1000 + 1000);
+    reader.set_handler([&](const RtChunk &c) {
+        if(c.len == sizeof(long long) && delays.size() < delays.capacity()) {
+            long long sent;
+            memcpy(&sent, c.data, sizeof(sent));
+            delays.push_back(c.time.time_since_epoch().count() - sent);
+        }
+    });
+
+    std::string warnings;
+    reader.start(&warnings);
+    std::cout << (priority > 0 ? "SCHED_FIFO " : "normal scheduling ") <<
+        (warnings.empty() ? "" : "(running without: " + warnings.substr(0, warnings.size() - 1) + ")") << std::endl;
+
+    // Load: one busy thread per CPU
+    std::atomic<bool> quit(false);
+    std::vector<std::thread> load;
+    for(unsigned i = 0; i < std::max(1u, std::thread::hardware_concurrency()); i++)
+        load.emplace_back([&] { volatile unsigned long x = 0; while(!quit) x++; });
+
+    auto end = SerialClock::now() + std::chrono::seconds(seconds);
+    auto next = SerialClock::now();
+    while(SerialClock::now() < end)
+    {
+        next += std::chrono::milliseconds(1);
+        std::this_thread::sleep_until(next);
+        long long now = SerialClock::now().time_since_epoch().count();
+        if(write(master, &now, sizeof(now)) < 0)
+            break;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    quit = true;
+    for(auto &l : load)
+        l.join();
+    reader.stop();
+
+    RtLatency l = reader.latency();
+    std::cout << "  wake to deliver: " << l.count << " wakeups, p50 " << l.p50_us <<
+        " us, p99 " << l.p99_us << " us, p99.99 " << l.p9999_us << " us, max " <<
+        l.max_us << " us" << std::endl;
+
+    if(!delays.empty()) {
+        std::sort(delays.begin(), delays.end());
+        auto at = [&](double p) {
+            return delays[std::min(delays.size() - 1, static_cast<size_t>(p * delays.size()))] / 1000.0;
+        };
+        std::cout << "  write to read:   " << delays.size() << " messages, p50 " << at(0.5) <<
+            " us, p99 " << at(0.99) << " us, p99.99 " << at(0.9999) << " us, max " <<
+            delays.back() / 1000.0 << " us" << std::endl;
+    }
+
+    port.sclose();
+    close(master);
+    close(slave);
+}
+
+int main(int argc, char *argv[])
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 5;
+    int priority = argc > 2 ? atoi(argv[2]) : 80;
+    int cpu = argc > 3 ? atoi(argv[3]) : 0;
+
+    run(seconds, 0, -1);
+    run(seconds, priority, cpu);
+
+    return 0;
+}
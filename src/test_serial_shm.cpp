@@ -0,0 +1,300 @@
+//
+// test_serial_shm.cpp
+//
+// Benchmark for serial_shm.h, no hardware needed. One process stands in
+// for the owner of the serial port and hands a stream to several reader
+// processes, first through a ShmRingWriter (one copy into the ring, the
+// readers map it), then the way a socket relay would (one Unix socket
+// per reader, every byte written to each). Two loads:
+//
+//   throughput  MB of 4 KB blocks as fast as the readers keep up
+//   latency     8 byte timestamps at a steady rate, time until each
+//               reader has it
+//
+// Every reader checks each byte against its stream position, so a torn
+// or misplaced read shows up as damaged. Bytes a ring reader lost to
+// overwriting are reported apart (the ring never holds the writer up).
+//
+// Usage: test_serial_shm [readers] [MB] [messages]
+//   eg:  test_serial_shm 2 256 20000
+//
+// The writer line is the rate the stream was handed over at. The ring
+// never holds the writer up, so a reader that can't keep that pace
+// loses bytes instead; with fewer cores than readers + 1 the readers
+// share the writer's core and most of the stream is lost.
+//
+// macOS/Linux only (link with -lrt on older Linux).
+//
+
+#include "serial_port.h"
+#include "serial_shm.h"
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <algorithm>
+
+#define SHM_BENCH_NAME "/test_serial_shm"
+#define SHM_BENCH_BLOCK 4096
+
+static long long now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Byte at stream position p
+static uint8_t pattern(unsigned long long p)
+{
+    return static_cast<uint8_t>(p % 251);
+}
+
+// What a reader reports back to the parent
+struct ReaderResult
+{
+    unsigned long long got;
+    unsigned long long lost;
+    unsigned long long damaged;
+    double mean_ns;
+    double p99_ns;
+};
+
+// Source of the stream on the reader side: the ring or a socket.
+// Returns bytes read, < 0 once the stream has gone quiet or closed.
+typedef std::function<int(uint8_t *, int)> ReadFn;
+
+// Reader process body: reads total bytes (or timestamps if messages > 0)
+static ReaderResult consume(ReadFn read_fn, std::function<unsigned long long()> lost_fn,
+                            unsigned long long total, int messages)
+{
+    ReaderResult res = {0, 0, 0, 0, 0};
+    std::vector<uint8_t> buf(65536);
+    std::vector<long long> lat;
+    uint8_t partial[8];
+    int have = 0;
+
+    while(true)
+    {
+        unsigned long long lost = lost_fn();
+        if(messages > 0 ? lat.size() + lost / 8 >= static_cast<size_t>(messages)
+                        : res.got + lost >= total)
+            break;
+        int n = read_fn(buf.data(), static_cast<int>(buf.size()));
+        if(n < 0)
+            break;
+        long long t = now_ns();
+
+        if(messages == 0) {
+            unsigned long long pos = res.got + lost_fn();
+            for(int i = 0; i < n; i++)
+            {
+                if(buf[i] != pattern(pos + i))
+                    res.damaged++;
+            }
+        }
+        else {
+            for(int i = 0; i < n; i++)
+            {
+                partial[have++] = buf[i];
+                if(have == 8) {
+                    long long ts;
+                    memcpy(&ts, partial, 8);
+                    lat.push_back(t - ts);
+                    have = 0;
+                }
+            }
+        }
+        res.got += n;
+    }
+    res.lost = lost_fn();
+
+    if(!lat.empty()) {
+        std::sort(lat.begin(), lat.end());
+        double sum = 0;
+        for(long long l : lat)
+            sum += l;
+        res.mean_ns = sum / lat.size();
+        res.p99_ns = lat[lat.size() * 99 / 100];
+    }
+    return res;
+}
+
+// Forks a reader, which signals ready once set up and sends its result
+// back through a pipe. Returns the pipe's read end.
+static int spawn(std::function<ReaderResult(int ready_fd)> body, std::vector<pid_t> &pids)
+{
+    int p[2];
+    if(pipe(p) < 0)
+        exit(1);
+    pid_t pid = fork();
+    if(pid == 0) {
+        close(p[0]);
+        ReaderResult res = body(p[1]);
+        if(write(p[1], &res, sizeof(res)) < 0)
+            _exit(1);
+        _exit(0);
+    }
+    close(p[1]);
+    pids.push_back(pid);
+    return p[0];
+}
+
+static void wait_ready(const std::vector<int> &fds)
+{
+    for(int fd : fds)
+    {
+        char c;
+        if(read(fd, &c, 1) != 1)
+            exit(1);
+    }
+}
+
+// Collects the readers' results. Returns false if any reader saw damaged
+// bytes or came up short by more than it lost.
+static bool report(const char *label, const std::vector<int> &fds, std::vector<pid_t> &pids,
+                   double secs, unsigned long long total, bool latency)
+{
+    bool ok = true;
+    if(!latency)
+        printf("  %-7s writer:   %.0f MB/s\n", label, total / 1e6 / secs);
+
+    for(size_t i = 0; i < fds.size(); i++)
+    {
+        ReaderResult res;
+        if(read(fds[i], &res, sizeof(res)) != sizeof(res))
+            memset(&res, 0, sizeof(res));
+        close(fds[i]);
+        waitpid(pids[i], NULL, 0);
+
+        if(latency)
+            printf("  %-7s reader %zu: %llu msgs, mean %.1f us, p99 %.1f us, lost %llu\n",
+                   label, i, res.got / 8, res.mean_ns / 1000, res.p99_ns / 1000, res.lost / 8);
+        else
+            printf("  %-7s reader %zu: %.0f MB/s, %llu of %llu bytes, lost %llu, damaged %llu\n",
+                   label, i, res.got / 1e6 / secs, res.got, total, res.lost, res.damaged);
+
+        if(res.damaged > 0 || (!latency && res.got + res.lost < total))
+            ok = false;
+    }
+    pids.clear();
+
+    return ok;
+}
+
+// Writes the stream: total bytes of pattern, or messages timestamps
+// one every 20us, through publish
+static double produce(std::function<void(const uint8_t *, int)> publish,
+                      unsigned long long total, int messages)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    if(messages == 0) {
+        std::vector<uint8_t> src(SHM_BENCH_BLOCK + 251);
+        for(size_t i = 0; i < src.size(); i++)
+            src[i] = pattern(i);
+        for(unsigned long long pos = 0; pos < total; pos += SHM_BENCH_BLOCK)
+            publish(src.data() + pos % 251, SHM_BENCH_BLOCK);
+    }
+    else {
+        for(int i = 0; i < messages; i++)
+        {
+            long long due = now_ns() + 20000;
+            long long ts = now_ns();
+            publish(reinterpret_cast<const uint8_t *>(&ts), 8);
+            while(now_ns() < due)
+                sched_yield();
+        }
+    }
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool run_ring(int readers, unsigned long long total, int messages)
+{
+    ShmRingWriter ring;
+    if(ring.create(SHM_BENCH_NAME, 4 << 20) < 0)
+        exit(1);
+
+    std::vector<int> fds;
+    std::vector<pid_t> pids;
+    for(int r = 0; r < readers; r++)
+    {
+        fds.push_back(spawn([&](int ready_fd) {
+            ShmRingReader reader;
+            if(reader.attach(SHM_BENCH_NAME) < 0)
+                _exit(1);
+            if(write(ready_fd, "r", 1) < 0)
+                _exit(1);
+            return consume([&](uint8_t *buf, int len) { return reader.read(buf, len, 1000); },
+                           [&]() { return reader.lost(); }, total, messages);
+        }, pids));
+    }
+    wait_ready(fds);
+
+    double secs = produce([&](const uint8_t *buf, int len) { ring.publish(buf, len); }, total, messages);
+    bool ok = report("shm", fds, pids, secs, total, messages > 0);
+    ring.destroy();
+
+    return ok;
+}
+
+static bool run_socket(int readers, unsigned long long total, int messages)
+{
+    std::vector<int> socks;
+    std::vector<int> fds;
+    std::vector<pid_t> pids;
+    for(int r = 0; r < readers; r++)
+    {
+        int sv[2];
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+            exit(1);
+        fds.push_back(spawn([&](int ready_fd) {
+            close(sv[0]);
+            for(int s : socks)
+                close(s);
+            if(write(ready_fd, "r", 1) < 0)
+                _exit(1);
+            return consume([&](uint8_t *buf, int len) {
+                               int n = static_cast<int>(::read(sv[1], buf, len));
+                               return n > 0 ? n : -1;
+                           },
+                           []() { return 0ULL; }, total, messages);
+        }, pids));
+        close(sv[1]);
+        socks.push_back(sv[0]);
+    }
+    wait_ready(fds);
+
+    // The relay: every byte goes to every client
+    double secs = produce([&](const uint8_t *buf, int len) {
+        for(int s : socks)
+        {
+            for(int off = 0; off < len; )
+            {
+                ssize_t n = write(s, buf + off, len - off);
+                if(n <= 0)
+                    return;
+                off += static_cast<int>(n);
+            }
+        }
+    }, total, messages);
+    for(int s : socks)
+        close(s);
+    return report("socket", fds, pids, secs, total, messages > 0);
+}
+
+int main(int argc, char **argv)
+{
+    int readers = argc > 1 ? atoi(argv[1]) : 2;
+    unsigned long long total = (argc > 2 ? atoll(argv[2]) : 256) << 20;
+    int messages = argc > 3 ? atoi(argv[3]) : 20000;
+
+    printf("throughput, %d readers, %llu MB in %d byte blocks\n", readers, total >> 20, SHM_BENCH_BLOCK);
+    bool ok = run_ring(readers, total, 0);
+    ok = run_socket(readers, total, 0) && ok;
+
+    printf("latency, %d readers, %d timestamps 20 us apart\n", readers, messages);
+    ok = run_ring(readers, 0, messages) && ok;
+    ok = run_socket(readers, 0, messages) && ok;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+//
+// test_serial_static.cpp
+//
+// Benchmark for serial_port_static.h, no hardware needed. A thread
+// writes short CSV lines to a pseudo terminal as fast as it can while
+// the main thread reads them back line by line, first through the
+// runtime SerialPort, then through a BasicSerialPort. Reports lines per
+// second for each and checks that every line arrived intact.
+//
+// Also checks that flow control set through runtime() before opening is
+// applied to the port.
+//
+// Usage: test_serial_static [lines]
+//   eg:  test_serial_static 2000000
+//
+// Linux only (link with -lutil).
+//
+
+#include "serial_port.h"
+#include "serial_port_static.h"
+
+#include <pty.h>
+#include <thread>
+
+typedef SerialConfig<115200, 1024, Terminators<'\n'>> Config;
+
+static const char LINE[] = "1234,5678,9012,3456,7890,123456\n";     // 32 bytes
+
+static int open_pty(int &master, std::string &name)
+{
+    int slave;
+    char buf[128];
+    if(openpty(&master, &slave, buf, NULL, NULL) < 0) {
+        std::cerr << "openpty failed: " << strerror(errno) << std::endl;
+        exit(1);
+    }
+    struct termios t;
+    tcgetattr(master, &t);
+    cfmakeraw(&t);
+    tcsetattr(master, TCSANOW, &t);
+    name = buf;
+    return slave;
+}
+
+// Writes count lines to the master in large blocks
+static void write_lines(int master, int count)
+{
+    const int per_block = 256;
+    std::string block;
+    for(int i = 0; i < per_block; i++)
+        block += LINE;
+
+    for(int sent = 0; sent < count; sent += per_block)
+    {
+        int n = std::min(per_block, count - sent);
+        const char *p = block.data();
+        size_t left = n * (sizeof(LINE) - 1);
+        while(left > 0)
+        {
+            ssize_t w = write(master, p, left);
+            if(w < 0) {
+                if(errno == EINTR)
+                    continue;
+                return;
+            }
+            p += w;
+            left -= w;
+        }
+    }
+}
+
+// Reads count lines with read_line, returns lines per second (0 if a
+// line was lost or damaged)
+template <class ReadLine>
+static double run(int master, int count, ReadLine read_line)
+{
+    std::thread writer(write_lines, master, count);
+
+    std::string line;
+    int good = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < count; i++)
+    {
+        line.clear();
+        if(read_line(line) < 0)
+            break;
+        if(line == LINE)
+            good++;
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    writer.join();
+
+    if(good != count) {
+        std::cout << "  " << good << " of " << count << " lines intact" << std::endl;
+        return 0;
+    }
+    return count / secs;
+}
+
+int main(int argc, char *argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : 2000000;
+
+    int master;
+    std::string name;
+    int slave = open_pty(master, name);
+
+    SerialPort runtime_port(name, 115200, 1000);
+    double rt = run(master, count, [&](std::string &s) { return runtime_port.sreadline(s, 256); });
+    runtime_port.sclose();
+    std::cout << "SerialPort::sreadline         " << static_cast<long>(rt) << " lines/s" << std::endl;
+
+    BasicSerialPort<Config> static_port;
+    static_port.runtime().set_flow_control(FlowControl::HARDWARE);
+    static_port.open_port(name, 1000);
+
+    struct termios t;
+    tcgetattr(slave, &t);
+    bool flow_ok = (t.c_cflag & CRTSCTS) != 0;
+
+    double st = run(master, count, [&](std::string &s) { return static_port.sreadline(s); });
+    static_port.sclose();
+    std::cout << "BasicSerialPort::sreadline    " << static_cast<long>(st) << " lines/s" << std::endl;
+    std::cout << "flow control from runtime()   " << (flow_ok ? "applied" : "LOST") << std::endl;
+
+    close(slave);
+    close(master);
+
+    return (rt > 0 && st > 0 && flow_ok) ? 0 : 1;
+}
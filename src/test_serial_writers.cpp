@@ -0,0 +1,206 @@
+//
+// test_serial_writers.cpp
+//
+// Stress test for concurrent writers on one SerialPort, no hardware
+// needed. Several threads swrite() tagged messages to a pseudo terminal
+// at once, mostly short ones with a large one now and then, while a
+// peer thread reads the other end with pauses (so writes run into
+// backpressure and go out in pieces) and echoes everything back to a
+// reader thread using the same port. The peer and the reader check
+// that every message arrives whole, in order per writer, and never
+// mixed with another writer's bytes.
+//
+// The same load is run first through plain write() calls on the fd,
+// which do interleave under backpressure, to show what the check
+// catches.
+//
+// Usage: test_serial_writers [writers] [messages per writer]
+//   eg:  test_serial_writers 4 20000
+//
+// macOS/Linux only (uses openpty, link with -lutil on Linux).
+//
+
+#include "serial_port.h"
+
+#include <thread>
+#include <atomic>
+#include <map>
+#if defined(__APPLE__)
+#include <util.h>
+#else
+#include <pty.h>
+#endif
+
+// Message q of writer w: "W<w>:<q>:<len>:" then len times 'a' + w.
+// Every 50th one is larger than the pty buffer.
+static std::string make_message(int w, int q)
+{
+    int len = (q % 50 == 49) ? 6000 : 40;
+    return "W" + std::to_string(w) + ":" + std::to_string(q) + ":" +
+           std::to_string(len) + ":" + std::string(len, static_cast<char>('a' + w)) + "\n";
+}
+
+// Checks messages one line at a time, per writer order included
+class MessageCheck
+{
+public:
+    MessageCheck() { good = 0; bad = 0; }
+
+    void line(const std::string &l)
+    {
+        int w, q, len, n = 0;
+        if(sscanf(l.c_str(), "W%d:%d:%d:%n", &w, &q, &len, &n) != 3 || n == 0 ||
+           w < 0 || w > 25) {
+            bad++;
+            return;
+        }
+        bool in_order = (q == next[w]);
+        next[w] = q + 1;        // Resync, so one damaged line counts once
+
+        if(!in_order || l.size() != static_cast<size_t>(n + len + 1) ||
+           l.find_first_not_of(static_cast<char>('a' + w), n) != l.size() - 1)
+            bad++;
+        else
+            good++;
+    }
+
+    int good;
+    int bad;
+
+private:
+    std::map<int, int> next;
+};
+
+// Runs the load with write_msg doing the writes. Returns true if every
+// message arrived intact at the peer and back at the reader.
+static bool run(const char *label, int writers, int messages,
+                std::function<void(SerialPort &, const std::string &)> write_msg)
+{
+    int master, slave;
+    char name[128];
+    if(openpty(&master, &slave, name, NULL, NULL) < 0) {
+        std::cerr << "openpty failed: " << strerror(errno) << std::endl;
+        exit(1);
+    }
+    struct termios t;
+    tcgetattr(master, &t);
+    cfmakeraw(&t);
+    tcsetattr(master, TCSANOW, &t);
+
+    SerialPort port;
+    if(port.open_port(name, 115200, 20) < 0)
+        exit(1);
+
+    std::atomic<bool> writing(true);
+    auto quiet_for = [](std::chrono::steady_clock::time_point since) {
+        return std::chrono::steady_clock::now() - since > std::chrono::milliseconds(500);
+    };
+
+    // Peer: checks and echoes, pausing every 64 KB so writers block
+    MessageCheck at_peer;
+    std::thread peer([&] {
+        std::string acc;
+        char buf[4096];
+        size_t since_pause = 0;
+        auto last = std::chrono::steady_clock::now();
+        while(writing || !quiet_for(last))
+        {
+            struct pollfd pfd = {master, POLLIN, 0};
+            if(poll(&pfd, 1, 10) <= 0)
+                continue;
+            int n = static_cast<int>(read(master, buf, sizeof(buf)));
+            if(n <= 0)
+                continue;
+            last = std::chrono::steady_clock::now();
+
+            for(int off = 0; off < n; )
+            {
+                int k = static_cast<int>(write(master, buf + off, n - off));
+                if(k > 0)
+                    off += k;
+            }
+            acc.append(buf, n);
+            size_t pos;
+            while((pos = acc.find('\n')) != std::string::npos)
+            {
+                at_peer.line(acc.substr(0, pos + 1));
+                acc.erase(0, pos + 1);
+            }
+
+            since_pause += n;
+            if(since_pause > 65536) {
+                since_pause = 0;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+    });
+
+    // Reader: same port as the writers, reads the echo
+    MessageCheck at_reader;
+    std::thread reader([&] {
+        std::string l;
+        auto last = std::chrono::steady_clock::now();
+        while(writing || !quiet_for(last))
+        {
+            if(port.sreadline(l, 8192) > 0 && l[l.size() - 1] == '\n') {
+                at_reader.line(l);
+                l.clear();
+                last = std::chrono::steady_clock::now();
+            }
+        }
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for(int w = 0; w < writers; w++)
+    {
+        threads.emplace_back([&, w] {
+            for(int q = 0; q < messages; q++)
+                write_msg(port, make_message(w, q));
+        });
+    }
+    for(std::thread &th : threads)
+        th.join();
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    writing = false;
+    peer.join();
+    reader.join();
+
+    int total = writers * messages;
+    printf("%-14s %.2f s, peer %d/%d intact (%d bad), reader %d/%d intact (%d bad)\n",
+           label, secs, at_peer.good, total, at_peer.bad, at_reader.good, total, at_reader.bad);
+
+    port.sclose();
+    close(slave);
+    close(master);
+
+    return at_peer.good == total && at_peer.bad == 0 &&
+           at_reader.good == total && at_reader.bad == 0;
+}
+
+int main(int argc, char **argv)
+{
+    int writers = argc > 1 ? atoi(argv[1]) : 4;
+    int messages = argc > 2 ? atoi(argv[2]) : 20000;
+
+    // Each write() call is atomic, but a partial write under
+    // backpressure lets another thread's bytes in before the rest
+    run("plain write()", writers, messages, [](SerialPort &port, const std::string &msg) {
+        size_t off = 0;
+        while(off < msg.size())
+        {
+            ssize_t n = write(port.get_fd(), msg.data() + off, msg.size() - off);
+            if(n > 0)
+                off += n;
+            else
+                std::this_thread::yield();
+        }
+    });
+
+    bool ok = run("swrite()", writers, messages, [](SerialPort &port, const std::string &msg) {
+        if(port.swrite(msg) != static_cast<int>(msg.size()))
+            std::cerr << "short write" << std::endl;
+    });
+
+    return ok ? 0 : 1;
+}